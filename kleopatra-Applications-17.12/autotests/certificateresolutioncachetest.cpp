@@ -0,0 +1,169 @@
+/* This file is part of Kleopatra
+
+   Copyright (c) 2018 Intevation GmbH
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QTest>
+
+#include "crypto/certificateresolutioncache.h"
+
+#include <Libkleo/KeyCache>
+
+#include <gpgme++/key.h>
+
+#include <gpgme.h>
+
+#include <kmime/kmime_header_parsing.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace Kleo;
+using namespace Kleo::Crypto;
+
+static KMime::Types::Mailbox mailbox(const char *address)
+{
+    KMime::Types::Mailbox mb;
+    mb.fromUnicodeString(QString::fromLatin1(address));
+    return mb;
+}
+
+// a bare key that carries nothing but its fingerprint; gpgme_key_unref() frees both
+static GpgME::Key keyWithFingerprint(const char *fpr)
+{
+    const gpgme_key_t key = static_cast<gpgme_key_t>(std::calloc(1, sizeof(*key)));
+    key->_refs = 1;
+    key->fpr = strdup(fpr);
+    return GpgME::Key(key, false);
+}
+
+static const char alice[] = "0123456789ABCDEF0123456789ABCDEF01234567";
+static const char bob[] = "89ABCDEF0123456789ABCDEF0123456789ABCDEF";
+
+class CertificateResolutionCacheTest : public QObject
+{
+    Q_OBJECT
+private:
+    std::vector<KMime::Types::Mailbox> mailboxes() const
+    {
+        return { mailbox("Alice <alice@example.org>"), mailbox("bob@example.org") };
+    }
+
+    std::vector< std::vector<GpgME::Key> > keys() const
+    {
+        return { { keyWithFingerprint(alice) }, { keyWithFingerprint(bob) } };
+    }
+
+    bool isCached(const std::vector<KMime::Types::Mailbox> &mbs) const
+    {
+        std::vector< std::vector<GpgME::Key> > found;
+        return m_cache->lookup(CertificateResolutionCache::Encryption, GpgME::OpenPGP, mbs, found);
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        m_cache = CertificateResolutionCache::instance();
+        m_cache->setTimeToLive(5 * 60);
+        m_cache->clear();
+        m_cache->insert(CertificateResolutionCache::Encryption, GpgME::OpenPGP, mailboxes(), keys());
+    }
+
+    void cleanup()
+    {
+        m_cache.reset();
+    }
+
+    void testKeyIgnoresOrderAndCase()
+    {
+        const std::vector<KMime::Types::Mailbox> reversed = { mailbox("BOB@example.org"), mailbox("alice@EXAMPLE.org") };
+        std::vector< std::vector<GpgME::Key> > found;
+        QVERIFY(m_cache->lookup(CertificateResolutionCache::Encryption, GpgME::OpenPGP, reversed, found));
+        // the result follows the order of the lookup, not the one of the insert
+        QCOMPARE(found.size(), size_t(2));
+        QCOMPARE(found[0].size(), size_t(1));
+        QCOMPARE(found[1].size(), size_t(1));
+        QCOMPARE(qstrcmp(found[0].front().primaryFingerprint(), bob), 0);
+        QCOMPARE(qstrcmp(found[1].front().primaryFingerprint(), alice), 0);
+    }
+
+    void testKeyIncludesPurposeAndProtocol()
+    {
+        std::vector< std::vector<GpgME::Key> > found;
+        QVERIFY(!m_cache->lookup(CertificateResolutionCache::Signing, GpgME::OpenPGP, mailboxes(), found));
+        QVERIFY(!m_cache->lookup(CertificateResolutionCache::Encryption, GpgME::CMS, mailboxes(), found));
+        QVERIFY(!isCached({ mailbox("alice@example.org") }));
+        QVERIFY(isCached(mailboxes()));
+    }
+
+    void testEntriesExpire()
+    {
+        m_cache->setTimeToLive(1);
+        m_cache->insert(CertificateResolutionCache::Encryption, GpgME::OpenPGP, mailboxes(), keys());
+        QVERIFY(isCached(mailboxes()));
+        QTest::qWait(1100);
+        QVERIFY(!isCached(mailboxes()));
+    }
+
+    void testZeroTimeToLiveDisablesCache()
+    {
+        m_cache->setTimeToLive(0);
+        QCOMPARE(m_cache->statistics().entries, 0U);
+        m_cache->insert(CertificateResolutionCache::Encryption, GpgME::OpenPGP, mailboxes(), keys());
+        QVERIFY(!isCached(mailboxes()));
+    }
+
+    void testKeysMayHaveChangedDropsAll()
+    {
+        const unsigned int invalidations = m_cache->statistics().invalidations;
+        Q_EMIT KeyCache::mutableInstance()->keysMayHaveChanged();
+        QVERIFY(!isCached(mailboxes()));
+        QCOMPARE(m_cache->statistics().entries, 0U);
+        QCOMPARE(m_cache->statistics().invalidations, invalidations + 1);
+    }
+
+    void testAboutToRemoveDropsEntriesHoldingTheKey()
+    {
+        const std::vector<KMime::Types::Mailbox> carol = { mailbox("carol@example.org") };
+        const std::vector< std::vector<GpgME::Key> > carolKeys = { { keyWithFingerprint("FEDCBA9876543210FEDCBA9876543210FEDCBA98") } };
+        m_cache->insert(CertificateResolutionCache::Encryption, GpgME::OpenPGP, carol, carolKeys);
+
+        const unsigned int invalidations = m_cache->statistics().invalidations;
+        // fingerprints are compared case-insensitively
+        Q_EMIT KeyCache::mutableInstance()->aboutToRemove(keyWithFingerprint(QByteArray(bob).toLower().constData()));
+        QVERIFY(!isCached(mailboxes()));
+        QVERIFY(isCached(carol));
+        QCOMPARE(m_cache->statistics().invalidations, invalidations + 1);
+
+        // a key no entry holds changes nothing
+        Q_EMIT KeyCache::mutableInstance()->aboutToRemove(keyWithFingerprint(alice));
+        QVERIFY(isCached(carol));
+        QCOMPARE(m_cache->statistics().invalidations, invalidations + 1);
+    }
+
+private:
+    std::shared_ptr<CertificateResolutionCache> m_cache;
+};
+
+QTEST_GUILESS_MAIN(CertificateResolutionCacheTest)
+
+#include "certificateresolutioncachetest.moc"
@@ -0,0 +1,112 @@
+/* This file is part of Kleopatra
+
+   Copyright (c) 2018 Intevation GmbH
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QByteArray>
+#include <QList>
+#include <QObject>
+#include <QTest>
+
+#include "uiserver/commandstats.h"
+
+#include <thread>
+#include <vector>
+
+using namespace Kleo;
+
+static QByteArray findLine(const QByteArray &dump, const QByteArray &prefix)
+{
+    const QList<QByteArray> lines = dump.split('\n');
+    for (const QByteArray &line : lines) {
+        if (line.startsWith(prefix + ' ')) {
+            return line;
+        }
+    }
+    return QByteArray();
+}
+
+static quint64 field(const QByteArray &line, const QByteArray &name)
+{
+    const QList<QByteArray> fields = line.split(' ');
+    for (const QByteArray &f : fields) {
+        if (f.startsWith(name + '=')) {
+            return f.mid(name.size() + 1).toULongLong();
+        }
+    }
+    return 0;
+}
+
+class CommandStatsTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testPercentilesAreWithinBucketPrecision()
+    {
+        const std::shared_ptr<CommandStats> stats = CommandStats::instance();
+        CommandStats::Entry *const entry = stats->entry("TEST_PERCENTILES");
+        QVERIFY(entry);
+        QCOMPARE(stats->entry("TEST_PERCENTILES"), entry);
+
+        for (int i = 1; i <= 1000; ++i) {
+            CommandStats::record(entry, CommandStats::Total, i);
+        }
+
+        const QByteArray line = findLine(stats->dump(), "TEST_PERCENTILES total");
+        QVERIFY(!line.isEmpty());
+        QCOMPARE(field(line, "count"), quint64(1000));
+        QCOMPARE(field(line, "max_us"), quint64(1000));
+        QCOMPARE(field(line, "mean_us"), quint64(500));
+        // buckets have 1/8 relative width and report their lower bound
+        QVERIFY(field(line, "p50_us") <= 500 && field(line, "p50_us") >= 500 * 7 / 8);
+        QVERIFY(field(line, "p99_us") <= 990 && field(line, "p99_us") >= 990 * 7 / 8);
+    }
+
+    void testConcurrentRecordingLosesNothing()
+    {
+        static const int numThreads = 8;
+        static const int perThread = 10000;
+
+        const std::shared_ptr<CommandStats> stats = CommandStats::instance();
+        CommandStats::Entry *const entry = stats->entry("TEST_CONCURRENT");
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; ++t) {
+            threads.emplace_back([entry, t]() {
+                for (int i = 0; i < perThread; ++i) {
+                    CommandStats::record(entry, CommandStats::Crypto, t * 1000 + i % 1000);
+                    CommandStats::countCompleted(entry, i % 10 == 0);
+                }
+            });
+        }
+        for (std::thread &t : threads) {
+            t.join();
+        }
+
+        const QByteArray dump = stats->dump();
+        const QByteArray summary = findLine(dump, "TEST_CONCURRENT");
+        QCOMPARE(field(summary, "completed"), quint64(numThreads * perThread));
+        QCOMPARE(field(summary, "errors"), quint64(numThreads * perThread / 10));
+        const QByteArray crypto = findLine(dump, "TEST_CONCURRENT crypto");
+        QCOMPARE(field(crypto, "count"), quint64(numThreads * perThread));
+        QCOMPARE(field(crypto, "max_us"), quint64((numThreads - 1) * 1000 + 999));
+    }
+};
+
+QTEST_GUILESS_MAIN(CommandStatsTest)
+
+#include "commandstatstest.moc"
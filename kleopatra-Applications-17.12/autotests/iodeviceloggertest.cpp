@@ -0,0 +1,85 @@
+/* This file is part of Kleopatra
+
+   Copyright (c) 2018 Intevation GmbH
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QObject>
+#include <QTest>
+
+#include "utils/asynclogdevice.h"
+#include "utils/iodevicelogger.h"
+
+#include <memory>
+
+using namespace Kleo;
+
+class IODeviceLoggerTest : public QObject
+{
+    Q_OBJECT
+private:
+    static std::shared_ptr<QBuffer> openBuffer(const QByteArray &data = QByteArray())
+    {
+        const std::shared_ptr<QBuffer> buffer(new QBuffer);
+        buffer->setData(data);
+        buffer->open(QIODevice::ReadWrite);
+        return buffer;
+    }
+
+private Q_SLOTS:
+    void testMirrorIsWrittenAsynchronously()
+    {
+        const QByteArray data(100000, 'a');
+        const std::shared_ptr<QBuffer> mirror = openBuffer();
+        {
+            IODeviceLogger logger(openBuffer(data));
+            logger.setReadLogDevice(std::make_shared<AsyncLogDevice>(mirror));
+            while (!logger.atEnd()) {
+                QVERIFY(logger.read(4096).size() > 0);
+            }
+        }
+        AsyncLogDevice::flush();
+        QCOMPARE(mirror->data(), data);
+    }
+
+    void testLogLimitOnlyMirrorsHeader()
+    {
+        const std::shared_ptr<QBuffer> mirror = openBuffer();
+        IODeviceLogger logger(openBuffer());
+        logger.setWriteLogDevice(mirror);
+        logger.setLogLimit(10);
+        QCOMPARE(logger.write("0123456"), qint64(7));
+        QCOMPARE(logger.write("789abcdef"), qint64(9));
+        QCOMPARE(mirror->data(), QByteArray("0123456789"));
+    }
+
+    void testSummaryCountsChunks()
+    {
+        IODeviceLogger logger(openBuffer());
+        logger.write(QByteArray(1, 'x'));
+        logger.write(QByteArray(1000, 'x'));
+        logger.write(QByteArray(1024, 'x'));
+        const QString summary = logger.summary();
+        QVERIFY2(summary.startsWith(QLatin1String("read=0/0 written=2025/3 ")), qPrintable(summary));
+        QVERIFY2(summary.endsWith(QLatin1String("chunks=<=1:1,<=1024:2")), qPrintable(summary));
+    }
+};
+
+QTEST_GUILESS_MAIN(IODeviceLoggerTest)
+
+#include "iodeviceloggertest.moc"
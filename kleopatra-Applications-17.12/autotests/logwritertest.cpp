@@ -0,0 +1,204 @@
+/* This file is part of Kleopatra
+
+   Copyright (c) 2018 Intevation GmbH
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include "utils/logwriter.h"
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace Kleo;
+
+static QList<QByteArray> readLines(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QList<QByteArray>();
+    }
+    QList<QByteArray> lines = file.readAll().split('\n');
+    if (!lines.empty() && lines.back().isEmpty()) {
+        lines.pop_back();
+    }
+    return lines;
+}
+
+class LogWriterTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testConcurrentPostsAreWrittenOrCounted()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.path() + QLatin1String("/kleo-log");
+        FILE *const file = fopen(QFile::encodeName(fileName).constData(), "a");
+        QVERIFY(file);
+
+        static const int numThreads = 4;
+        static const int numMessages = 5000;
+        LogWriter::Statistics stats;
+        {
+            LogWriter writer(file, fileName);
+            writer.setRateLimit(0);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < numThreads; ++t) {
+                threads.emplace_back([&writer, t]() {
+                    for (int i = 0; i < numMessages; ++i) {
+                        writer.post(QtDebugMsg, "test", "msg " + QByteArray::number(t) + ' ' + QByteArray::number(i) + '\n');
+                    }
+                });
+            }
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+            writer.flush();
+            stats = writer.statistics();
+        }
+        fclose(file);
+
+        QCOMPARE(stats.written + stats.dropped, quint64(numThreads * numMessages));
+        int messages = 0;
+        for (const QByteArray &line : readLines(fileName)) {
+            if (line.startsWith("msg ")) {
+                ++messages;
+            }
+        }
+        QCOMPARE(quint64(messages), stats.written);
+    }
+
+    void testRateLimitIsPerCategory()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.path() + QLatin1String("/kleo-log");
+        FILE *const file = fopen(QFile::encodeName(fileName).constData(), "a");
+        QVERIFY(file);
+
+        static const char noisy[] = "noisy";
+        static const char quiet[] = "quiet";
+        LogWriter writer(file, fileName);
+        writer.setRateLimit(10);
+        int accepted = 0;
+        for (int i = 0; i < 100; ++i) {
+            accepted += writer.post(QtDebugMsg, noisy, "noisy\n");
+        }
+        accepted += writer.post(QtDebugMsg, quiet, "quiet\n");
+        writer.flush();
+
+        // all in the same second unless the machine is very slow
+        QVERIFY(accepted >= 11 && accepted <= 21);
+        QCOMPARE(writer.statistics().suppressed, quint64(101 - accepted));
+        QVERIFY(readLines(fileName).contains("quiet"));
+        fclose(file);
+    }
+
+    void testWarningsAreNotLimited()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.path() + QLatin1String("/kleo-log");
+        FILE *const file = fopen(QFile::encodeName(fileName).constData(), "a");
+        QVERIFY(file);
+
+        static const char category[] = "test";
+        LogWriter writer(file, fileName);
+        writer.setRateLimit(10);
+        for (int i = 0; i < 20; ++i) {
+            writer.post(QtDebugMsg, category, "debug\n");
+        }
+        for (int i = 0; i < 50; ++i) {
+            QVERIFY(writer.post(QtWarningMsg, category, "warning\n"));
+            QVERIFY(writer.post(QtCriticalMsg, category, "critical\n"));
+        }
+
+        // more warnings than the ring holds are written, not dropped
+        for (int i = 0; i < 5000; ++i) {
+            QVERIFY(writer.post(QtWarningMsg, category, "flood\n"));
+        }
+        writer.flush();
+
+        const LogWriter::Statistics stats = writer.statistics();
+        QCOMPARE(stats.dropped, quint64(0));
+        const QList<QByteArray> lines = readLines(fileName);
+        QCOMPARE(lines.count("warning"), 50);
+        QCOMPARE(lines.count("critical"), 50);
+        QCOMPARE(lines.count("flood"), 5000);
+        // only the debug messages count against the limit
+        QVERIFY(stats.suppressed <= 10);
+        QCOMPARE(quint64(lines.count("debug")) + stats.suppressed, quint64(20));
+        fclose(file);
+    }
+
+    void testFatalIsWrittenImmediately()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.path() + QLatin1String("/kleo-log");
+        FILE *const file = fopen(QFile::encodeName(fileName).constData(), "a");
+        QVERIFY(file);
+
+        LogWriter writer(file, fileName);
+        writer.setRateLimit(1);
+        QVERIFY(writer.post(QtDebugMsg, "test", "before\n"));
+        QVERIFY(writer.post(QtFatalMsg, "test", "fatal\n"));
+
+        // no flush(): the fatal message and everything before it are
+        // on disk as soon as post() returns
+        const QList<QByteArray> lines = readLines(fileName);
+        QVERIFY(lines.contains("before"));
+        QCOMPARE(lines.back(), QByteArray("fatal"));
+        fclose(file);
+    }
+
+    void testRotationKeepsBackups()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.path() + QLatin1String("/kleo-log");
+        FILE *const file = fopen(QFile::encodeName(fileName).constData(), "a");
+        QVERIFY(file);
+        {
+            LogWriter writer(file, fileName);
+            writer.setRateLimit(0);
+            writer.setMaxFileSize(1000);
+            writer.setMaxBackups(2);
+            const QByteArray line(99, 'x');
+            for (int round = 0; round < 4; ++round) {
+                for (int i = 0; i < 11; ++i) {
+                    QVERIFY(writer.post(QtDebugMsg, nullptr, line + '\n'));
+                }
+                writer.flush();
+            }
+            QCOMPARE(writer.statistics().rotations, quint64(4));
+        }
+        fclose(file);
+
+        QVERIFY(QFile::exists(fileName + QLatin1String(".1")));
+        QVERIFY(QFile::exists(fileName + QLatin1String(".2")));
+        QVERIFY(!QFile::exists(fileName + QLatin1String(".3")));
+        QCOMPARE(readLines(fileName + QLatin1String(".1")).size(), 11);
+        QCOMPARE(QFile(fileName).size(), qint64(0));
+    }
+};
+
+QTEST_GUILESS_MAIN(LogWriterTest)
+
+#include "logwritertest.moc"
@@ -0,0 +1,103 @@
+/* This file is part of Kleopatra
+
+   Copyright (c) 2018 Intevation GmbH
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QDir>
+#include <QObject>
+#include <QStringList>
+#include <QTest>
+
+#include "utils/sumfileindex.h"
+
+using namespace Kleo;
+
+class SumFileIndexTest : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testEachSumFileIsParsedOnce()
+    {
+        static const int numFiles = 5000;
+
+        QStringList sha256Files, md5Files;
+        for (int i = 0; i < numFiles; ++i) {
+            sha256Files.push_back(QStringLiteral("file%1.tar.gz").arg(i));
+        }
+        md5Files.push_back(QStringLiteral("only-in-md5sums"));
+
+        int listed = 0, parsed = 0;
+        SumFileIndex index(
+            [&listed](const QDir &) {
+                ++listed;
+                return QStringList() << QStringLiteral("SHA256SUMS") << QStringLiteral("MD5SUMS");
+            },
+            [&](const QString &sumFile) {
+                ++parsed;
+                return sumFile.endsWith(QLatin1String("SHA256SUMS")) ? sha256Files : md5Files;
+            },
+            Qt::CaseSensitive);
+
+        const QDir dir(QStringLiteral("/srv/mirror"));
+        for (const QString &file : qAsConst(sha256Files)) {
+            QCOMPARE(index.findSumFile(dir, file), QStringLiteral("SHA256SUMS"));
+        }
+        QCOMPARE(index.findSumFile(dir, QStringLiteral("only-in-md5sums")), QStringLiteral("MD5SUMS"));
+        QVERIFY(index.findSumFile(dir, QStringLiteral("not-listed")).isEmpty());
+
+        QCOMPARE(listed, 1);
+        QCOMPARE(parsed, 2);
+    }
+
+    void testDirectoriesAreIndexedSeparately()
+    {
+        int parsed = 0;
+        SumFileIndex index(
+            [](const QDir &) {
+                return QStringList() << QStringLiteral("SHA1SUMS");
+            },
+            [&parsed](const QString &sumFile) {
+                ++parsed;
+                return QStringList() << QDir(sumFile).dirName();
+            },
+            Qt::CaseSensitive);
+
+        QCOMPARE(index.findSumFile(QDir(QStringLiteral("/a")), QStringLiteral("SHA1SUMS")), QStringLiteral("SHA1SUMS"));
+        QCOMPARE(index.findSumFile(QDir(QStringLiteral("/b")), QStringLiteral("SHA1SUMS")), QStringLiteral("SHA1SUMS"));
+        QCOMPARE(index.findSumFile(QDir(QStringLiteral("/a")), QStringLiteral("SHA1SUMS")), QStringLiteral("SHA1SUMS"));
+        QCOMPARE(parsed, 2);
+    }
+
+    void testCaseInsensitive()
+    {
+        SumFileIndex index(
+            [](const QDir &) {
+                return QStringList() << QStringLiteral("SHA256SUMS");
+            },
+            [](const QString &) {
+                return QStringList() << QStringLiteral("Setup.EXE");
+            },
+            Qt::CaseInsensitive);
+
+        const QDir dir(QStringLiteral("/srv/mirror"));
+        QCOMPARE(index.findSumFile(dir, QStringLiteral("setup.exe")), QStringLiteral("SHA256SUMS"));
+    }
+};
+
+QTEST_GUILESS_MAIN(SumFileIndexTest)
+
+#include "sumfileindextest.moc"
@@ -0,0 +1,132 @@
+/* This file is part of Kleopatra
+
+   Copyright (c) 2018 Intevation GmbH
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QObject>
+#include <QSignalSpy>
+#include <QTest>
+
+#include "crypto/taskcollection.h"
+#include "crypto/task_p.h"
+#include "utils/gnupg-helper.h"
+
+#include <memory>
+#include <vector>
+
+using namespace Kleo::Crypto;
+
+// TaskCollection falls back to a busy indicator for GnuPG before 2.1.15.
+// Don't let the gpgconf installed on the host decide what is tested.
+bool Kleo::engineIsVersion(int, int, int, GpgME::Engine)
+{
+    return true;
+}
+
+class TaskCollectionTest : public QObject
+{
+    Q_OBJECT
+private:
+    static void reportProgress(Task *task, int processed, int total)
+    {
+        QMetaObject::invokeMethod(task, "setProgress", Qt::DirectConnection,
+                                  Q_ARG(QString, QString()), Q_ARG(int, processed), Q_ARG(int, total));
+    }
+
+    static std::vector<std::shared_ptr<Task> > makeTasks(int count)
+    {
+        std::vector<std::shared_ptr<Task> > tasks;
+        tasks.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            tasks.push_back(std::make_shared<SimpleTask>(QStringLiteral("task %1").arg(i)));
+        }
+        return tasks;
+    }
+
+private Q_SLOTS:
+    void testProgressIsAggregated()
+    {
+        TaskCollection collection;
+        const std::vector<std::shared_ptr<Task> > tasks = makeTasks(4);
+        collection.setTasks(tasks);
+        QSignalSpy spy(&collection, &TaskCollection::progress);
+
+        reportProgress(tasks[0].get(), 10, 100);
+        reportProgress(tasks[1].get(), 20, 100);
+        reportProgress(tasks[2].get(), 30, 100);
+        QCOMPARE(spy.count(), 0);   // throttled
+        QTRY_COMPARE(spy.count(), 1);
+        // one task still has no total: busy indicator
+        QCOMPARE(spy.last().at(1).toInt(), 0);
+        QCOMPARE(spy.last().at(2).toInt(), 0);
+
+        reportProgress(tasks[3].get(), 40, 100);
+        reportProgress(tasks[0].get(), 100, 100);   // 10 -> 100 must not be added twice
+        QTRY_COMPARE(spy.count(), 2);
+        QCOMPARE(spy.last().at(1).toInt(), 1000 * 190 / 400);
+        QCOMPARE(spy.last().at(2).toInt(), 1000);
+    }
+
+    void testProgressIsThrottled()
+    {
+        TaskCollection collection;
+        const std::vector<std::shared_ptr<Task> > tasks = makeTasks(1000);
+        collection.setTasks(tasks);
+        QSignalSpy spy(&collection, &TaskCollection::progress);
+
+        for (int round = 1; round <= 10; ++round) {
+            for (const std::shared_ptr<Task> &task : tasks) {
+                reportProgress(task.get(), round, 10);
+            }
+        }
+        QCOMPARE(spy.count(), 0);
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.last().at(1).toInt(), 1000);
+    }
+
+    // Compare the rows by hand, e.g. with -tickcounter: walking all tasks
+    // on every progress report would make the 5000 tasks row ~10 times
+    // slower than the 500 tasks row.
+    void benchmarkProgressReport_data()
+    {
+        QTest::addColumn<int>("numTasks");
+        QTest::newRow("500 tasks") << 500;
+        QTest::newRow("5000 tasks") << 5000;
+    }
+
+    void benchmarkProgressReport()
+    {
+        QFETCH(int, numTasks);
+        static const int numTicks = 20000;
+        TaskCollection collection;
+        const std::vector<std::shared_ptr<Task> > tasks = makeTasks(numTasks);
+        collection.setTasks(tasks);
+        for (const std::shared_ptr<Task> &task : tasks) {
+            reportProgress(task.get(), 0, numTicks);
+        }
+
+        QBENCHMARK {
+            for (int i = 0; i < numTicks; ++i) {
+                reportProgress(tasks[i % numTasks].get(), i, numTicks);
+            }
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(TaskCollectionTest)
+
+#include "taskcollectiontest.moc"
@@ -237,6 +237,9 @@ void CryptoOperationsConfigWidget::setupGui()
     fileGrpLay->addWidget(mPGPFileExtCB);
     fileGrpLay->addWidget(mAutoDecryptVerifyCB);
     fileGrpLay->addWidget(mASCIIArmorCB);
+    mChecksumCacheCB = new QCheckBox(i18n("Do not re-hash files that did not change since their checksums were last verified."));
+    mChecksumCacheCB->setToolTip(i18nc("@info", "Uncheck this option to re-hash all files the next time checksums are verified."));
+    fileGrpLay->addWidget(mChecksumCacheCB);
 
     QGridLayout *comboLay = new QGridLayout;
     QLabel *chkLabel = new QLabel(i18n("Checksum program to use when creating checksum files:"));
@@ -273,6 +276,7 @@ void CryptoOperationsConfigWidget::setupGui()
     connect(mPGPFileExtCB, &QCheckBox::toggled, this, &CryptoOperationsConfigWidget::changed);
     connect(mAutoDecryptVerifyCB, &QCheckBox::toggled, this, &CryptoOperationsConfigWidget::changed);
     connect(mASCIIArmorCB, &QCheckBox::toggled, this, &CryptoOperationsConfigWidget::changed);
+    connect(mChecksumCacheCB, &QCheckBox::toggled, this, &CryptoOperationsConfigWidget::changed);
 }
 
 CryptoOperationsConfigWidget::~CryptoOperationsConfigWidget() {}
@@ -289,6 +293,8 @@ void CryptoOperationsConfigWidget::defaults()
     mPGPFileExtCB->setChecked(filePrefs.usePGPFileExt());
     mAutoDecryptVerifyCB->setChecked(filePrefs.autoDecryptVerify());
 
+    mChecksumCacheCB->setChecked(false);
+
     if (mChecksumDefinitionCB->count()) {
         mChecksumDefinitionCB->setCurrentIndex(0);
     }
@@ -312,6 +318,10 @@ void CryptoOperationsConfigWidget::load()
     mAutoDecryptVerifyCB->setChecked(filePrefs.autoDecryptVerify());
     mASCIIArmorCB->setChecked(filePrefs.addASCIIArmor());
 
+    // read by ChecksumCache::isEnabled(), which the KCM cannot link against:
+    const KConfigGroup checksumGroup(KSharedConfig::openConfig(), "ChecksumOperations");
+    mChecksumCacheCB->setChecked(checksumGroup.readEntry("use-verification-cache", false));
+
     const std::vector< std::shared_ptr<ChecksumDefinition> > cds = ChecksumDefinition::getChecksumDefinitions();
     const std::shared_ptr<ChecksumDefinition> default_cd = ChecksumDefinition::getDefaultChecksumDefinition(cds);
 
@@ -358,6 +368,10 @@ void CryptoOperationsConfigWidget::save()
     filePrefs.setAutoDecryptVerify(mAutoDecryptVerifyCB->isChecked());
     filePrefs.setAddASCIIArmor(mASCIIArmorCB->isChecked());
 
+    KConfigGroup checksumGroup(KSharedConfig::openConfig(), "ChecksumOperations");
+    checksumGroup.writeEntry("use-verification-cache", mChecksumCacheCB->isChecked());
+    checksumGroup.sync();
+
     const int idx = mChecksumDefinitionCB->currentIndex();
     if (idx >= 0) {
         const std::shared_ptr<ChecksumDefinition> cd = qvariant_cast< std::shared_ptr<ChecksumDefinition> >(mChecksumDefinitionCB->itemData(idx));
@@ -0,0 +1,266 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    crypto/certificateresolutioncache.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "certificateresolutioncache.h"
+
+#include <Libkleo/KeyCache>
+
+#include <gpgme++/key.h>
+
+#include <kmime/kmime_header_parsing.h>
+
+#include "kleopatra_debug.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+
+#include <algorithm>
+
+using namespace Kleo;
+using namespace Kleo::Crypto;
+
+namespace
+{
+struct Entry {
+    QElapsedTimer age;
+    QHash< QString, std::vector<GpgME::Key> > keys; // normalized address -> keys
+};
+
+static const unsigned int DEFAULT_TTL = 5 * 60;
+static const int MAX_ENTRIES = 1000;
+
+static QString normalized(const KMime::Types::Mailbox &mb)
+{
+    return mb.addrSpec().asString().trimmed().toLower();
+}
+}
+
+class CertificateResolutionCache::Private
+{
+    friend class ::Kleo::Crypto::CertificateResolutionCache;
+public:
+    Private()
+        : keyCache(KeyCache::instance()),
+          mutex(),
+          entries(),
+          ttl(DEFAULT_TTL),
+          hits(0),
+          misses(0),
+          invalidations(0)
+    {
+    }
+
+    static bool holds(const Entry &entry, const char *fpr)
+    {
+        for (auto it = entry.keys.cbegin(); it != entry.keys.cend(); ++it) {
+            for (const GpgME::Key &key : it.value()) {
+                if (qstricmp(key.primaryFingerprint(), fpr) == 0) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    static QString cacheKey(Purpose purpose, GpgME::Protocol proto, const std::vector<KMime::Types::Mailbox> &mailboxes)
+    {
+        QStringList addresses;
+        addresses.reserve(mailboxes.size());
+        for (const KMime::Types::Mailbox &mb : mailboxes) {
+            addresses.push_back(normalized(mb));
+        }
+        addresses.sort();
+        addresses.removeDuplicates();
+        return QString::number(purpose) + QLatin1Char(':') + QString::number(proto) + QLatin1Char(':') + addresses.join(QLatin1Char(','));
+    }
+
+    bool isExpired(const Entry &entry) const
+    {
+        return entry.age.hasExpired(qint64(ttl) * 1000);
+    }
+
+    void evict()
+    {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (isExpired(*it)) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        while (entries.size() >= MAX_ENTRIES) {
+            auto oldest = entries.begin();
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if (it->age.elapsed() > oldest->age.elapsed()) {
+                    oldest = it;
+                }
+            }
+            entries.erase(oldest);
+        }
+    }
+
+private:
+    const std::shared_ptr<const KeyCache> keyCache;
+    mutable QMutex mutex;
+    QHash<QString, Entry> entries;
+    unsigned int ttl;
+    unsigned int hits, misses, invalidations;
+};
+
+std::shared_ptr<CertificateResolutionCache> CertificateResolutionCache::instance()
+{
+    static std::weak_ptr<CertificateResolutionCache> self;
+    try {
+        return std::shared_ptr<CertificateResolutionCache>(self);
+    } catch (const std::bad_weak_ptr &) {
+        const std::shared_ptr<CertificateResolutionCache> s(new CertificateResolutionCache);
+        self = s;
+        return s;
+    }
+}
+
+CertificateResolutionCache::CertificateResolutionCache()
+    : QObject(), d(new Private)
+{
+    connect(d->keyCache.get(), &KeyCache::keysMayHaveChanged,
+            this, &CertificateResolutionCache::slotKeysMayHaveChanged);
+    connect(d->keyCache.get(), &KeyCache::aboutToRemove,
+            this, &CertificateResolutionCache::slotAboutToRemove);
+}
+
+CertificateResolutionCache::~CertificateResolutionCache() {}
+
+bool CertificateResolutionCache::lookup(Purpose purpose, GpgME::Protocol proto, const std::vector<KMime::Types::Mailbox> &mailboxes,
+                                        std::vector< std::vector<GpgME::Key> > &keys)
+{
+    const QString key = Private::cacheKey(purpose, proto, mailboxes);
+    const QMutexLocker locker(&d->mutex);
+    const auto it = d->entries.constFind(key);
+    if (it == d->entries.cend() || d->isExpired(*it)) {
+        ++d->misses;
+        return false;
+    }
+    ++d->hits;
+    keys.clear();
+    keys.reserve(mailboxes.size());
+    for (const KMime::Types::Mailbox &mb : mailboxes) {
+        keys.push_back(it->keys.value(normalized(mb)));
+    }
+    return true;
+}
+
+void CertificateResolutionCache::insert(Purpose purpose, GpgME::Protocol proto, const std::vector<KMime::Types::Mailbox> &mailboxes,
+                                        const std::vector< std::vector<GpgME::Key> > &keys)
+{
+    if (keys.size() != mailboxes.size() || !d->ttl) {
+        return;
+    }
+    Entry entry;
+    entry.age.start();
+    for (size_t i = 0; i < mailboxes.size(); ++i) {
+        entry.keys.insert(normalized(mailboxes[i]), keys[i]);
+    }
+
+    const QString key = Private::cacheKey(purpose, proto, mailboxes);
+    const QMutexLocker locker(&d->mutex);
+    if (!d->entries.contains(key)) {
+        d->evict();
+    }
+    d->entries.insert(key, entry);
+}
+
+void CertificateResolutionCache::clear()
+{
+    const QMutexLocker locker(&d->mutex);
+    d->entries.clear();
+}
+
+void CertificateResolutionCache::setTimeToLive(unsigned int seconds)
+{
+    const QMutexLocker locker(&d->mutex);
+    d->ttl = seconds;
+    if (!seconds) {
+        d->entries.clear();
+    }
+}
+
+unsigned int CertificateResolutionCache::timeToLive() const
+{
+    const QMutexLocker locker(&d->mutex);
+    return d->ttl;
+}
+
+CertificateResolutionCache::Statistics CertificateResolutionCache::statistics() const
+{
+    const QMutexLocker locker(&d->mutex);
+    const Statistics stats = { d->hits, d->misses, d->invalidations, static_cast<unsigned int>(d->entries.size()) };
+    return stats;
+}
+
+void CertificateResolutionCache::slotKeysMayHaveChanged()
+{
+    const QMutexLocker locker(&d->mutex);
+    if (d->entries.empty()) {
+        return;
+    }
+    qCDebug(KLEOPATRA_LOG) << "CertificateResolutionCache: keys may have changed, dropping" << d->entries.size() << "entries";
+    d->entries.clear();
+    ++d->invalidations;
+}
+
+void CertificateResolutionCache::slotAboutToRemove(const GpgME::Key &key)
+{
+    const char *const fpr = key.primaryFingerprint();
+    if (!fpr) {
+        return;
+    }
+    const QMutexLocker locker(&d->mutex);
+    int dropped = 0;
+    for (auto it = d->entries.begin(); it != d->entries.end();) {
+        if (Private::holds(*it, fpr)) {
+            it = d->entries.erase(it);
+            ++dropped;
+        } else {
+            ++it;
+        }
+    }
+    if (dropped) {
+        qCDebug(KLEOPATRA_LOG) << "CertificateResolutionCache:" << fpr << "is about to be removed, dropping" << dropped << "entries";
+        ++d->invalidations;
+    }
+}
+
+#include "moc_certificateresolutioncache.cpp"
@@ -0,0 +1,122 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    crypto/certificateresolutioncache.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_CRYPTO_CERTIFICATERESOLUTIONCACHE_H__
+#define __KLEOPATRA_CRYPTO_CERTIFICATERESOLUTIONCACHE_H__
+
+#include <QObject>
+
+#include <utils/pimpl_ptr.h>
+
+#include <gpgme++/global.h>
+
+#include <memory>
+#include <vector>
+
+namespace GpgME
+{
+class Key;
+}
+
+namespace KMime
+{
+namespace Types
+{
+class Mailbox;
+}
+}
+
+namespace Kleo
+{
+namespace Crypto
+{
+
+/*!
+  Remembers which keys were found for a set of mailboxes, so that
+  messages to the same recipients don't repeat the lookup, across
+  UI-server connections and sessions.
+
+  Entries are keyed by purpose, protocol and the set of normalized
+  (lower-cased) addresses; the order of the mailboxes doesn't matter.
+  They expire after timeToLive() seconds. All of them are dropped when
+  the KeyCache reports that keys may have changed, and those holding a
+  key are dropped as soon as the KeyCache is about to remove that key.
+*/
+class CertificateResolutionCache : public QObject
+{
+    Q_OBJECT
+public:
+    enum Purpose {
+        Encryption,
+        Signing
+    };
+
+    static std::shared_ptr<CertificateResolutionCache> instance();
+
+    ~CertificateResolutionCache();
+
+    //! On a hit, \a keys[i] are the keys for \a mailboxes[i].
+    bool lookup(Purpose purpose, GpgME::Protocol proto, const std::vector<KMime::Types::Mailbox> &mailboxes,
+                std::vector< std::vector<GpgME::Key> > &keys);
+    //! \a keys[i] must be the keys for \a mailboxes[i].
+    void insert(Purpose purpose, GpgME::Protocol proto, const std::vector<KMime::Types::Mailbox> &mailboxes,
+                const std::vector< std::vector<GpgME::Key> > &keys);
+
+    void clear();
+
+    void setTimeToLive(unsigned int seconds);
+    unsigned int timeToLive() const;
+
+    struct Statistics {
+        unsigned int hits;
+        unsigned int misses;
+        unsigned int invalidations;
+        unsigned int entries;
+    };
+    Statistics statistics() const;
+
+private Q_SLOTS:
+    void slotKeysMayHaveChanged();
+    void slotAboutToRemove(const GpgME::Key &key);
+
+private:
+    CertificateResolutionCache();
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+}
+}
+
+#endif // __KLEOPATRA_CRYPTO_CERTIFICATERESOLUTIONCACHE_H__
@@ -33,6 +33,7 @@
 #include <config-kleopatra.h>
 
 #include "decryptverifytask.h"
+#include "signerkeyresolver.h"
 
 #include <QGpgME/Protocol>
 #include <QGpgME/VerifyOpaqueJob>
@@ -280,6 +281,22 @@ static QString formatDate(const QDateTime &dt)
 {
     return QLocale().toString(dt);
 }
+// GnuPG / GpgME does not provide Key information in a verification
+// result; the Key object is a dummy just holding the KeyID. The real
+// key is taken from the KeyCache, which SignerKeyResolver populated
+// before the result was created.
+static Key signerKey(const Signature &sig)
+{
+    const char *const fpr = sig.fingerprint();
+    if (fpr && *fpr && KeyCache::instance()->initialized()) {
+        const Key &key = KeyCache::instance()->findByKeyIDOrFingerprint(fpr);
+        if (!key.isNull()) {
+            return key;
+        }
+    }
+    return sig.key();
+}
+
 static QString formatSigningInformation(const Signature &sig)
 {
     if (sig.isNull()) {
@@ -287,7 +304,7 @@ static QString formatSigningInformation(const Signature &sig)
     }
     const QDateTime dt = sig.creationTime() != 0 ? QDateTime::fromTime_t(sig.creationTime()) : QDateTime();
     QString text;
-    Key key = sig.key();
+    Key key = signerKey(sig);
     if (dt.isValid()) {
         text = i18nc("1 is a date", "Signature created on %1", formatDate(dt)) + QStringLiteral("<br>");
     }
@@ -353,16 +370,6 @@ static UserID findUserIDByMailbox(const Key &key, const Mailbox &mbox)
     return UserID();
 }
 
-static void updateKeys(const VerificationResult &result) {
-    // This little hack works around the problem that GnuPG / GpgME does not
-    // provide Key information in a verification result. The Key object is
-    // a dummy just holding the KeyID. This hack ensures that all available
-    // keys are fetched from the backend and are populated
-    for (const auto sig: result.signatures()) {
-        // Update key information
-        sig.key(true, true);
-    }
-}
 
 }
 
@@ -447,10 +454,10 @@ static QString formatVerificationResultOverview(const VerificationResult &res, c
     //Good signature:
     QString text;
     if (sigs.size() == 1) {
-        text = i18n("<b>Valid signature by %1</b>", renderKeyEMailOnlyNameAsFallback(sigs[0].key()));
+        text = i18n("<b>Valid signature by %1</b>", renderKeyEMailOnlyNameAsFallback(signerKey(sigs[0])));
         if (info.conflicts())
             text += i18n("<br/><b>Warning:</b> The sender's mail address is not stored in the %1 used for signing.",
-                         renderKeyLink(QLatin1String(sigs[0].key().primaryFingerprint()), i18n("certificate")));
+                         renderKeyLink(QLatin1String(signerKey(sigs[0]).primaryFingerprint()), i18n("certificate")));
     } else {
         text = i18np("<b>Valid signature.</b>", "<b>%1 valid signatures.</b>", sigs.size());
         if (info.conflicts()) {
@@ -482,7 +489,7 @@ static QString formatSignature(const Signature &sig, const DecryptVerifyResult::
     }
 
     const QString text = formatSigningInformation(sig) + QLatin1String("<br/>");
-    const Key key = sig.key();
+    const Key key = signerKey(sig);
 
     // Green
     if (sig.summary() & Signature::Valid) {
@@ -647,8 +654,25 @@ public:
         m_outputLabel(output),
         m_auditLog(auditLog),
         m_parentTask(QPointer<Task>(parentTask)),
-        m_informativeSender(informativeSender)
+        m_informativeSender(informativeSender),
+        m_keysResolved(false),
+        m_overviewFormatted(false),
+        m_detailsFormatted(false)
     {
+        const std::shared_ptr<const KeyCache> cache = KeyCache::instance();
+        // resolve the keys while they are in the cache anyway instead of
+        // on every repaint; if the cache isn't ready yet, don't wait for it
+        if (cache->initialized()) {
+            resolveKeys();
+        }
+        // e.g. the signer's key was imported after the verification
+        m_keysChangedConnection = QObject::connect(cache.get(), &KeyCache::keysMayHaveChanged,
+                                                   [this]() { invalidateKeys(); });
+    }
+
+    ~Private()
+    {
+        QObject::disconnect(m_keysChangedConnection);
     }
 
     QString label() const
@@ -657,6 +681,19 @@ public:
     }
 
     DecryptVerifyResult::SenderInfo makeSenderInfo() const;
+    const std::vector<Key> &recipients() const;
+    void resolveKeys() const;
+
+    void invalidateKeys()
+    {
+        m_keysResolved = false;
+        m_signers.clear();
+        m_recipients.clear();
+        m_overviewFormatted = false;
+        m_overview.clear();
+        m_detailsFormatted = false;
+        m_details.clear();
+    }
 
     bool isDecryptOnly() const
     {
@@ -681,11 +718,43 @@ public:
     const AuditLog m_auditLog;
     QPointer <Task> m_parentTask;
     const Mailbox m_informativeSender;
+
+    // computed on first use, and again after the key cache changed
+    QMetaObject::Connection m_keysChangedConnection;
+    mutable bool m_keysResolved;
+    mutable std::vector<Key> m_signers;
+    mutable std::vector<Key> m_recipients;
+    mutable bool m_overviewFormatted;
+    mutable QString m_overview;
+    mutable bool m_detailsFormatted;
+    mutable QString m_details;
 };
 
+void DecryptVerifyResult::Private::resolveKeys() const
+{
+    if (m_keysResolved) {
+        return;
+    }
+    m_keysResolved = true;
+    const std::shared_ptr<const KeyCache> cache = KeyCache::instance();
+    if (!m_verificationResult.isNull()) {
+        m_signers = cache->findSigners(m_verificationResult);
+    }
+    if (!m_decryptionResult.isNull()) {
+        m_recipients = cache->findRecipients(m_decryptionResult);
+    }
+}
+
 DecryptVerifyResult::SenderInfo DecryptVerifyResult::Private::makeSenderInfo() const
 {
-    return SenderInfo(m_informativeSender, KeyCache::instance()->findSigners(m_verificationResult));
+    resolveKeys();
+    return SenderInfo(m_informativeSender, m_signers);
+}
+
+const std::vector<Key> &DecryptVerifyResult::Private::recipients() const
+{
+    resolveKeys();
+    return m_recipients;
 }
 
 std::shared_ptr<DecryptVerifyResult> AbstractDecryptVerifyTask::fromDecryptResult(const DecryptionResult &dr, const QByteArray &plaintext, const AuditLog &auditLog)
@@ -831,6 +900,9 @@ DecryptVerifyResult::DecryptVerifyResult(DecryptVerifyOperation type,
 
 QString DecryptVerifyResult::overview() const
 {
+    if (d->m_overviewFormatted) {
+        return d->m_overview;
+    }
     QString ov;
     if (d->isDecryptOnly()) {
         ov += formatDecryptionResultOverview(d->m_decryptionResult);
@@ -843,20 +915,27 @@ QString DecryptVerifyResult::overview() const
         // Avoid ugly breaks
         ov = QStringLiteral("<br>") + ov;
     }
-    return i18nc("label: result example: foo.sig: Verification failed. ", "%1: %2", d->label(), ov);
+    d->m_overview = i18nc("label: result example: foo.sig: Verification failed. ", "%1: %2", d->label(), ov);
+    d->m_overviewFormatted = true;
+    return d->m_overview;
 }
 
 QString DecryptVerifyResult::details() const
 {
-    if (d->isDecryptOnly()) {
-        return formatDecryptionResultDetails(d->m_decryptionResult, KeyCache::instance()->findRecipients(d->m_decryptionResult), errorString(), false);
+    if (d->m_detailsFormatted) {
+        return d->m_details;
     }
-    if (d->isVerifyOnly()) {
-        return formatVerificationResultDetails(d->m_verificationResult, d->makeSenderInfo(), errorString());
+    if (d->isDecryptOnly()) {
+        d->m_details = formatDecryptionResultDetails(d->m_decryptionResult, d->recipients(), errorString(), false);
+    } else if (d->isVerifyOnly()) {
+        d->m_details = formatVerificationResultDetails(d->m_verificationResult, d->makeSenderInfo(), errorString());
+    } else {
+        d->m_details = formatDecryptVerifyResultDetails(d->m_decryptionResult,
+                                                        d->m_verificationResult, d->recipients(),
+                                                        d->makeSenderInfo(), errorString());
     }
-    return formatDecryptVerifyResultDetails(d->m_decryptionResult,
-                                            d->m_verificationResult, KeyCache::instance()->findRecipients(
-                                                    d->m_decryptionResult), d->makeSenderInfo(), errorString());
+    d->m_detailsFormatted = true;
+    return d->m_details;
 }
 
 bool DecryptVerifyResult::hasError() const
@@ -921,9 +1000,10 @@ class DecryptVerifyTask::Private
 {
     DecryptVerifyTask *const q;
 public:
-    explicit Private(DecryptVerifyTask *qq) : q(qq), m_backend(nullptr), m_protocol(UnknownProtocol)  {}
+    explicit Private(DecryptVerifyTask *qq) : q(qq), m_backend(nullptr), m_protocol(UnknownProtocol), m_signerKeyResolver(SignerKeyResolver::instance())  {}
 
     void slotResult(const DecryptionResult &, const VerificationResult &, const QByteArray &);
+    void processResult(const DecryptionResult &, const VerificationResult &, const QByteArray &, const AuditLog &);
 
     void registerJob(QGpgME::DecryptVerifyJob *job)
     {
@@ -939,6 +1019,7 @@ public:
     std::shared_ptr<Output> m_output;
     const QGpgME::Protocol *m_backend;
     Protocol m_protocol;
+    const std::shared_ptr<SignerKeyResolver> m_signerKeyResolver;
 };
 
 void DecryptVerifyTask::Private::emitResult(const std::shared_ptr<DecryptVerifyResult> &result)
@@ -949,13 +1030,19 @@ void DecryptVerifyTask::Private::emitResult(const std::shared_ptr<DecryptVerifyR
 
 void DecryptVerifyTask::Private::slotResult(const DecryptionResult &dr, const VerificationResult &vr, const QByteArray &plainText)
 {
-    updateKeys(vr);
+    const AuditLog auditLog = auditLogFromSender(q->sender());
+    m_signerKeyResolver->resolve(vr, m_backend, q, [this, dr, vr, plainText, auditLog]() {
+        processResult(dr, vr, plainText, auditLog);
+    });
+}
+
+void DecryptVerifyTask::Private::processResult(const DecryptionResult &dr, const VerificationResult &vr, const QByteArray &plainText, const AuditLog &auditLog)
+{
     {
         std::stringstream ss;
         ss << dr << '\n' << vr;
         qCDebug(KLEOPATRA_LOG) << ss.str().c_str();
     }
-    const AuditLog auditLog = auditLogFromSender(q->sender());
     if (dr.error().code() || vr.error().code()) {
         m_output->cancel();
     } else {
@@ -1242,9 +1329,10 @@ class VerifyOpaqueTask::Private
 {
     VerifyOpaqueTask *const q;
 public:
-    explicit Private(VerifyOpaqueTask *qq) : q(qq), m_backend(nullptr), m_protocol(UnknownProtocol)  {}
+    explicit Private(VerifyOpaqueTask *qq) : q(qq), m_backend(nullptr), m_protocol(UnknownProtocol), m_signerKeyResolver(SignerKeyResolver::instance())  {}
 
     void slotResult(const VerificationResult &, const QByteArray &);
+    void processResult(const VerificationResult &, const QByteArray &, const AuditLog &);
 
     void registerJob(QGpgME::VerifyOpaqueJob *job)
     {
@@ -1260,6 +1348,7 @@ public:
     std::shared_ptr<Output> m_output;
     const QGpgME::Protocol *m_backend;
     Protocol m_protocol;
+    const std::shared_ptr<SignerKeyResolver> m_signerKeyResolver;
 };
 
 void VerifyOpaqueTask::Private::emitResult(const std::shared_ptr<DecryptVerifyResult> &result)
@@ -1270,13 +1359,19 @@ void VerifyOpaqueTask::Private::emitResult(const std::shared_ptr<DecryptVerifyRe
 
 void VerifyOpaqueTask::Private::slotResult(const VerificationResult &result, const QByteArray &plainText)
 {
-    updateKeys(result);
+    const AuditLog auditLog = auditLogFromSender(q->sender());
+    m_signerKeyResolver->resolve(result, m_backend, q, [this, result, plainText, auditLog]() {
+        processResult(result, plainText, auditLog);
+    });
+}
+
+void VerifyOpaqueTask::Private::processResult(const VerificationResult &result, const QByteArray &plainText, const AuditLog &auditLog)
+{
     {
         std::stringstream ss;
         ss << result;
         qCDebug(KLEOPATRA_LOG) << ss.str().c_str();
     }
-    const AuditLog auditLog = auditLogFromSender(q->sender());
     if (result.error().code()) {
         m_output->cancel();
     } else {
@@ -1398,9 +1493,10 @@ class VerifyDetachedTask::Private
 {
     VerifyDetachedTask *const q;
 public:
-    explicit Private(VerifyDetachedTask *qq) : q(qq), m_backend(nullptr), m_protocol(UnknownProtocol) {}
+    explicit Private(VerifyDetachedTask *qq) : q(qq), m_backend(nullptr), m_protocol(UnknownProtocol), m_signerKeyResolver(SignerKeyResolver::instance()) {}
 
     void slotResult(const VerificationResult &);
+    void processResult(const VerificationResult &, const AuditLog &);
 
     void registerJob(QGpgME::VerifyDetachedJob *job)
     {
@@ -1415,6 +1511,7 @@ public:
     std::shared_ptr<Input> m_input, m_signedData;
     const QGpgME::Protocol *m_backend;
     Protocol m_protocol;
+    const std::shared_ptr<SignerKeyResolver> m_signerKeyResolver;
 };
 
 void VerifyDetachedTask::Private::emitResult(const std::shared_ptr<DecryptVerifyResult> &result)
@@ -1425,13 +1522,19 @@ void VerifyDetachedTask::Private::emitResult(const std::shared_ptr<DecryptVerify
 
 void VerifyDetachedTask::Private::slotResult(const VerificationResult &result)
 {
-    updateKeys(result);
+    const AuditLog auditLog = auditLogFromSender(q->sender());
+    m_signerKeyResolver->resolve(result, m_backend, q, [this, result, auditLog]() {
+        processResult(result, auditLog);
+    });
+}
+
+void VerifyDetachedTask::Private::processResult(const VerificationResult &result, const AuditLog &auditLog)
+{
     {
         std::stringstream ss;
         ss << result;
         qCDebug(KLEOPATRA_LOG) << ss.str().c_str();
     }
-    const AuditLog auditLog = auditLogFromSender(q->sender());
     try {
         kleo_assert(!result.isNull());
         emitResult(q->fromVerifyDetachedResult(result, auditLog));
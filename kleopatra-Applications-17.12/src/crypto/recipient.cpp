@@ -33,6 +33,7 @@
 #include <config-kleopatra.h>
 
 #include "recipient.h"
+#include "certificateresolutioncache.h"
 
 #include <Libkleo/Predicates>
 #include <Libkleo/KeyCache>
@@ -45,6 +46,8 @@
 
 #include <gpgme++/key.h>
 
+#include <QStringList>
+
 using namespace Kleo;
 using namespace Kleo::Crypto;
 using namespace KMime::Types;
@@ -86,7 +89,17 @@ public:
         // ### also fill up to a certain number of keys with those
         // ### that don't match, for the case where there's a low
         // ### total number of keys
-        const std::vector<Key> encrypt = KeyCache::instance()->findEncryptionKeysByMailbox(mb.addrSpec().asString());
+        setEncryptionKeys(KeyCache::instance()->findEncryptionKeysByMailbox(mb.addrSpec().asString()));
+    }
+
+    Private(const Mailbox &mb, const std::vector<Key> &encrypt)
+        : mailbox(mb)
+    {
+        setEncryptionKeys(encrypt);
+    }
+
+    void setEncryptionKeys(const std::vector<Key> &encrypt)
+    {
         kdtools::separate_if(encrypt.cbegin(), encrypt.cend(),
                              std::back_inserter(pgpEncryptionKeys), std::back_inserter(cmsEncryptionKeys),
                              [](const Key &key) { return key.protocol() == OpenPGP; });
@@ -106,6 +119,31 @@ Recipient::Recipient(const Mailbox &mb)
 
 }
 
+// static
+std::vector<Recipient> Recipient::fromMailboxes(const std::vector<Mailbox> &mailboxes)
+{
+    const std::shared_ptr<CertificateResolutionCache> cache = CertificateResolutionCache::instance();
+    std::vector< std::vector<Key> > keys;
+    if (!cache->lookup(CertificateResolutionCache::Encryption, UnknownProtocol, mailboxes, keys)) {
+        QStringList addresses;
+        addresses.reserve(mailboxes.size());
+        for (const Mailbox &mb : mailboxes) {
+            addresses.push_back(mb.addrSpec().asString());
+        }
+        keys = KeyCache::instance()->findEncryptionKeysByMailboxes(addresses);
+        cache->insert(CertificateResolutionCache::Encryption, UnknownProtocol, mailboxes, keys);
+    }
+
+    std::vector<Recipient> result;
+    result.reserve(mailboxes.size());
+    for (size_t i = 0; i < mailboxes.size(); ++i) {
+        Recipient recipient;
+        recipient.d = std::make_shared<Private>(mailboxes[i], keys[i]);
+        result.push_back(recipient);
+    }
+    return result;
+}
+
 void Recipient::detach()
 {
     if (d && !d.unique()) {
@@ -63,6 +63,9 @@ public:
     Recipient() : d() {}
     explicit Recipient(const KMime::Types::Mailbox &mailbox);
 
+    //! Same as creating a Recipient for each mailbox, but looks up all of them at once.
+    static std::vector<Recipient> fromMailboxes(const std::vector<KMime::Types::Mailbox> &mailboxes);
+
     void swap(Recipient &other)
     {
         d.swap(other.d);
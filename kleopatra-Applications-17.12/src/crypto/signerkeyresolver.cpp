@@ -0,0 +1,289 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    crypto/signerkeyresolver.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "signerkeyresolver.h"
+
+#include <Libkleo/KeyCache>
+
+#include <QGpgME/Protocol>
+#include <QGpgME/KeyListJob>
+
+#include <gpgme++/key.h>
+#include <gpgme++/keylistresult.h>
+#include <gpgme++/verificationresult.h>
+
+#include "kleopatra_debug.h"
+
+#include <QHash>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+#include <algorithm>
+
+using namespace Kleo;
+using namespace Kleo::Crypto;
+using namespace GpgME;
+
+namespace
+{
+struct Waiter {
+    QPointer<QObject> receiver;
+    std::function<void()> callback;
+};
+
+// all waiters whose cache misses were listed by the same set of jobs
+struct Batch {
+    std::vector<Waiter> waiters;
+    int jobsPending = 0;
+};
+
+struct RunningJob {
+    std::shared_ptr<Batch> batch;
+    QStringList patterns;
+};
+
+struct Deferred {
+    VerificationResult result;
+    const QGpgME::Protocol *backend;
+    Waiter waiter;
+};
+}
+
+class SignerKeyResolver::Private
+{
+    friend class ::Kleo::Crypto::SignerKeyResolver;
+    SignerKeyResolver *const q;
+public:
+    explicit Private(SignerKeyResolver *qq)
+        : q(qq),
+          cache(KeyCache::instance()),
+          queuedBatch(),
+          flushScheduled(false)
+    {
+        stats.lookups = stats.cacheHits = stats.keyListJobs = 0;
+    }
+
+private:
+    void flush();
+    void notify(const std::shared_ptr<Batch> &batch);
+    void resolveDeferred();
+
+private:
+    const std::shared_ptr<const KeyCache> cache;
+    Statistics stats;
+    std::shared_ptr<Batch> queuedBatch;
+    QHash<const QGpgME::Protocol *, QSet<QString> > queuedPatterns;
+    bool flushScheduled;
+    QHash<QObject *, RunningJob> runningJobs;
+    // signers a previous listing didn't find; forgotten whenever the
+    // KeyCache reports a change or is about to remove a key
+    QSet<QString> unavailable;
+    std::vector<Deferred> waitingForCache;
+};
+
+std::shared_ptr<SignerKeyResolver> SignerKeyResolver::instance()
+{
+    static std::weak_ptr<SignerKeyResolver> self;
+    try {
+        return std::shared_ptr<SignerKeyResolver>(self);
+    } catch (const std::bad_weak_ptr &) {
+        const std::shared_ptr<SignerKeyResolver> s(new SignerKeyResolver);
+        self = s;
+        return s;
+    }
+}
+
+SignerKeyResolver::SignerKeyResolver()
+    : QObject(), d(new Private(this))
+{
+    connect(d->cache.get(), &KeyCache::keysMayHaveChanged,
+            this, [this]() { d->unavailable.clear(); });
+    connect(d->cache.get(), &KeyCache::aboutToRemove,
+            this, [this]() { d->unavailable.clear(); });
+    connect(d->cache.get(), &KeyCache::keyListingDone,
+            this, [this]() { d->resolveDeferred(); });
+}
+
+SignerKeyResolver::~SignerKeyResolver() {}
+
+SignerKeyResolver::Statistics SignerKeyResolver::statistics() const
+{
+    return d->stats;
+}
+
+void SignerKeyResolver::resolve(const VerificationResult &result, const QGpgME::Protocol *backend,
+                                QObject *receiver, const std::function<void()> &callback)
+{
+    const Waiter waiter = { receiver, callback };
+
+    if (!d->cache->initialized()) {
+        // looking up keys now would block until the cache is populated
+        const Deferred deferred = { result, backend, waiter };
+        d->waitingForCache.push_back(deferred);
+        KeyCache::mutableInstance()->startKeyListing();
+        return;
+    }
+
+    const std::vector<Signature> sigs = result.signatures();
+    const unsigned int withFingerprint = std::count_if(sigs.cbegin(), sigs.cend(), [](const Signature &sig) {
+        return sig.fingerprint() && *sig.fingerprint();
+    });
+    d->stats.lookups += withFingerprint;
+
+    const std::vector<Key> signers = d->cache->findSigners(result);
+    if (signers.size() >= withFingerprint) {
+        d->stats.cacheHits += withFingerprint;
+        callback();
+        return;
+    }
+
+    QStringList misses;
+    for (const Signature &sig : sigs) {
+        const char *const fpr = sig.fingerprint();
+        if (!fpr || !*fpr) {
+            continue;
+        }
+        const QString pattern = QString::fromLatin1(fpr);
+        if (!d->cache->findByKeyIDOrFingerprint(fpr).isNull() || d->unavailable.contains(pattern)) {
+            ++d->stats.cacheHits;
+        } else {
+            misses.push_back(pattern);
+        }
+    }
+    if (misses.empty() || !backend) {
+        callback();
+        return;
+    }
+
+    if (!d->queuedBatch) {
+        d->queuedBatch = std::make_shared<Batch>();
+    }
+    d->queuedBatch->waiters.push_back(waiter);
+    QSet<QString> &patterns = d->queuedPatterns[backend];
+    for (const QString &pattern : qAsConst(misses)) {
+        patterns.insert(pattern);
+    }
+    if (!d->flushScheduled) {
+        d->flushScheduled = true;
+        QTimer::singleShot(0, this, [this]() { d->flush(); });
+    }
+}
+
+void SignerKeyResolver::Private::flush()
+{
+    flushScheduled = false;
+    const std::shared_ptr<Batch> batch = queuedBatch;
+    queuedBatch.reset();
+    const auto patternsByBackend = queuedPatterns;
+    queuedPatterns.clear();
+    if (!batch) {
+        return;
+    }
+
+    for (auto it = patternsByBackend.cbegin(), end = patternsByBackend.cend(); it != end; ++it) {
+        QGpgME::KeyListJob *const job = it.key()->keyListJob(/*remote*/false, /*includeSigs*/false, /*validate*/true);
+        if (!job) {
+            continue;
+        }
+        // old style connect, see KeyCache::RefreshKeysJob
+        connect(job, SIGNAL(result(GpgME::KeyListResult,std::vector<GpgME::Key>)),
+                q, SLOT(slotKeyListResult(GpgME::KeyListResult,std::vector<GpgME::Key>)));
+        const QStringList patterns = it->toList();
+        const Error err = job->start(patterns, /*secretOnly*/false);
+        if (err || err.isCanceled()) {
+            qCDebug(KLEOPATRA_LOG) << "SignerKeyResolver: failed to start key listing:" << err.asString();
+            continue;
+        }
+        const RunningJob running = { batch, patterns };
+        runningJobs.insert(job, running);
+        ++batch->jobsPending;
+        ++stats.keyListJobs;
+        qCDebug(KLEOPATRA_LOG) << "SignerKeyResolver: listing" << patterns.size() << "signer keys for"
+                               << batch->waiters.size() << "results";
+    }
+
+    if (!batch->jobsPending) {
+        notify(batch);
+    }
+}
+
+void SignerKeyResolver::slotKeyListResult(const KeyListResult &result, const std::vector<Key> &keys)
+{
+    const auto it = d->runningJobs.find(sender());
+    if (it == d->runningJobs.end()) {
+        return;
+    }
+    const RunningJob running = *it;
+    d->runningJobs.erase(it);
+
+    if (!keys.empty()) {
+        KeyCache::mutableInstance()->insert(keys);
+    }
+    if (!result.error() && !result.error().isCanceled()) {
+        for (const QString &pattern : running.patterns) {
+            if (d->cache->findByKeyIDOrFingerprint(pattern.toLatin1().constData()).isNull()) {
+                d->unavailable.insert(pattern);
+            }
+        }
+    }
+
+    if (--running.batch->jobsPending == 0) {
+        d->notify(running.batch);
+    }
+}
+
+void SignerKeyResolver::Private::notify(const std::shared_ptr<Batch> &batch)
+{
+    for (const Waiter &waiter : qAsConst(batch->waiters)) {
+        if (waiter.receiver) {
+            waiter.callback();
+        }
+    }
+}
+
+void SignerKeyResolver::Private::resolveDeferred()
+{
+    if (!cache->initialized()) {
+        return;
+    }
+    std::vector<Deferred> deferred;
+    deferred.swap(waitingForCache);
+    for (const Deferred &item : deferred) {
+        if (item.waiter.receiver) {
+            q->resolve(item.result, item.backend, item.waiter.receiver, item.waiter.callback);
+        }
+    }
+}
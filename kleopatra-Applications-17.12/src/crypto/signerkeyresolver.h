@@ -0,0 +1,109 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    crypto/signerkeyresolver.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_CRYPTO_SIGNERKEYRESOLVER_H__
+#define __KLEOPATRA_CRYPTO_SIGNERKEYRESOLVER_H__
+
+#include <QObject>
+
+#include <utils/pimpl_ptr.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace GpgME
+{
+class Key;
+class KeyListResult;
+class VerificationResult;
+}
+
+namespace QGpgME
+{
+class Protocol;
+}
+
+namespace Kleo
+{
+namespace Crypto
+{
+
+/*!
+  Makes sure the keys of the signers of a verification result are in
+  the KeyCache without blocking the GUI thread.
+
+  Signers are looked up in the KeyCache first. Cache misses of all
+  results passed to resolve() within one event loop iteration are
+  listed by a single asynchronous KeyListJob per backend, and the keys
+  found are inserted into the KeyCache.
+*/
+class SignerKeyResolver : public QObject
+{
+    Q_OBJECT
+public:
+    static std::shared_ptr<SignerKeyResolver> instance();
+
+    ~SignerKeyResolver();
+
+    /*!
+      Calls \a callback once the signers of \a result are in the
+      KeyCache or are known to be unavailable. If all signers are
+      cached already, \a callback is called before this function
+      returns. If \a receiver is destroyed first, \a callback is not
+      called at all.
+    */
+    void resolve(const GpgME::VerificationResult &result, const QGpgME::Protocol *backend,
+                 QObject *receiver, const std::function<void()> &callback);
+
+    struct Statistics {
+        unsigned int lookups;
+        unsigned int cacheHits;
+        unsigned int keyListJobs;
+    };
+    Statistics statistics() const;
+
+private Q_SLOTS:
+    void slotKeyListResult(const GpgME::KeyListResult &result, const std::vector<GpgME::Key> &keys);
+
+private:
+    SignerKeyResolver();
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+}
+}
+
+#endif // __KLEOPATRA_CRYPTO_SIGNERKEYRESOLVER_H__
@@ -40,6 +40,9 @@
 
 #include "utils/gnupg-helper.h"
 
+#include <QHash>
+#include <QTimer>
+
 #include <algorithm>
 #include <map>
 
@@ -57,19 +60,34 @@ public:
     void taskProgress(const QString &, int, int);
     void taskResult(const std::shared_ptr<const Task::Result> &);
     void taskStarted();
+    void updateProgress(const Task *task);
     void calculateAndEmitProgress();
+    void emitProgress();
+
+    struct TaskProgress {
+        quint64 current;
+        quint64 total;
+    };
 
     std::map<int, std::shared_ptr<Task> > m_tasks;
-    mutable quint64 m_totalProgress;
-    mutable quint64 m_progress;
+    // last progress seen per task; the sums are kept up to date by delta
+    QHash<int, TaskProgress> m_taskProgress;
+    quint64 m_totalProgress;
+    quint64 m_progress;
+    unsigned int m_nTasksWithoutTotal;
+    QTimer m_progressTimer;
     unsigned int m_nCompleted;
     QString m_lastProgressMessage;
     bool m_errorOccurred;
     bool m_doneEmitted;
 };
 
-TaskCollection::Private::Private(TaskCollection *qq) : q(qq), m_totalProgress(0), m_progress(0), m_nCompleted(0), m_errorOccurred(false), m_doneEmitted(false)
+TaskCollection::Private::Private(TaskCollection *qq) : q(qq), m_totalProgress(0), m_progress(0), m_nTasksWithoutTotal(0), m_nCompleted(0), m_errorOccurred(false), m_doneEmitted(false)
 {
+    // don't update the progress bar more often than the screen does
+    m_progressTimer.setSingleShot(true);
+    m_progressTimer.setInterval(1000 / 30);
+    QObject::connect(&m_progressTimer, &QTimer::timeout, q, [this]() { emitProgress(); });
 }
 
 int TaskCollection::numberOfCompletedTasks() const
@@ -91,20 +109,45 @@ bool TaskCollection::allTasksCompleted() const
 void TaskCollection::Private::taskProgress(const QString &msg, int, int)
 {
     m_lastProgressMessage = msg;
+    updateProgress(qobject_cast<const Task *>(q->sender()));
     calculateAndEmitProgress();
 }
 
+void TaskCollection::Private::updateProgress(const Task *task)
+{
+    if (!task) {
+        return;
+    }
+    const auto it = m_taskProgress.find(task->id());
+    if (it == m_taskProgress.end()) {
+        return;
+    }
+    const TaskProgress now = { static_cast<quint64>(task->currentProgress()), static_cast<quint64>(task->totalProgress()) };
+    if (!it->total && now.total) {
+        --m_nTasksWithoutTotal;
+    } else if (it->total && !now.total) {
+        ++m_nTasksWithoutTotal;
+    }
+    m_progress = m_progress - it->current + now.current;
+    m_totalProgress = m_totalProgress - it->total + now.total;
+    *it = now;
+}
+
 void TaskCollection::Private::taskResult(const std::shared_ptr<const Task::Result> &result)
 {
     Q_ASSERT(result);
     ++m_nCompleted;
     m_errorOccurred = m_errorOccurred || result->hasError();
     m_lastProgressMessage.clear();
-    calculateAndEmitProgress();
+    updateProgress(qobject_cast<const Task *>(q->sender()));
     Q_EMIT q->result(result);
     if (!m_doneEmitted && q->allTasksCompleted()) {
-        Q_EMIT q->done();
         m_doneEmitted = true;
+        // final state, don't hold it back
+        emitProgress();
+        Q_EMIT q->done();
+    } else {
+        calculateAndEmitProgress();
     }
 }
 
@@ -114,20 +157,27 @@ void TaskCollection::Private::taskStarted()
     Q_ASSERT(task);
     Q_ASSERT(m_tasks.find(task->id()) != m_tasks.end());
     Q_EMIT q->started(m_tasks[task->id()]);
-    calculateAndEmitProgress(); // start Knight-Rider-Mode right away (gpgsm doesn't report _any_ progress).
+    updateProgress(task);
     if (m_doneEmitted) {
         // We are not done anymore, one task restarted.
         m_nCompleted--;
         m_doneEmitted = false;
     }
+    if (!m_progressTimer.isActive()) {
+        emitProgress(); // start Knight-Rider-Mode right away (gpgsm doesn't report _any_ progress).
+    }
 }
 
 void TaskCollection::Private::calculateAndEmitProgress()
 {
-    typedef std::map<int, std::shared_ptr<Task> >::const_iterator ConstIterator;
+    if (!m_progressTimer.isActive()) {
+        m_progressTimer.start();
+    }
+}
 
-    quint64 total = 0;
-    quint64 processed = 0;
+void TaskCollection::Private::emitProgress()
+{
+    m_progressTimer.stop();
 
     static bool haveWorkingProgress = engineIsVersion(2, 1, 15);
     if (!haveWorkingProgress) {
@@ -143,30 +193,14 @@ void TaskCollection::Private::calculateAndEmitProgress()
         return;
     }
 
-    bool unknowable = false;
-    for (ConstIterator it = m_tasks.begin(), end = m_tasks.end(); it != end; ++it) {
-        // Sum up progress and totals
-        const std::shared_ptr<Task> &i = it->second;
-        Q_ASSERT(i);
-        if (!i->totalProgress()) {
-            // There still might be jobs for which we don't know the progress.
-            qCDebug(KLEOPATRA_LOG) << "Task: " << i->label() << " has no total progress set. ";
-            unknowable = true;
-            break;
-        }
-        processed += i->currentProgress();
-        total += i->totalProgress();
-    }
-
-    m_totalProgress = total;
-    m_progress = processed;
-    if (!unknowable && processed && total >= processed) {
+    // There still might be jobs for which we don't know the progress.
+    const bool unknowable = m_nTasksWithoutTotal > 0;
+    if (!unknowable && m_progress && m_totalProgress >= m_progress) {
         // Scale down to avoid range issues.
         int scaled = 1000 * (m_progress / static_cast<double>(m_totalProgress));
-        qCDebug(KLEOPATRA_LOG) << "Collection Progress: " << scaled << " total: " << 1000;
         Q_EMIT q->progress(m_lastProgressMessage, scaled, 1000);
     } else {
-        if (total < processed) {
+        if (m_totalProgress < m_progress) {
             qCDebug(KLEOPATRA_LOG) << "Total progress is smaller then current progress.";
         }
         // Knight rider.
@@ -214,6 +248,12 @@ void TaskCollection::setTasks(const std::vector<std::shared_ptr<Task> > &tasks)
     for (const std::shared_ptr<Task> &i : tasks) {
         Q_ASSERT(i);
         d->m_tasks[i->id()] = i;
+        if (!d->m_taskProgress.contains(i->id())) {
+            const Private::TaskProgress progress = { 0, 0 };
+            d->m_taskProgress.insert(i->id(), progress);
+            ++d->m_nTasksWithoutTotal;
+            d->updateProgress(i.get());
+        }
         connect(i.get(), SIGNAL(progress(QString,int,int)),
                 this, SLOT(taskProgress(QString,int,int)));
         connect(i.get(), SIGNAL(result(std::shared_ptr<const Kleo::Crypto::Task::Result>)),
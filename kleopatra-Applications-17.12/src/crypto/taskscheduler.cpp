@@ -0,0 +1,248 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    crypto/taskscheduler.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "taskscheduler.h"
+#include "task.h"
+
+#include "kleopatra_debug.h"
+
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+using namespace Kleo;
+using namespace Kleo::Crypto;
+
+namespace
+{
+struct QueueEntry {
+    unsigned long long inputSize;
+    quint64 sequence;
+    std::shared_ptr<Task> task;
+};
+
+// smallest inputs first, FIFO for inputs of equal size
+bool operator<(const QueueEntry &lhs, const QueueEntry &rhs)
+{
+    return lhs.inputSize < rhs.inputSize
+           || (lhs.inputSize == rhs.inputSize && lhs.sequence < rhs.sequence);
+}
+}
+
+class TaskScheduler::Private
+{
+    friend class ::Kleo::Crypto::TaskScheduler;
+    TaskScheduler *const q;
+public:
+    explicit Private(TaskScheduler *qq);
+
+private:
+    void schedule();
+    void taskDone();
+    bool isIdle() const;
+    void releaseIfIdle();
+
+private:
+    // keeps the instance alive while it has queued or running tasks,
+    // even when nobody else holds it anymore
+    std::shared_ptr<TaskScheduler> m_self;
+    unsigned int m_limits[NumResources];
+    std::set<QueueEntry> m_queues[NumResources];
+    std::map<QObject *, Resource> m_running;
+    unsigned int m_inFlight[NumResources];
+    quint64 m_sequence;
+};
+
+TaskScheduler::Private::Private(TaskScheduler *qq)
+    : q(qq), m_self(), m_running(), m_sequence(0)
+{
+    m_limits[CPU] = std::max(1, QThread::idealThreadCount());
+    m_limits[IO] = 2;
+    m_limits[Card] = 1;
+    std::fill(m_inFlight, m_inFlight + NumResources, 0U);
+}
+
+std::shared_ptr<const TaskScheduler> TaskScheduler::instance()
+{
+    return mutableInstance();
+}
+
+std::shared_ptr<TaskScheduler> TaskScheduler::mutableInstance()
+{
+    static std::weak_ptr<TaskScheduler> self;
+    try {
+        return std::shared_ptr<TaskScheduler>(self);
+    } catch (const std::bad_weak_ptr &) {
+        const std::shared_ptr<TaskScheduler> s(new TaskScheduler);
+        self = s;
+        return s;
+    }
+}
+
+TaskScheduler::TaskScheduler() : QObject(), d(new Private(this))
+{
+}
+
+TaskScheduler::~TaskScheduler() {}
+
+void TaskScheduler::setLimit(Resource resource, unsigned int limit)
+{
+    Q_ASSERT(resource < NumResources);
+    d->m_limits[resource] = std::max(1U, limit);
+    d->schedule();
+}
+
+unsigned int TaskScheduler::limit(Resource resource) const
+{
+    Q_ASSERT(resource < NumResources);
+    return d->m_limits[resource];
+}
+
+void TaskScheduler::enqueue(const std::shared_ptr<Task> &task, Resource resource)
+{
+    Q_ASSERT(task);
+    Q_ASSERT(resource < NumResources);
+    const QueueEntry entry = { task->inputSize(), d->m_sequence++, task };
+    d->m_queues[resource].insert(entry);
+    if (!d->m_self) {
+        d->m_self = mutableInstance();
+    }
+    d->schedule();
+    Q_EMIT statisticsChanged();
+}
+
+bool TaskScheduler::dequeue(const std::shared_ptr<Task> &task)
+{
+    for (std::set<QueueEntry> &queue : d->m_queues) {
+        const auto it = std::find_if(queue.begin(), queue.end(),
+                                     [&task](const QueueEntry &entry) { return entry.task == task; });
+        if (it != queue.end()) {
+            queue.erase(it);
+            Q_EMIT statisticsChanged();
+            d->releaseIfIdle();
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int TaskScheduler::queueDepth(Resource resource) const
+{
+    Q_ASSERT(resource < NumResources);
+    return d->m_queues[resource].size();
+}
+
+unsigned int TaskScheduler::queueDepth() const
+{
+    unsigned int depth = 0;
+    for (const std::set<QueueEntry> &queue : d->m_queues) {
+        depth += queue.size();
+    }
+    return depth;
+}
+
+unsigned int TaskScheduler::inFlight(Resource resource) const
+{
+    Q_ASSERT(resource < NumResources);
+    return d->m_inFlight[resource];
+}
+
+unsigned int TaskScheduler::inFlight() const
+{
+    return d->m_running.size();
+}
+
+void TaskScheduler::Private::schedule()
+{
+    for (int r = 0; r < NumResources; ++r) {
+        std::set<QueueEntry> &queue = m_queues[r];
+        while (!queue.empty() && m_inFlight[r] < m_limits[r]) {
+            const std::shared_ptr<Task> task = queue.begin()->task;
+            queue.erase(queue.begin());
+
+            m_running[task.get()] = static_cast<Resource>(r);
+            ++m_inFlight[r];
+            // the result signal is emitted asynchronously, also on errors
+            q->connect(task.get(), SIGNAL(result(std::shared_ptr<const Kleo::Crypto::Task::Result>)),
+                       q, SLOT(taskDone()));
+            q->connect(task.get(), SIGNAL(destroyed()),
+                       q, SLOT(taskDone()));
+            qCDebug(KLEOPATRA_LOG) << "TaskScheduler: starting" << task->label()
+                                   << "resource:" << r << "in flight:" << m_inFlight[r] << '/' << m_limits[r]
+                                   << "queued:" << queue.size();
+            task->start();
+        }
+    }
+}
+
+void TaskScheduler::Private::taskDone()
+{
+    // no qobject_cast: sender() may be half-destroyed already
+    QObject *const task = q->sender();
+    const auto it = m_running.find(task);
+    if (it == m_running.end()) {
+        return;
+    }
+    QObject::disconnect(task, nullptr, q, nullptr);
+    Q_ASSERT(m_inFlight[it->second] > 0);
+    --m_inFlight[it->second];
+    m_running.erase(it);
+    schedule();
+    Q_EMIT q->statisticsChanged();
+    releaseIfIdle();
+}
+
+bool TaskScheduler::Private::isIdle() const
+{
+    return m_running.empty()
+           && std::all_of(m_queues, m_queues + NumResources,
+                          [](const std::set<QueueEntry> &queue) { return queue.empty(); });
+}
+
+void TaskScheduler::Private::releaseIfIdle()
+{
+    if (!m_self || !isIdle()) {
+        return;
+    }
+    // this may be the last reference; drop it from the event loop rather
+    // than deleting the scheduler from within one of its own slots
+    std::shared_ptr<TaskScheduler> self;
+    self.swap(m_self);
+    QTimer::singleShot(0, [self]() {});
+}
+
+#include "moc_taskscheduler.cpp"
@@ -0,0 +1,106 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    crypto/taskscheduler.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_CRYPTO_TASKSCHEDULER_H__
+#define __KLEOPATRA_CRYPTO_TASKSCHEDULER_H__
+
+#include <QObject>
+
+#include <utils/pimpl_ptr.h>
+
+#include <memory>
+
+namespace Kleo
+{
+namespace Crypto
+{
+
+class Task;
+
+/*!
+  Starts tasks of all controllers under a common concurrency policy.
+
+  Tasks are queued per resource they are bound by, and at most limit()
+  tasks of each resource run at the same time. Within a queue the
+  tasks with the smallest input go first, so that the user gets
+  feedback quickly.
+
+  While tasks are queued or running, the scheduler keeps itself alive,
+  so they are not lost when the last user releases the instance.
+*/
+class TaskScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    enum Resource {
+        CPU,    //!< e.g. encryption of local files
+        IO,     //!< e.g. reading from or writing to slow or remote storage
+        Card,   //!< operations using a smartcard, which can only do one thing at a time
+
+        NumResources
+    };
+
+    static std::shared_ptr<const TaskScheduler> instance();
+    static std::shared_ptr<TaskScheduler> mutableInstance();
+
+    ~TaskScheduler();
+
+    void setLimit(Resource resource, unsigned int limit);
+    unsigned int limit(Resource resource) const;
+
+    //! Queues \a task; it is started as soon as the limit of \a resource allows.
+    void enqueue(const std::shared_ptr<Task> &task, Resource resource = CPU);
+    //! Removes \a task from the queue if it wasn't started yet.
+    bool dequeue(const std::shared_ptr<Task> &task);
+
+    unsigned int queueDepth(Resource resource) const;
+    unsigned int queueDepth() const;
+    unsigned int inFlight(Resource resource) const;
+    unsigned int inFlight() const;
+
+Q_SIGNALS:
+    //! Emitted whenever queue depths or in-flight counts change.
+    void statisticsChanged();
+
+private:
+    TaskScheduler();
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+    Q_PRIVATE_SLOT(d, void taskDone())
+};
+
+}
+}
+
+#endif // __KLEOPATRA_CRYPTO_TASKSCHEDULER_H__
@@ -41,6 +41,9 @@
 #include <utils/input.h>
 #include <utils/output.h>
 #include <utils/kleo_assert.h>
+#include <utils/checksumcache.h>
+#include <utils/sumfileindex.h>
+#include <utils/throughputmeter.h>
 
 #include <Libkleo/Stl_Util>
 #include <Libkleo/ChecksumDefinition>
@@ -55,11 +58,16 @@
 #include <QMutex>
 #include <QProgressDialog>
 #include <QDir>
+#include <QHash>
 #include <QProcess>
+#include <QTemporaryFile>
+#include <QTextStream>
 
 #include <gpg-error.h>
 
+#include <chrono>
 #include <deque>
+#include <future>
 #include <limits>
 #include <set>
 
@@ -174,6 +182,8 @@ private:
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions;
     QStringList files;
     QStringList errors;
+    const std::shared_ptr<ChecksumCache> cache;
+    bool forceRehash;
     volatile bool canceled;
 };
 
@@ -184,6 +194,8 @@ VerifyChecksumsController::Private::Private(VerifyChecksumsController *qq)
       checksumDefinitions(ChecksumDefinition::getChecksumDefinitions()),
       files(),
       errors(),
+      cache(ChecksumCache::isEnabled() ? ChecksumCache::mutableInstance() : std::shared_ptr<ChecksumCache>()),
+      forceRehash(false),
       canceled(false)
 {
     connect(this, &Private::progress,
@@ -222,6 +234,13 @@ void VerifyChecksumsController::setFiles(const QStringList &files)
     d->files = files;
 }
 
+void VerifyChecksumsController::setForceRehash(bool force)
+{
+    kleo_assert(!d->isRunning());
+    const QMutexLocker locker(&d->mutex);
+    d->forceRehash = force;
+}
+
 void VerifyChecksumsController::start()
 {
 
@@ -264,7 +283,7 @@ namespace
 struct SumFile {
     QDir dir;
     QString sumFile;
-    quint64 totalSize;
+    QStringList files; // absolute paths
     std::shared_ptr<ChecksumDefinition> checksumDefinition;
 };
 
@@ -313,6 +332,19 @@ static QString decode(const QString &encoded)
     return decoded;
 }
 
+static QString encode(const QString &decoded)
+{
+    QString encoded;
+    encoded.reserve(decoded.size());
+    for (const QChar &ch : decoded)
+        switch (ch.toLatin1()) {
+        case '\\': encoded += QLatin1String("\\\\"); break;
+        case '\n':  encoded += QLatin1String("\\n");  break;
+        default:    encoded += ch;                    break;
+        }
+    return encoded;
+}
+
 static std::vector<File> parse_sum_file(const QString &fileName)
 {
     std::vector<File> files;
@@ -336,11 +368,18 @@ static std::vector<File> parse_sum_file(const QString &fileName)
     return files;
 }
 
-static quint64 aggregate_size(const QDir &dir, const QStringList &files)
+// Runs concurrently to the verification, so the progress can switch
+// from files to bytes as soon as the total is known:
+static quint64 aggregate_size(const std::vector<SumFile> &sumfiles, const volatile bool &canceled)
 {
     quint64 n = 0;
-    for (const QString &file : files) {
-        n += QFileInfo(dir.absoluteFilePath(file)).size();
+    for (const SumFile &sumFile : sumfiles) {
+        for (const QString &file : sumFile.files) {
+            if (canceled) {
+                return n;
+            }
+            n += QFileInfo(file).size();
+        }
     }
     return n;
 }
@@ -371,30 +410,6 @@ struct less_file : std::binary_function<QString, QString, bool> {
         return QString::compare(lhs, rhs, fs_cs) < 0;
     }
 };
-struct sumfile_contains_file : std::unary_function<QString, bool> {
-    const QDir dir;
-    const QString fileName;
-    sumfile_contains_file(const QDir &dir_, const QString &fileName_)
-        : dir(dir_), fileName(fileName_) {}
-    bool operator()(const QString &sumFile) const
-    {
-        const std::vector<File> files = parse_sum_file(dir.absoluteFilePath(sumFile));
-        qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:      found " << files.size()
-                               << " files listed in " << qPrintable(dir.absoluteFilePath(sumFile));
-        for (const File &file : files) {
-            const bool isSameFileName = (QString::compare(file.name, fileName, fs_cs) == 0);
-            qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:        "
-                                   << qPrintable(file.name) << " == "
-                                   << qPrintable(fileName)  << " ? "
-                                   << isSameFileName;
-            if (isSameFileName) {
-                return true;
-            }
-        }
-        return false;
-    }
-};
-
 }
 
 // IF is_dir(file)
@@ -450,6 +465,20 @@ static std::vector<SumFile> find_sums_by_input_files(const QStringList &files, Q
 
     const matches_any is_sum_file(patterns);
 
+    SumFileIndex index(
+        [&patterns](const QDir &dir) {
+            return filter_checksum_files(dir.entryList(QDir::Files), patterns);
+        },
+        [](const QString &sumFile) {
+            const std::vector<File> files = parse_sum_file(sumFile);
+            QStringList names;
+            names.reserve(files.size());
+            std::transform(files.cbegin(), files.cend(),
+                           std::back_inserter(names), std::mem_fn(&File::name));
+            return names;
+        },
+        fs_cs);
+
     std::map<QDir, std::set<QString, less_file>, less_dir> dirs2sums;
 
     // Step 1: find the sumfiles we need to check:
@@ -466,7 +495,7 @@ static std::vector<SumFile> find_sums_by_input_files(const QStringList &files, Q
         if (fi.isDir()) {
             qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:   it's a directory";
             QDir dir(file);
-            const QStringList sumfiles = filter_checksum_files(dir.entryList(QDir::Files), patterns);
+            const QStringList sumfiles = index.sumFiles(dir);
             qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:   found " << sumfiles.size()
                                    << " sum files: " << qPrintable(sumfiles.join(QStringLiteral(", ")));
             dirs2sums[ dir ].insert(sumfiles.begin(), sumfiles.end());
@@ -484,15 +513,11 @@ static std::vector<SumFile> find_sums_by_input_files(const QStringList &files, Q
         } else {
             qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:   it's something else; checking whether we'll find a sumfile for it...";
             const QDir dir = fi.dir();
-            const QStringList sumfiles = filter_checksum_files(dir.entryList(QDir::Files), patterns);
-            qCDebug(KLEOPATRA_LOG) << "find_sums_by_input_files:   found " << sumfiles.size()
-                                   << " potential sumfiles: " << qPrintable(sumfiles.join(QStringLiteral(", ")));
-            const auto it = std::find_if(sumfiles.cbegin(), sumfiles.cend(),
-                                         sumfile_contains_file(dir, fileName));
-            if (it == sumfiles.end()) {
+            const QString sumfile = index.findSumFile(dir, fileName);
+            if (sumfile.isEmpty()) {
                 errors.push_back(i18n("Cannot find checksums file for file %1", file));
             } else {
-                dirs2sums[dir].insert(*it);
+                dirs2sums[dir].insert(sumfile);
             }
         }
         if (progress) {
@@ -519,11 +544,14 @@ static std::vector<SumFile> find_sums_by_input_files(const QStringList &files, Q
             QStringList files;
             files.reserve(summedfiles.size());
             std::transform(summedfiles.cbegin(), summedfiles.cend(),
-                           std::back_inserter(files), std::mem_fn(&File::name));
+                           std::back_inserter(files),
+                           [&dir](const File &file) {
+                               return dir.absoluteFilePath(file.name);
+                           });
             const SumFile sumFile = {
                 it->first,
                 sumFileName,
-                aggregate_size(it->first, files),
+                files,
                 filename2definition(sumFileName, checksumDefinitions),
             };
             sumfiles.push_back(sumFile);
@@ -568,7 +596,7 @@ static VerifyChecksumsDialog::Status string2status(const QByteArray &str)
     return VerifyChecksumsDialog::Unknown;
 }
 
-static QString process(const SumFile &sumFile, bool *fatal, const QStringList &env,
+static QString process(const SumFile &sumFile, const QString &absFilePath, bool *fatal, const QStringList &env,
                        const std::function<void(const QString &, VerifyChecksumsDialog::Status)> &status)
 {
     QProcess p;
@@ -576,8 +604,6 @@ static QString process(const SumFile &sumFile, bool *fatal, const QStringList &e
     p.setWorkingDirectory(sumFile.dir.absolutePath());
     p.setReadChannel(QProcess::StandardOutput);
 
-    const QString absFilePath = sumFile.dir.absoluteFilePath(sumFile.sumFile);
-
     const QString program = sumFile.checksumDefinition->verifyCommand();
     sumFile.checksumDefinition->startVerifyCommand(&p, QStringList(absFilePath));
 
@@ -614,11 +640,97 @@ static QString process(const SumFile &sumFile, bool *fatal, const QStringList &e
     return QString();
 }
 
+namespace
+{
+struct CacheStats {
+    unsigned int hits;
+    unsigned int lookups;
+};
+}
+
+// Reports all files whose cached digest matches the one listed in
+// sumFile through cached(), and runs the verify command only on the
+// remaining ones (through a temporary sum file). Files found OK by the
+// verify command are added to the cache, unless they changed in the
+// meantime. With !useCached, all files are re-hashed and only their
+// cache entries are refreshed.
+static QString process_cached(const SumFile &sumFile, bool *fatal, const QStringList &env,
+                              const std::function<void(const QString &, VerifyChecksumsDialog::Status)> &status,
+                              const std::function<void(const QString &)> &cached,
+                              ChecksumCache &cache, bool useCached, CacheStats &stats)
+{
+    const QString absFilePath = sumFile.dir.absoluteFilePath(sumFile.sumFile);
+    const QString algorithm = sumFile.checksumDefinition->id();
+
+    struct Pending {
+        FileId id;
+        QByteArray checksum;
+    };
+    QHash<QString, Pending> pending;
+    std::vector<File> misses;
+    const unsigned int previousHits = stats.hits;
+
+    for (const File &file : parse_sum_file(absFilePath)) {
+        const QString fileName = sumFile.dir.absoluteFilePath(file.name);
+        const FileId id = FileId::fromFile(fileName);
+        bool hit = false;
+        if (useCached) {
+            ++stats.lookups;
+            hit = cache.lookup(id, algorithm) == file.checksum.toLower();
+        }
+        if (hit) {
+            ++stats.hits;
+            cached(fileName);
+        } else {
+            const Pending p = { id, file.checksum };
+            pending.insert(fileName, p);
+            misses.push_back(file);
+        }
+    }
+
+    if (misses.empty()) {
+        return QString();
+    }
+
+    const auto statusCb = [&](const QString &fileName, VerifyChecksumsDialog::Status st) {
+        if (st == VerifyChecksumsDialog::OK) {
+            const auto it = pending.constFind(fileName);
+            if (it != pending.cend() && FileId::fromFile(fileName) == it->id) {
+                cache.insert(it->id, algorithm, it->checksum, fileName);
+            }
+        }
+        status(fileName, st);
+    };
+
+    if (stats.hits == previousHits) {
+        // nothing cached, verify the original
+        return process(sumFile, absFilePath, fatal, env, statusCb);
+    }
+
+    QTemporaryFile reduced;
+    if (!reduced.open()) {
+        return process(sumFile, absFilePath, fatal, env, statusCb);
+    }
+    {
+        QTextStream s(&reduced);
+        for (const File &file : misses) {
+            const QString encoded = encode(file.name);
+            if (encoded != file.name) {
+                s << QLatin1Char('\\');
+            }
+            s << QString::fromLatin1(file.checksum) << QLatin1Char(' ')
+              << (file.binary ? QLatin1Char('*') : QLatin1Char(' ')) << encoded << QLatin1Char('\n');
+        }
+    }
+    reduced.close();
+    return process(sumFile, reduced.fileName(), fatal, env, statusCb);
+}
+
 namespace
 {
 static QDebug operator<<(QDebug s, const SumFile &sum)
 {
-    return s << "SumFile(" << sum.dir << "->" << sum.sumFile << "<-(" << sum.totalSize << ')' << ")\n";
+    return s << "SumFile(" << sum.dir << "->" << sum.sumFile << "<-(" << sum.files.size() << ')' << ")\n";
 }
 }
 
@@ -629,6 +741,8 @@ void VerifyChecksumsController::Private::run()
 
     const QStringList files = this->files;
     const std::vector< std::shared_ptr<ChecksumDefinition> > checksumDefinitions = this->checksumDefinitions;
+    const std::shared_ptr<ChecksumCache> cache = this->cache;
+    const bool forceRehash = this->forceRehash;
 
     locker.unlock();
 
@@ -648,7 +762,6 @@ void VerifyChecksumsController::Private::run()
     Q_EMIT progress(0, 0, scanning);
 
     const auto progressCb = [this, scanning](int arg) { Q_EMIT progress(arg, 0, scanning); };
-    const auto statusCb = [this](const QString &str, VerifyChecksumsDialog::Status st) { Q_EMIT status(str, st); };
 
     const std::vector<SumFile> sumfiles = find_sums_by_input_files(files, errors, progressCb, checksumDefinitions);
 
@@ -658,40 +771,87 @@ void VerifyChecksumsController::Private::run()
 
     if (!canceled) {
 
-        Q_EMIT progress(0, 0, i18n("Calculating total size..."));
+        //
+        // Step 2: perform work (with progress reporting):
+        //
 
-        const quint64 total
-            = kdtools::accumulate_transform(sumfiles.cbegin(), sumfiles.cend(),
-                                            std::mem_fn(&SumFile::totalSize), Q_UINT64_C(0));
-
-        if (!canceled) {
+        const QStringList env = c_lang_environment();
 
-            //
-            // Step 2: perform work (with progress reporting):
-            //
+        // the sizes are only needed for the progress, so don't make the
+        // verification wait for them:
+        std::future<quint64> sizer = std::async(std::launch::async, [&sumfiles, this]() {
+            return aggregate_size(sumfiles, canceled);
+        });
 
-            const QStringList env = c_lang_environment();
+        const unsigned int totalFiles
+            = kdtools::accumulate_transform(sumfiles.cbegin(), sumfiles.cend(),
+                                            [](const SumFile &sumFile) { return sumFile.files.size(); }, 0U);
 
-            // re-scale 'total' to fit into ints (wish QProgressDialog would use quint64...)
-            const quint64 factor = total / std::numeric_limits<int>::max() + 1;
+        ThroughputMeter meter;
+        meter.start(0, totalFiles);
 
-            quint64 done = 0;
-            Q_FOREACH (const SumFile &sumFile, sumfiles) {
-                Q_EMIT progress(done / factor, total / factor,
-                                i18n("Verifying checksums (%2) in %1", sumFile.checksumDefinition->label(), sumFile.dir.path()));
-                bool fatal = false;
-                const QString error = process(sumFile, &fatal, env, statusCb);
-                if (!error.isEmpty()) {
-                    errors.push_back(error);
+        // count files until the total size is known, bytes afterwards:
+        bool haveTotal = false;
+        const auto report = [&](const QString &text) {
+            if (!haveTotal && sizer.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                meter.setTotalBytes(sizer.get());
+                haveTotal = true;
+            }
+            if (haveTotal) {
+                // re-scale 'total' to fit into ints (wish QProgressDialog would use quint64...)
+                const quint64 factor = meter.totalBytes() / std::numeric_limits<int>::max() + 1;
+                Q_EMIT progress(meter.bytesDone() / factor, meter.totalBytes() / factor, text);
+            } else {
+                Q_EMIT progress(meter.filesDone(), meter.totalFiles(), text);
+            }
+        };
+
+        CacheStats cacheStats = { 0, 0 };
+        Q_FOREACH (const SumFile &sumFile, sumfiles) {
+            const QString what = i18n("Verifying checksums (%2) in %1", sumFile.checksumDefinition->label(), sumFile.dir.path());
+            report(what);
+
+            // the verify command reports one line per file, so we can
+            // update the progress after each file, not only after each sum file:
+            const auto statusCb = [&](const QString &file, VerifyChecksumsDialog::Status st) {
+                Q_EMIT status(file, st);
+                meter.addFile(QFileInfo(file).size());
+                if (meter.shouldReport()) {
+                    report(i18nc("what is being done: progress details", "%1: %2", what, meter.toString()));
                 }
-                done += sumFile.totalSize;
-                if (fatal || canceled) {
-                    break;
+            };
+            // cache hits were not hashed, so they must not count towards the throughput:
+            const auto cachedCb = [&](const QString &file) {
+                Q_EMIT status(file, VerifyChecksumsDialog::OK);
+                meter.addSkippedFile(QFileInfo(file).size());
+                if (meter.shouldReport()) {
+                    report(i18nc("what is being done: progress details", "%1: %2", what, meter.toString()));
                 }
-            }
-            Q_EMIT progress(done / factor, total / factor, i18n("Done."));
+            };
 
+            bool fatal = false;
+            const QString error = cache
+                ? process_cached(sumFile, &fatal, env, statusCb, cachedCb, *cache, !forceRehash, cacheStats)
+                : process(sumFile, sumFile.dir.absoluteFilePath(sumFile.sumFile), &fatal, env, statusCb);
+            if (!error.isEmpty()) {
+                errors.push_back(error);
+            }
+            if (fatal || canceled) {
+                break;
+            }
         }
+        qCDebug(KLEOPATRA_LOG) << "verified" << meter.filesDone() << "files," << meter.bytesDone() << "bytes,"
+                               << meter.bytesPerSecond() << "bytes/s";
+        if (cache) {
+            cache->save();
+        }
+        if (cache && !forceRehash) {
+            qCDebug(KLEOPATRA_LOG) << "checksum cache:" << cacheStats.hits << "hits in" << cacheStats.lookups << "lookups";
+            report(i18n("Done. %1 of %2 files verified from the checksum cache.", cacheStats.hits, cacheStats.lookups));
+        } else {
+            report(i18n("Done."));
+        }
+
     }
 
     locker.relock();
@@ -40,7 +40,8 @@ Card::Card(): mCanLearn(false),
               mHasNullPin(false),
               mStatus(Status::NoCard),
               mAppType(UnknownApplication),
-              mAppVersion(-1) {
+              mAppVersion(-1),
+              mSlot(0) {
 }
 
 void Card::setStatus(Status s)
@@ -93,6 +94,16 @@ void Card::setPinStates(std::vector<PinState> pinStates)
     mPinStates = pinStates;
 }
 
+std::string Card::chvStatus() const
+{
+    return mChvStatus;
+}
+
+void Card::setChvStatus(const std::string &status)
+{
+    mChvStatus = status;
+}
+
 void Card::setSlot(int slot)
 {
     mSlot = slot;
@@ -130,6 +141,7 @@ bool Card::operator == (const Card& other) const
         && mAppType == other.appType()
         && mAppVersion == other.appVersion()
         && mPinStates == other.pinStates()
+        && mChvStatus == other.chvStatus()
         && mSlot == other.slot()
         && mCanLearn == other.canLearnKeys()
         && mHasNullPin == other.hasNullPin();
@@ -99,6 +99,11 @@ public:
     std::vector<PinState> pinStates() const;
     void setPinStates(std::vector<PinState> pinStates);
 
+    /** The verbatim CHV-STATUS attribute (PIN retry counters); empty if
+        the card application does not report it. */
+    std::string chvStatus() const;
+    void setChvStatus(const std::string &status);
+
     void setSlot(int slot);
     int slot() const;
 
@@ -116,6 +121,7 @@ private:
     AppType mAppType;
     int mAppVersion;
     std::vector<PinState> mPinStates;
+    std::string mChvStatus;
     int mSlot;
 };
 } // namespace Smartcard
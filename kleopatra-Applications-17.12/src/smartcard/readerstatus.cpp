@@ -55,6 +55,7 @@
 #include <QWaitCondition>
 #include <QThread>
 #include <QPointer>
+#include <QElapsedTimer>
 
 #include <memory>
 #include <vector>
@@ -173,13 +174,35 @@ static Card::PinState parse_pin_state(const QString &s)
     }
 }
 
+// round-trips taking longer than this are reported as slow
+static const qint64 slowTransactionMs = 500;
+
+// Assuan errors in reply to a command the other side does not know or
+// accept (e.g. GETINFO card_list on gnupg < 2.3). The connection itself
+// is fine after those.
+static bool is_command_rejected(const Error &err)
+{
+    return err.code() == GPG_ERR_ASS_UNKNOWN_CMD
+           || err.code() == GPG_ERR_ASS_NOT_IMPLEMENTED
+           || err.code() == GPG_ERR_ASS_PARAMETER;
+}
+
 static std::unique_ptr<DefaultAssuanTransaction> gpgagent_transact(std::shared_ptr<Context> &gpgAgent, const char *command, Error &err)
 {
     qCDebug(KLEOPATRA_LOG) << "gpgagent_transact(" << command << ")";
+    QElapsedTimer timer;
+    timer.start();
     err = gpgAgent->assuanTransact(command);
+    const qint64 elapsed = timer.elapsed();
+    if (elapsed >= slowTransactionMs) {
+        qCWarning(KLEOPATRA_LOG) << "gpgagent_transact(" << command << "): slow reader or card, took" << elapsed << "ms";
+    } else {
+        qCDebug(KLEOPATRA_LOG) << "gpgagent_transact(" << command << "): took" << elapsed << "ms";
+    }
     if (err.code()) {
         qCDebug(KLEOPATRA_LOG) << "gpgagent_transact(" << command << "):" << QString::fromLocal8Bit(err.asString());
-        if (err.code() >= GPG_ERR_ASS_GENERAL && err.code() <= GPG_ERR_ASS_UNKNOWN_INQUIRE) {
+        if (err.code() >= GPG_ERR_ASS_GENERAL && err.code() <= GPG_ERR_ASS_UNKNOWN_INQUIRE
+                && !is_command_rejected(err)) {
             qCDebug(KLEOPATRA_LOG) << "Assuan problem, killing context";
             gpgAgent.reset();
         }
@@ -189,7 +212,7 @@ static std::unique_ptr<DefaultAssuanTransaction> gpgagent_transact(std::shared_p
     return std::unique_ptr<DefaultAssuanTransaction>(dynamic_cast<DefaultAssuanTransaction*>(t.release()));
 }
 
-const std::vector< std::pair<std::string, std::string> > gpgagent_statuslines(std::shared_ptr<Context> gpgAgent, const char *what, Error &err)
+const std::vector< std::pair<std::string, std::string> > gpgagent_statuslines(std::shared_ptr<Context> &gpgAgent, const char *what, Error &err)
 {
     const std::unique_ptr<DefaultAssuanTransaction> t = gpgagent_transact(gpgAgent, what, err);
     if (t.get()) {
@@ -202,7 +225,7 @@ const std::vector< std::pair<std::string, std::string> > gpgagent_statuslines(st
 
 }
 
-static const std::string gpgagent_status(const std::shared_ptr<Context> &gpgAgent, const char *what, Error &err)
+static const std::string gpgagent_status(std::shared_ptr<Context> &gpgAgent, const char *what, Error &err)
 {
     const auto lines = gpgagent_statuslines (gpgAgent, what, err);
     // The status is only the last attribute
@@ -235,14 +258,58 @@ static const std::string gpgagent_data(std::shared_ptr<Context> &gpgAgent, const
     }
 }
 
-static void handle_openpgp_card(std::shared_ptr<Card> &ci, std::shared_ptr<Context> &gpg_agent)
+typedef std::vector< std::pair<std::string, std::string> > StatusLines;
+
+static bool find_status(const StatusLines &lines, const char *keyword, std::string &value)
+{
+    const auto it = std::find_if(lines.cbegin(), lines.cend(),
+                                 [keyword](const std::pair<std::string, std::string> &pair) {
+                                     return pair.first == keyword;
+                                 });
+    if (it == lines.cend()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+static std::vector<std::string> find_statuses(const StatusLines &lines, const char *keyword)
+{
+    std::vector<std::string> values;
+    for (const auto &pair : lines) {
+        if (pair.first == keyword) {
+            values.push_back(pair.second);
+        }
+    }
+    return values;
+}
+
+// Returns the attribute from the batched LEARN output if it is there,
+// and only asks the card for it otherwise.
+static const std::string scd_learned_or_getattr(const StatusLines &learned, std::shared_ptr<Context> &gpgAgent, const char *what, Error &err)
+{
+    std::string value;
+    if (find_status(learned, what, value)) {
+        err = Error();
+        return value;
+    }
+    return scd_getattr_status(gpgAgent, what, err);
+}
+
+static void handle_openpgp_card(std::shared_ptr<Card> &ci, std::shared_ptr<Context> &gpg_agent, const StatusLines &learned)
 {
     Error err;
     auto ret = new OpenPGPCard();
     ret->setSerialNumber(ci->serialNumber());
 
+    if (!find_statuses(learned, "KEYPAIRINFO").empty()) {
+        ret->setKeyPairInfo(learned);
+        ci.reset(ret);
+        return;
+    }
     const auto info = gpgagent_statuslines(gpg_agent, "SCD LEARN --keypairinfo", err);
     if (err.code()) {
+        delete ret;
         ci->setStatus(Card::CardError);
         return;
     }
@@ -250,20 +317,20 @@ static void handle_openpgp_card(std::shared_ptr<Card> &ci, std::shared_ptr<Conte
     ci.reset(ret);
 }
 
-static void handle_netkey_card(std::shared_ptr<Card> &ci, std::shared_ptr<Context> &gpg_agent)
+static void handle_netkey_card(std::shared_ptr<Card> &ci, std::shared_ptr<Context> &gpg_agent, const StatusLines &learned)
 {
     Error err;
-    auto ret = new NetKeyCard();
+    std::unique_ptr<NetKeyCard> ret(new NetKeyCard());
     ret->setSerialNumber(ci->serialNumber());
 
-    ret->setAppVersion(parse_app_version(scd_getattr_status(gpg_agent, "NKS-VERSION", err)));
+    ret->setAppVersion(parse_app_version(scd_learned_or_getattr(learned, gpg_agent, "NKS-VERSION", err)));
     if (err.code() || ret->appVersion() != 3) {
         qCDebug(KLEOPATRA_LOG) << "not a NetKey v3 card, giving up";
         return;
     }
     // the following only works for NKS v3...
     const auto chvStatus = QString::fromStdString(
-            scd_getattr_status(gpg_agent, "CHV-STATUS", err)).split(QStringLiteral(" "));
+            scd_learned_or_getattr(learned, gpg_agent, "CHV-STATUS", err)).split(QStringLiteral(" "));
     if (err.code()) {
         return;
     }
@@ -279,26 +346,46 @@ static void handle_netkey_card(std::shared_ptr<Card> &ci, std::shared_ptr<Contex
     ret->setPinStates(states);
 
     // check for keys to learn:
-    const std::unique_ptr<DefaultAssuanTransaction> result = gpgagent_transact(gpg_agent, "SCD LEARN --keypairinfo", err);
-    if (err.code() || !result.get()) {
-        return;
+    std::vector<std::string> keyPairInfos = find_statuses(learned, "KEYPAIRINFO");
+    if (keyPairInfos.empty()) {
+        const std::unique_ptr<DefaultAssuanTransaction> result = gpgagent_transact(gpg_agent, "SCD LEARN --keypairinfo", err);
+        if (err.code() || !result.get()) {
+            return;
+        }
+        keyPairInfos = result->statusLine("KEYPAIRINFO");
     }
-    const std::vector<std::string> keyPairInfos = result->statusLine("KEYPAIRINFO");
     if (keyPairInfos.empty()) {
         return;
     }
     ret->setKeyPairInfo(keyPairInfos);
-    ci.reset(ret);
+    ci.reset(ret.release());
+}
+
+// Returns the serial numbers of all inserted cards. Fails with an
+// error on gnupg versions whose scdaemon only knows one card.
+static std::vector<std::string> get_card_serials(std::shared_ptr<Context> &gpgAgent, Error &err)
+{
+    std::vector<std::string> serials;
+    for (const auto &pair : gpgagent_statuslines(gpgAgent, "SCD GETINFO card_list", err)) {
+        if (pair.first == "SERIALNO") {
+            serials.push_back(pair.second);
+        }
+    }
+    return serials;
 }
 
-static std::shared_ptr<Card> get_card_status(unsigned int slot, std::shared_ptr<Context> &gpg_agent)
+// Queries the card currently selected in scdaemon. If it is the card
+// 'known' was read from (in the same slot), its PIN state did not
+// change, and 'full' is not set, 'known' is returned as-is, saving the
+// LEARN and the other GETATTR round-trips.
+static std::shared_ptr<Card> get_card_status(unsigned int slot, std::shared_ptr<Context> &gpg_agent,
+                                             const std::shared_ptr<Card> &known, bool full)
 {
     Q_UNUSED(gpgagent_data);
     qCDebug(KLEOPATRA_LOG) << "get_card_status(" << slot << ',' << gpg_agent.get() << ')';
     auto ci = std::shared_ptr<Card> (new Card());
-    if (slot != 0 || !gpg_agent) {
-        // In the future scdaemon should support multiple slots but
-        // not yet (2.1.18)
+    ci->setSlot(slot);
+    if (!gpg_agent) {
         return ci;
     }
 
@@ -312,9 +399,37 @@ static std::shared_ptr<Card> get_card_status(unsigned int slot, std::shared_ptr<
         ci->setStatus(Card::CardError);
         return ci;
     }
+    if (!full && known && known->status() != Card::CardError && known->status() != Card::NoCard
+            && known->slot() == static_cast<int>(slot) && known->serialNumber() == ci->serialNumber()) {
+        // PIN retry counters and null PINs change without a new serial number
+        Error chvErr;
+        const std::string chvStatus = scd_getattr_status(gpg_agent, "CHV-STATUS", chvErr);
+        if (!gpg_agent) {
+            ci->setStatus(Card::CardError);
+            return ci;
+        }
+        if (chvStatus == known->chvStatus()) {
+            qCDebug(KLEOPATRA_LOG) << "get_card_status: card" << ci->serialNumber().c_str() << "unchanged";
+            return known;
+        }
+        qCDebug(KLEOPATRA_LOG) << "get_card_status: PIN state of card" << ci->serialNumber().c_str() << "changed";
+    }
     ci->setStatus(Card::CardPresent);
 
-    const auto verbatimType = scd_getattr_status(gpg_agent, "APPTYPE", err);
+    // Fetch everything scdaemon reports about the card in one round-trip
+    // instead of a GETATTR per attribute. --force skips the KNOWNCARDP
+    // inquiry. Whatever is missing from the output (depending on the
+    // card application and the gnupg version) is queried separately.
+    StatusLines learned = gpgagent_statuslines(gpg_agent, "SCD LEARN --force", err);
+    if (err.code()) {
+        learned.clear();
+        if (!gpg_agent) {
+            ci->setStatus(Card::CardError);
+            return ci;
+        }
+    }
+
+    const auto verbatimType = scd_learned_or_getattr(learned, gpg_agent, "APPTYPE", err);
     ci->setAppType(parse_app_type(verbatimType));
     if (err.code()) {
         return ci;
@@ -323,28 +438,79 @@ static std::shared_ptr<Card> get_card_status(unsigned int slot, std::shared_ptr<
     // Handle different card types
     if (ci->appType() == Card::NksApplication) {
         qCDebug(KLEOPATRA_LOG) << "get_card_status: found Netkey card" << ci->serialNumber().c_str() << "end";
-        handle_netkey_card(ci, gpg_agent);
-        return ci;
+        handle_netkey_card(ci, gpg_agent, learned);
     } else if (ci->appType() == Card::OpenPGPApplication) {
         qCDebug(KLEOPATRA_LOG) << "get_card_status: found OpenPGP card" << ci->serialNumber().c_str() << "end";
-        handle_openpgp_card(ci, gpg_agent);
-        return ci;
+        handle_openpgp_card(ci, gpg_agent, learned);
     } else {
         qCDebug(KLEOPATRA_LOG) << "get_card_status: unhandled application:" << verbatimType.c_str();
-        return ci;
     }
-
+    ci->setSlot(slot);
+    if (gpg_agent) {
+        // compared by the quick path of the next update
+        Error chvErr;
+        ci->setChvStatus(scd_learned_or_getattr(learned, gpg_agent, "CHV-STATUS", chvErr));
+    }
     return ci;
 }
 
-static std::vector<std::shared_ptr<Card> > update_cardinfo(std::shared_ptr<Context> &gpgAgent)
+static std::shared_ptr<Card> find_card(const std::vector<std::shared_ptr<Card> > &cards, const std::string &serialNumber)
 {
-    // Multiple smartcard readers are only supported internally by gnupg
-    // but not by scdaemon (Status gnupg 2.1.18)
-    // We still pretend that there can be multiple cards inserted
-    // at once but we don't handle it yet.
-    const auto ci = get_card_status(0, gpgAgent);
-    return std::vector<std::shared_ptr<Card> >(1, ci);
+    const auto it = std::find_if(cards.cbegin(), cards.cend(),
+                                 [&serialNumber](const std::shared_ptr<Card> &card) {
+                                     return card && card->serialNumber() == serialNumber;
+                                 });
+    return it == cards.cend() ? std::shared_ptr<Card>() : *it;
+}
+
+enum CardListSupport {
+    CardListSupportUnknown,
+    CardListSupported,
+    CardListUnsupported
+};
+
+// 'cardList' caches whether scdaemon knows GETINFO card_list, so that
+// older versions are only asked once. 'fullCurrent' fully re-reads the
+// current card (the one simple transactions act on) only.
+static std::vector<std::shared_ptr<Card> > update_cardinfo(std::shared_ptr<Context> &gpgAgent,
+                                                           const std::vector<std::shared_ptr<Card> > &oldCards, bool full,
+                                                           bool fullCurrent, CardListSupport &cardList)
+{
+    Error err;
+    std::vector<std::string> serials;
+    if (cardList != CardListUnsupported && gpgAgent) {
+        serials = get_card_serials(gpgAgent, err);
+        if (!err.code()) {
+            cardList = CardListSupported;
+        } else if (is_command_rejected(err)) {
+            qCDebug(KLEOPATRA_LOG) << "update_cardinfo: scdaemon does not support GETINFO card_list";
+            cardList = CardListUnsupported;
+        }
+    }
+    if (err.code() || serials.empty()) {
+        // scdaemon before gnupg 2.3 has no notion of multiple cards
+        // (or no card is inserted): only look at the current one
+        const auto known = oldCards.empty() ? std::shared_ptr<Card>() : oldCards.front();
+        return std::vector<std::shared_ptr<Card> >(1, get_card_status(0, gpgAgent, known, full || fullCurrent));
+    }
+
+    std::vector<std::shared_ptr<Card> > cards;
+    cards.reserve(serials.size());
+    for (const std::string &serial : serials) {
+        const std::string cmd = "SCD SWITCHCARD " + serial;
+        (void)gpgagent_transact(gpgAgent, cmd.c_str(), err);
+        if (err.code()) {
+            break;
+        }
+        const bool current = cards.empty();
+        cards.push_back(get_card_status(cards.size(), gpgAgent, find_card(oldCards, serial), full || (current && fullCurrent)));
+    }
+    if (cards.size() > 1 && gpgAgent) {
+        // make the first card current again; simple transactions act on it
+        const std::string cmd = "SCD SWITCHCARD " + serials.front();
+        (void)gpgagent_transact(gpgAgent, cmd.c_str(), err);
+    }
+    return cards;
 }
 } // namespace
 
@@ -355,6 +521,8 @@ struct Transaction {
 };
 
 static const Transaction updateTransaction = { "__update__", nullptr, nullptr };
+static const Transaction quickUpdateTransaction = { "__quick_update__", nullptr, nullptr };
+static const Transaction currentCardUpdateTransaction = { "__update_current__", nullptr, nullptr };
 static const Transaction quitTransaction   = { "__quit__",   nullptr, nullptr };
 
 namespace
@@ -366,6 +534,8 @@ public:
     explicit ReaderStatusThread(QObject *parent = nullptr)
         : QThread(parent),
           m_gnupgHomePath(Kleo::gnupgHomeDirectory()),
+          m_anyCardHasNullPin(false),
+          m_anyCardCanLearnKeys(false),
           m_transactions(1, updateTransaction)   // force initial scan
     {
         connect(this, &ReaderStatusThread::oneTransactionFinished,
@@ -395,6 +565,23 @@ public:
         m_waitForTransactions.wakeOne();
     }
 
+    // Removes the queued transactions of 'receiver' and of receivers
+    // that are already gone, and returns them. A transaction already
+    // sent to the agent cannot be cancelled.
+    std::list<Transaction> takeTransactions(const QObject *receiver)
+    {
+        std::list<Transaction> taken;
+        const QMutexLocker locker(&m_mutex);
+        for (auto it = m_transactions.begin(); it != m_transactions.end();) {
+            const auto next = std::next(it);
+            if (it->slot && (it->receiver.isNull() || it->receiver.data() == receiver)) {
+                taken.splice(taken.end(), m_transactions, it);
+            }
+            it = next;
+        }
+        return taken;
+    }
+
 Q_SIGNALS:
     void anyCardHasNullPinChanged(bool);
     void anyCardCanLearnKeysChanged(bool);
@@ -408,6 +595,22 @@ public Q_SLOTS:
         addTransaction(updateTransaction);
     }
 
+    // only re-reads cards whose serial number changed
+    void quickPing()
+    {
+        addTransaction(quickUpdateTransaction);
+    }
+
+    // QWidgets emit destroyed() before their QPointers are cleared,
+    // so match on the pointer itself:
+    void dropOrphanedTransactions(QObject *receiver)
+    {
+        const auto dropped = takeTransactions(receiver);
+        if (!dropped.empty()) {
+            qCDebug(KLEOPATRA_LOG) << "ReaderStatusThread[GUI]: dropped" << dropped.size() << "transactions of a destroyed receiver";
+        }
+    }
+
     void stop()
     {
         const QMutexLocker locker(&m_mutex);
@@ -429,20 +632,31 @@ private Q_SLOTS:
 
 private:
     void run() override {
-        while (true) {
-            std::shared_ptr<Context> gpgAgent;
+        // one connection to the agent for the lifetime of the thread; it
+        // is only recreated after an Assuan error or a card error
+        std::shared_ptr<Context> gpgAgent;
+        CardListSupport cardList = CardListSupportUnknown;
+        bool firstUpdate = true;
 
+        while (true) {
             QByteArray command;
             bool nullSlot = false;
+            bool orphaned = false;
+            bool fullUpdate = false;
+            bool currentCardUpdate = false;
             std::list<Transaction> item;
             std::vector<std::shared_ptr<Card> > oldCards;
 
-            Error err;
-            std::unique_ptr<Context> c = Context::createForEngine(AssuanEngine, &err);
-            if (err.code() == GPG_ERR_NOT_SUPPORTED) {
-                return;
+            if (!gpgAgent) {
+                Error err;
+                std::unique_ptr<Context> c = Context::createForEngine(AssuanEngine, &err);
+                if (err.code() == GPG_ERR_NOT_SUPPORTED) {
+                    return;
+                }
+                gpgAgent = std::shared_ptr<Context>(c.release());
+                // the agent (and scdaemon) may have been restarted in a different version
+                cardList = CardListSupportUnknown;
             }
-            gpgAgent = std::shared_ptr<Context>(c.release());
 
             KDAB_SYNCHRONIZED(m_mutex) {
 
@@ -464,6 +678,29 @@ private:
                 command = item.front().command;
                 nullSlot = !item.front().slot;
                 oldCards = m_cardInfos;
+
+                orphaned = !nullSlot && !item.front().receiver;
+
+                // a burst of file system events results in a single update
+                if (nullSlot && isUpdate(command)) {
+                    fullUpdate = command == updateTransaction.command;
+                    currentCardUpdate = command == currentCardUpdateTransaction.command;
+                    for (auto it = m_transactions.begin(); it != m_transactions.end();) {
+                        if (!it->slot && isUpdate(it->command)) {
+                            fullUpdate = fullUpdate || it->command == updateTransaction.command;
+                            currentCardUpdate = currentCardUpdate || it->command == currentCardUpdateTransaction.command;
+                            it = m_transactions.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                }
+            }
+
+            if (orphaned) {
+                // don't send commands (e.g. PIN changes) for a dialog that is gone
+                qCDebug(KLEOPATRA_LOG) << "ReaderStatusThread[2nd]: skipping" << command << "of a destroyed receiver";
+                continue;
             }
 
             qCDebug(KLEOPATRA_LOG) << "ReaderStatusThread[2nd]: new iteration command=" << command << " ; nullSlot=" << nullSlot;
@@ -472,16 +709,21 @@ private:
                 return;    // quit
             }
 
-            if ((nullSlot && command == updateTransaction.command)) {
+            if (nullSlot && isUpdate(command)) {
 
-                std::vector<std::shared_ptr<Card> > newCards = update_cardinfo(gpgAgent);
-
-                newCards.resize(std::max(newCards.size(), oldCards.size()));
-                oldCards.resize(std::max(newCards.size(), oldCards.size()));
+                QElapsedTimer timer;
+                timer.start();
+                std::vector<std::shared_ptr<Card> > newCards = update_cardinfo(gpgAgent, oldCards, fullUpdate, currentCardUpdate, cardList);
+                qCDebug(KLEOPATRA_LOG) << "ReaderStatusThread[2nd]:" << (fullUpdate ? "full" : currentCardUpdate ? "current card" : "quick") << "update of"
+                                       << newCards.size() << "cards took" << timer.elapsed() << "ms";
 
                 KDAB_SYNCHRONIZED(m_mutex)
                 m_cardInfos = newCards;
 
+                // with several readers, cards can also disappear
+                newCards.resize(std::max(newCards.size(), oldCards.size()));
+                oldCards.resize(std::max(newCards.size(), oldCards.size()));
+
                 std::vector<std::shared_ptr<Card> >::const_iterator
                 nit = newCards.begin(), nend = newCards.end(),
                 oit = oldCards.begin(), oend = oldCards.end();
@@ -497,13 +739,13 @@ private:
                         qCDebug(KLEOPATRA_LOG) << "ReaderStatusThread[2nd]: slot" << idx << ": card Changed";
                         Q_EMIT cardChanged(idx);
                     }
-                    if ((*nit)->canLearnKeys()) {
+                    if (nptr && nptr->canLearnKeys()) {
                         anyLC = true;
                     }
-                    if ((*nit)->hasNullPin()) {
+                    if (nptr && nptr->hasNullPin()) {
                         anyNP = true;
                     }
-                    if ((*nit)->status() == Card::CardError) {
+                    if (nptr && nptr->status() == Card::CardError) {
                         anyError = true;
                     }
                     ++nit;
@@ -511,29 +753,51 @@ private:
                     ++idx;
                 }
 
-                Q_EMIT anyCardHasNullPinChanged(anyNP);
-                Q_EMIT anyCardCanLearnKeysChanged(anyLC);
+                if (firstUpdate || anyNP != m_anyCardHasNullPin) {
+                    m_anyCardHasNullPin = anyNP;
+                    Q_EMIT anyCardHasNullPinChanged(anyNP);
+                }
+                if (firstUpdate || anyLC != m_anyCardCanLearnKeys) {
+                    m_anyCardCanLearnKeys = anyLC;
+                    Q_EMIT anyCardCanLearnKeysChanged(anyLC);
+                }
+                firstUpdate = false;
 
                 if (anyError) {
                     gpgAgent.reset();
                 }
             } else {
                 GpgME::Error err;
+                QElapsedTimer timer;
+                timer.start();
                 (void)gpgagent_transact(gpgAgent, command.constData(), err);
-
-                KDAB_SYNCHRONIZED(m_mutex)
-                // splice 'item' into m_finishedTransactions:
-                m_finishedTransactions.splice(m_finishedTransactions.end(), item);
+                qCDebug(KLEOPATRA_LOG) << "ReaderStatusThread[2nd]: transaction" << command << "finished after" << timer.elapsed() << "ms";
+
+                KDAB_SYNCHRONIZED(m_mutex) {
+                    // splice 'item' into m_finishedTransactions:
+                    m_finishedTransactions.splice(m_finishedTransactions.end(), item);
+                    // the transaction may have changed the card (e.g. its PINs),
+                    // but not the other ones:
+                    m_transactions.push_back(currentCardUpdateTransaction);
+                }
 
                 Q_EMIT oneTransactionFinished(err);
             }
         }
     }
 
+    static bool isUpdate(const QByteArray &command)
+    {
+        return command == updateTransaction.command || command == quickUpdateTransaction.command
+               || command == currentCardUpdateTransaction.command;
+    }
+
 private:
     mutable QMutex m_mutex;
     QWaitCondition m_waitForTransactions;
     const QString m_gnupgHomePath;
+    // only used by the worker thread:
+    bool m_anyCardHasNullPin, m_anyCardCanLearnKeys;
     // protected by m_mutex:
     std::vector<std::shared_ptr<Card> > m_cardInfos;
     std::list<Transaction> m_transactions, m_finishedTransactions;
@@ -558,7 +822,9 @@ public:
 
         watcher.whitelistFiles(QStringList(QStringLiteral("reader_*.status")));
         watcher.addPath(Kleo::gnupgHomeDirectory());
-        watcher.setDelay(100);
+        // only coalesces bursts of events, the update itself is cheap
+        // for unchanged cards
+        watcher.setDelay(10);
 
         connect(this, &::ReaderStatusThread::cardChanged,
                 q, &ReaderStatus::cardChanged);
@@ -567,7 +833,7 @@ public:
         connect(this, &::ReaderStatusThread::anyCardCanLearnKeysChanged,
                 q, &ReaderStatus::anyCardCanLearnKeysChanged);
 
-        connect(&watcher, &FileSystemWatcher::triggered, this, &::ReaderStatusThread::ping);
+        connect(&watcher, &FileSystemWatcher::triggered, this, &::ReaderStatusThread::quickPing);
 
     }
     ~Private()
@@ -655,6 +921,11 @@ std::vector<Card::PinState> ReaderStatus::pinStates(unsigned int slot) const
 void ReaderStatus::startSimpleTransaction(const QByteArray &command, QObject *receiver, const char *slot)
 {
     const Transaction t = { command, receiver, slot };
+    if (receiver) {
+        // don't send commands (e.g. PIN changes) for a dialog that is gone
+        connect(receiver, &QObject::destroyed, d.get(), &::ReaderStatusThread::dropOrphanedTransactions,
+                Qt::UniqueConnection);
+    }
     d->addTransaction(t);
 }
 
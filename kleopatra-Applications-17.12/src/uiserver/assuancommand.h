@@ -36,6 +36,8 @@
 #include <utils/pimpl_ptr.h>
 #include <utils/types.h>
 
+#include "commandstats.h"
+
 #include <gpgme++/global.h>
 #include <gpgme++/error.h>
 
@@ -315,6 +317,9 @@ public:
 
     int inquire(const char *keyword, QObject *receiver, const char *slot, unsigned int maxSize = 0);
 
+    //! Records the time since the previous phase (or since the command was received) as @p phase.
+    void markPhaseDone(CommandStats::Phase phase);
+
     void done(const GpgME::Error &err = GpgME::Error());
     void done(const GpgME::Error &err, const QString &details);
     void done(int err)
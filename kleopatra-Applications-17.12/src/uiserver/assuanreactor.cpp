@@ -0,0 +1,258 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/assuanreactor.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "assuanreactor.h"
+
+#include "kleopatra_debug.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <cstring>
+#include <map>
+
+#ifdef Q_OS_LINUX
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
+
+using namespace Kleo;
+
+#ifdef Q_OS_LINUX
+
+class AssuanReactor::Private
+{
+    friend class ::Kleo::AssuanReactor;
+public:
+    Private()
+        : epollFd(epoll_create1(EPOLL_CLOEXEC)),
+          wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+          dispatchMutex(QMutex::Recursive),
+          handlersMutex(),
+          handlers(),
+          thread(this)
+    {
+        thread.setObjectName(QStringLiteral("AssuanReactor"));
+    }
+
+    ~Private()
+    {
+        if (thread.isRunning()) {
+            const quint64 one = 1;
+            (void)::write(wakeFd, &one, sizeof one);
+            thread.wait();
+        }
+        if (wakeFd >= 0) {
+            ::close(wakeFd);
+        }
+        if (epollFd >= 0) {
+            ::close(epollFd);
+        }
+    }
+
+    bool control(int op, int fd)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.u64 = 0;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd, op, fd, &ev) != 0) {
+            qCDebug(KLEOPATRA_LOG) << "AssuanReactor: epoll_ctl" << op << fd << "failed:" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    void run();
+
+private:
+    class Thread : public QThread
+    {
+    public:
+        explicit Thread(Private *d) : QThread(), d(d) {}
+    private:
+        void run() override
+        {
+            d->run();
+        }
+        Private *const d;
+    };
+
+    const int epollFd;
+    const int wakeFd;
+    // held while a handler runs, so remove() can wait for it
+    QMutex dispatchMutex;
+    // protects 'handlers', never held while a handler runs
+    QMutex handlersMutex;
+    std::map<int, Handler *> handlers;
+    Thread thread;
+};
+
+void AssuanReactor::Private::run()
+{
+    static const int MAX_EVENTS = 32;
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        const int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qCWarning(KLEOPATRA_LOG) << "AssuanReactor: epoll_wait failed:" << strerror(errno);
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == wakeFd) {
+                return; // quit
+            }
+            const QMutexLocker dispatchLocker(&dispatchMutex);
+            Handler *handler = nullptr;
+            {
+                const QMutexLocker locker(&handlersMutex);
+                const auto it = handlers.find(fd);
+                if (it != handlers.end()) {
+                    handler = it->second;
+                }
+            }
+            if (handler) {
+                handler->readActivity(fd);
+            }
+        }
+    }
+}
+
+AssuanReactor::AssuanReactor()
+    : d(new Private)
+{
+    if (d->epollFd < 0 || d->wakeFd < 0) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    ev.data.fd = d->wakeFd;
+    if (epoll_ctl(d->epollFd, EPOLL_CTL_ADD, d->wakeFd, &ev) != 0) {
+        return;
+    }
+    d->thread.start();
+}
+
+AssuanReactor::~AssuanReactor() {}
+
+// static
+std::shared_ptr<AssuanReactor> AssuanReactor::instance()
+{
+    static std::weak_ptr<AssuanReactor> self;
+    try {
+        return std::shared_ptr<AssuanReactor>(self);
+    } catch (const std::bad_weak_ptr &) {
+        if (qEnvironmentVariableIsSet("KLEOPATRA_NO_ASSUAN_REACTOR")) {
+            return std::shared_ptr<AssuanReactor>();
+        }
+        const std::shared_ptr<AssuanReactor> s(new AssuanReactor);
+        if (!s->d->thread.isRunning()) {
+            qCDebug(KLEOPATRA_LOG) << "AssuanReactor: could not be started, using the GUI thread";
+            return std::shared_ptr<AssuanReactor>();
+        }
+        self = s;
+        return s;
+    }
+}
+
+bool AssuanReactor::add(int fd, Handler *handler)
+{
+    Q_ASSERT(handler);
+    const QMutexLocker locker(&d->handlersMutex);
+    if (!d->control(EPOLL_CTL_ADD, fd)) {
+        return false;
+    }
+    d->handlers[fd] = handler;
+    return true;
+}
+
+void AssuanReactor::rearm(int fd)
+{
+    const QMutexLocker locker(&d->handlersMutex);
+    if (d->handlers.count(fd)) {
+        d->control(EPOLL_CTL_MOD, fd);
+    }
+}
+
+void AssuanReactor::remove(int fd)
+{
+    const QMutexLocker dispatchLocker(&d->dispatchMutex);
+    const QMutexLocker locker(&d->handlersMutex);
+    if (d->handlers.erase(fd)) {
+        epoll_ctl(d->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+bool AssuanReactor::isReactorThread() const
+{
+    return QThread::currentThread() == &d->thread;
+}
+
+#else // Q_OS_LINUX
+
+class AssuanReactor::Private
+{
+};
+
+AssuanReactor::AssuanReactor() : d(new Private) {}
+AssuanReactor::~AssuanReactor() {}
+
+// static
+std::shared_ptr<AssuanReactor> AssuanReactor::instance()
+{
+    return std::shared_ptr<AssuanReactor>();
+}
+
+bool AssuanReactor::add(int, Handler *)
+{
+    return false;
+}
+
+void AssuanReactor::rearm(int) {}
+void AssuanReactor::remove(int) {}
+
+bool AssuanReactor::isReactorThread() const
+{
+    return false;
+}
+
+#endif // Q_OS_LINUX
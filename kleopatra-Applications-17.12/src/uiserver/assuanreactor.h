@@ -0,0 +1,93 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/assuanreactor.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UISERVER_ASSUANREACTOR_H__
+#define __KLEOPATRA_UISERVER_ASSUANREACTOR_H__
+
+#include <utils/pimpl_ptr.h>
+
+#include <QtGlobal>
+
+#include <memory>
+
+namespace Kleo
+{
+
+/*!
+  A thread that waits for UI-server sockets to become readable, so
+  that Assuan protocol parsing doesn't have to happen on the GUI
+  thread.
+
+  Each registered descriptor is armed one-shot: after
+  Handler::readActivity() was called for it, it is not polled again
+  until rearm() is called. This way a connection decides, per read,
+  whether it keeps processing in the reactor thread or hands over to
+  the GUI thread.
+
+  Only available on Linux (epoll); instance() returns null elsewhere,
+  and connections keep using QSocketNotifiers on the GUI thread.
+*/
+class AssuanReactor
+{
+public:
+    class Handler
+    {
+    public:
+        virtual ~Handler() {}
+        //! called in the reactor thread
+        virtual void readActivity(int fd) = 0;
+    };
+
+    static std::shared_ptr<AssuanReactor> instance();
+
+    ~AssuanReactor();
+
+    bool add(int fd, Handler *handler);
+    void rearm(int fd);
+    //! When this returns, readActivity() is not running for @p fd, and won't be called anymore.
+    void remove(int fd);
+
+    bool isReactorThread() const;
+
+private:
+    AssuanReactor();
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+
+    Q_DISABLE_COPY(AssuanReactor)
+};
+
+}
+
+#endif // __KLEOPATRA_UISERVER_ASSUANREACTOR_H__
@@ -41,8 +41,11 @@
 
 #include "assuanserverconnection.h"
 #include "assuancommand.h"
+#include "assuanreactor.h"
 #include "sessiondata.h"
 
+#include <crypto/certificateresolutioncache.h>
+
 #include <utils/input.h>
 #include <utils/output.h>
 #include <utils/gnupg-helper.h>
@@ -64,6 +67,8 @@
 #include <KLocalizedString>
 #include <KWindowSystem>
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QSocketNotifier>
 #include <QTimer>
 #include <QVariant>
@@ -243,7 +248,30 @@ static void apply_window_id(QWidget *widget, const QString &winIdStr)
 //
 //
 
-class AssuanServerConnection::Private : public QObject
+// Built once per set of command factories and shared, read-only, by
+// all connections, so setting up a connection is a plain loop over
+// assuan_register_command().
+class AssuanServerConnection::DispatchTable
+{
+public:
+    struct Command {
+        const char *name;
+        AssuanCommandFactory::_Handler handler;
+    };
+
+    std::vector<Command> commands; // sorted by name, case-insensitively
+    std::vector< std::shared_ptr<AssuanCommandFactory> > factories; // sorted: _detail::ByName<std::less>
+};
+
+// Where an AssuanReactor is available, the connection's Assuan context
+// is used by one thread at a time: the reactor thread parses commands
+// as long as they don't need the GUI thread. Factory commands, and
+// handlers wrapped in on_gui_thread(), hand the context over to the
+// GUI thread, which gives it back in resumeReading() once nothing is
+// running there anymore. While the GUI thread owns the context, the
+// reactor only forwards read activity to it.
+
+class AssuanServerConnection::Private : public QObject, public AssuanReactor::Handler
 {
     Q_OBJECT
     friend class ::Kleo::AssuanServerConnection;
@@ -251,9 +279,17 @@ class AssuanServerConnection::Private : public QObject
     friend class ::Kleo::AssuanCommand;
     AssuanServerConnection *const q;
 public:
-    Private(assuan_fd_t fd_, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories_, AssuanServerConnection *qq);
+    Private(assuan_fd_t fd_, const std::shared_ptr<const DispatchTable> &dispatchTable_, AssuanServerConnection *qq);
     ~Private();
 
+    static std::shared_ptr<const DispatchTable> makeDispatchTable(const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories);
+
+#ifndef HAVE_ASSUAN2
+    typedef int (*AssuanHandler)(assuan_context_t, char *);
+#else
+    typedef gpg_error_t (*AssuanHandler)(assuan_context_t, char *);
+#endif
+
 Q_SIGNALS:
     void startKeyManager();
 
@@ -261,25 +297,155 @@ public Q_SLOTS:
     void slotReadActivity(int)
     {
         Q_ASSERT(ctx);
+        if (processNext()) {
+            connectionClosed();
+        } else {
+            resumeReading();
+        }
+    }
+
+    int startCommandBottomHalf()
+    {
+        const int rc = startCommandBottomHalfImpl();
+        resumeReading();
+        return rc;
+    }
+
+private Q_SLOTS:
+    void slotForwardedRead(int epoch)
+    {
+        forwardedReadPending.storeRelease(0);
+        if (closed || epoch != readEpoch.loadAcquire() || !guiOwnsContext.loadAcquire()) {
+            return; // stale
+        }
+        slotReadActivity(-1);
+    }
+
+    void slotRunDeferredHandler()
+    {
+        const AssuanHandler handler = deferredHandler;
+        const QByteArray command = deferredCommand;
+        QByteArray line = deferredLine;
+        deferredHandler = nullptr;
+        deferredCommand.clear();
+        deferredLine.clear();
+        if (!closed) {
+            if (!command.isEmpty()) {
+                (void)AssuanCommandFactory::_handle(ctx.get(), line.data(), command.constData());
+            } else if (handler) {
+                (void)handler(ctx.get(), line.data());
+            }
+        }
+        resumeReading();
+    }
+
+    void slotConnectionClosed()
+    {
+        connectionClosed();
+    }
+
+private:
+    // AssuanReactor::Handler, called in the reactor thread
+    void readActivity(int fd) override
+    {
+        Q_UNUSED(fd);
+        if (guiOwnsContext.loadAcquire()) {
+            forwardedReadPending.storeRelease(1);
+            QMetaObject::invokeMethod(this, "slotForwardedRead", Qt::QueuedConnection, Q_ARG(int, readEpoch.loadAcquire()));
+            return;
+        }
+        const bool closing = processNext();
+        if (closing || hasDeferredWork()) {
+            readEpoch.ref();
+            guiOwnsContext.storeRelease(1);
+            QMetaObject::invokeMethod(this, closing ? "slotConnectionClosed" : "slotRunDeferredHandler", Qt::QueuedConnection);
+            return;
+        }
+        for (int reactorFd : reactorFds) {
+            reactor->rearm(reactorFd);
+        }
+    }
+
+    // Called on the GUI thread when it is done with the context for now:
+    // gives it back to the reactor unless a command is still running,
+    // in which case read activity keeps being forwarded.
+    void resumeReading()
+    {
+        if (!reactor || closed) {
+            return;
+        }
+        if (!currentCommand && !hasDeferredWork()) {
+            readEpoch.ref();
+            guiOwnsContext.storeRelease(0);
+        } else if (forwardedReadPending.loadAcquire()) {
+            return; // will be rearmed after the forwarded read
+        }
+        for (int reactorFd : reactorFds) {
+            reactor->rearm(reactorFd);
+        }
+    }
+
+    bool processNext()
+    {
 #ifndef HAVE_ASSUAN2
-        if (const int err = assuan_process_next(ctx.get())) {
+        return assuan_process_next(ctx.get()) != 0;
 #else
         int done = false;
-        if (const int err = assuan_process_next(ctx.get(), &done) || done) {
+        const int err = assuan_process_next(ctx.get(), &done);
+        return err || done;
 #endif
-            //if ( err == -1 || gpg_err_code(err) == GPG_ERR_EOF ) {
-            topHalfDeletion();
-            if (nohupedCommands.empty()) {
-                bottomHalfDeletion();
+    }
+
+    void connectionClosed()
+    {
+        topHalfDeletion();
+        if (nohupedCommands.empty()) {
+            bottomHalfDeletion();
+        }
+    }
+
+    bool hasDeferredWork() const
+    {
+        return deferredHandler || !deferredCommand.isEmpty();
+    }
+
+    bool inReactorThread() const
+    {
+        return reactor && reactor->isReactorThread();
+    }
+
+    void unregisterFromReactor()
+    {
+        if (reactor) {
+            for (int reactorFd : reactorFds) {
+                reactor->remove(reactorFd);
             }
-            //} else {
-            //assuan_process_done( ctx.get(), err );
-            //return;
-            //}
         }
+        reactorFds.clear();
     }
 
-    int startCommandBottomHalf();
+    // Wraps handlers that create QObjects or otherwise need to run on
+    // the GUI thread: in the reactor thread, the command is deferred
+    // until the context has been handed over.
+    template <AssuanHandler handler>
+#ifndef HAVE_ASSUAN2
+    static int on_gui_thread(assuan_context_t ctx_, char *line)
+    {
+#else
+    static gpg_error_t on_gui_thread(assuan_context_t ctx_, char *line)
+    {
+#endif
+        Q_ASSERT(assuan_get_pointer(ctx_));
+        AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(ctx_));
+        if (!conn.inReactorThread()) {
+            return handler(ctx_, line);
+        }
+        conn.deferredHandler = handler;
+        conn.deferredLine = QByteArray(line ? line : "");
+        return 0;
+    }
+
+    int startCommandBottomHalfImpl();
 
 private:
     void nohupDone(AssuanCommand *cmd)
@@ -301,6 +467,7 @@ private:
             return;
         }
         currentCommand.reset();
+        resumeReading();
     }
 
     void topHalfDeletion()
@@ -308,6 +475,7 @@ private:
         if (currentCommand) {
             currentCommand->canceled();
         }
+        unregisterFromReactor();
         if (fd != ASSUAN_INVALID_FD) {
 #if defined(Q_OS_WIN32)
             CloseHandle(fd);
@@ -453,6 +621,13 @@ private:
             ba = conn.dumpRecipients();
         } else if (qstrcmp(line, "x-files") == 0) {
             ba = conn.dumpFiles();
+        } else if (qstrcmp(line, "x-stats") == 0) {
+            ba = conn.stats->dump();
+            const Crypto::CertificateResolutionCache::Statistics rs = Crypto::CertificateResolutionCache::instance()->statistics();
+            ba += "x-resolution-cache hits=" + QByteArray::number(rs.hits)
+                  + " misses=" + QByteArray::number(rs.misses)
+                  + " invalidations=" + QByteArray::number(rs.invalidations)
+                  + " entries=" + QByteArray::number(rs.entries) + '\n';
         } else {
             static const QString errorString = i18n("Unknown value for WHAT");
             return assuan_process_done_msg(ctx_, gpg_error(GPG_ERR_ASS_PARAMETER), errorString);
@@ -533,6 +708,12 @@ private:
 
             std::shared_ptr< typename Input_or_Output<in>::type > io;
 
+            // all streams of one operation are either logged or not
+            if (conn.ioOperationSampled < 0) {
+                conn.ioOperationSampled = Log::instance()->sampleIOOperation();
+            }
+            const Log::IOOperationScope ioOperationScope(conn.ioOperationSampled);
+
             if (options.count("FD")) {
 
                 if (options.count("FILE")) {
@@ -862,6 +1043,7 @@ private:
         std::for_each(messages.begin(), messages.end(), std::mem_fn(&Input::finalize));
         messages.clear();
         bias = GpgME::UnknownProtocol;
+        ioOperationSampled = -1;
     }
 
     assuan_fd_t fd;
@@ -873,10 +1055,20 @@ private:
     bool informativeSenders;    // address taken, so no : 1
     bool informativeRecipients; // address taken, so no : 1
     GpgME::Protocol bias;
+    int ioOperationSampled;     // -1 until the first INPUT/OUTPUT/MESSAGE of an operation
     QString sessionTitle;
     unsigned int sessionId;
     std::vector< std::shared_ptr<QSocketNotifier> > notifiers;
-    std::vector< std::shared_ptr<AssuanCommandFactory> > factories; // sorted: _detail::ByName<std::less>
+    std::shared_ptr<AssuanReactor> reactor;
+    std::vector<int> reactorFds;
+    QAtomicInt guiOwnsContext;       // 1 while the GUI thread uses ctx
+    QAtomicInt readEpoch;            // bumped on each change of ownership
+    QAtomicInt forwardedReadPending;
+    AssuanHandler deferredHandler;
+    QByteArray deferredCommand;
+    QByteArray deferredLine;
+    std::shared_ptr<const DispatchTable> dispatchTable;
+    std::shared_ptr<CommandStats> stats;
     std::shared_ptr<AssuanCommand> currentCommand;
     std::vector< std::shared_ptr<AssuanCommand> > nohupedCommands;
     std::map<std::string, QVariant> options;
@@ -890,6 +1082,7 @@ private:
 void AssuanServerConnection::Private::cleanup()
 {
     Q_ASSERT(nohupedCommands.empty());
+    unregisterFromReactor();
     reset();
     currentCommand.reset();
     currentCommandIsNohup = false;
@@ -899,7 +1092,48 @@ void AssuanServerConnection::Private::cleanup()
     fd = ASSUAN_INVALID_FD;
 }
 
-AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories_, AssuanServerConnection *qq)
+// static
+std::shared_ptr<const AssuanServerConnection::DispatchTable> AssuanServerConnection::Private::makeDispatchTable(const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories)
+{
+#ifdef __GLIBCXX__
+    Q_ASSERT(__gnu_cxx::is_sorted(factories.begin(), factories.end(), _detail::ByName<std::less>()));
+#endif
+
+    const std::shared_ptr<DispatchTable> table(new DispatchTable);
+    table->factories = factories;
+
+    static const DispatchTable::Command builtins[] = {
+        { "INPUT",            &on_gui_thread<&Private::input_handler>   },
+        { "MESSAGE",          &on_gui_thread<&Private::message_handler> },
+        { "OUTPUT",           &on_gui_thread<&Private::output_handler>  },
+        { "FILE",             &Private::file_handler                    },
+        { "GETINFO",          &Private::getinfo_handler                 },
+        { "START_KEYMANAGER", &Private::start_keymanager_handler        },
+        { "START_CONFDIALOG", &Private::start_confdialog_handler        },
+        { "RECIPIENT",        &Private::recipient_handler               },
+        { "SENDER",           &Private::sender_handler                  },
+        { "SESSION",          &Private::session_handler                 },
+        { "CAPABILITIES",     &Private::capabilities_handler            },
+    };
+
+    table->commands.reserve(sizeof builtins / sizeof * builtins + factories.size());
+    table->commands.insert(table->commands.end(), std::begin(builtins), std::end(builtins));
+    for (const std::shared_ptr<AssuanCommandFactory> &fac : factories) {
+        const DispatchTable::Command cmd = { fac->name(), fac->_handler() };
+        table->commands.push_back(cmd);
+    }
+    std::sort(table->commands.begin(), table->commands.end(),
+              [](const DispatchTable::Command &lhs, const DispatchTable::Command &rhs) {
+                  return qstricmp(lhs.name, rhs.name) < 0;
+              });
+    Q_ASSERT(std::adjacent_find(table->commands.begin(), table->commands.end(),
+                                [](const DispatchTable::Command &lhs, const DispatchTable::Command &rhs) {
+                                    return qstricmp(lhs.name, rhs.name) == 0;
+                                }) == table->commands.end());
+    return table;
+}
+
+AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::shared_ptr<const DispatchTable> &dispatchTable_, AssuanServerConnection *qq)
     : QObject(),
       q(qq),
       fd(fd_),
@@ -910,12 +1144,20 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
       informativeSenders(false),
       informativeRecipients(false),
       bias(GpgME::UnknownProtocol),
+      ioOperationSampled(-1),
       sessionId(0),
-      factories(factories_)
-{
-#ifdef __GLIBCXX__
-    Q_ASSERT(__gnu_cxx::is_sorted(factories_.begin(), factories_.end(), _detail::ByName<std::less>()));
+#ifdef HAVE_ASSUAN2
+      // with libassuan 1, the reset notifier can't be deferred to the GUI thread
+      reactor(AssuanReactor::instance()),
 #endif
+      guiOwnsContext(1),
+      readEpoch(0),
+      forwardedReadPending(0),
+      deferredHandler(nullptr),
+      dispatchTable(dispatchTable_),
+      stats(CommandStats::instance())
+{
+    Q_ASSERT(dispatchTable);
 
     if (fd == ASSUAN_INVALID_FD) {
         throw Exception(gpg_error(GPG_ERR_INV_ARG), "pre-assuan_init_socket_server_ext");
@@ -946,107 +1188,24 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
     FILE *const logFile = Log::instance()->logFile();
     assuan_set_log_stream(ctx.get(), logFile ? logFile : stderr);
 
-    // register FDs with the event loop:
-    assuan_fd_t fds[MAX_ACTIVE_FDS];
-    const int numFDs = assuan_get_active_fds(ctx.get(), FOR_READING, fds, MAX_ACTIVE_FDS);
-    Q_ASSERT(numFDs != -1);   // == 1
-
-    if (!numFDs || fds[0] != fd) {
-        const std::shared_ptr<QSocketNotifier> sn(new QSocketNotifier((intptr_t)fd, QSocketNotifier::Read), std::mem_fn(&QObject::deleteLater));
-        connect(sn.get(), &QSocketNotifier::activated, this, &Private::slotReadActivity);
-        notifiers.push_back(sn);
-    }
-
-    notifiers.reserve(notifiers.size() + numFDs);
-    for (int i = 0; i < numFDs; ++i) {
-        const std::shared_ptr<QSocketNotifier> sn(new QSocketNotifier((intptr_t)fds[i], QSocketNotifier::Read), std::mem_fn(&QObject::deleteLater));
-        connect(sn.get(), &QSocketNotifier::activated, this, &Private::slotReadActivity);
-        notifiers.push_back(sn);
-    }
-
-    // register our INPUT/OUTPUT/MESSGAE/FILE handlers:
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "INPUT",  input_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "INPUT",  input_handler, ""))
-#endif
-        throw Exception(err, "register \"INPUT\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "MESSAGE",  message_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "MESSAGE",  message_handler, ""))
-#endif
-        throw Exception(err, "register \"MESSAGE\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "OUTPUT", output_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "OUTPUT", output_handler, ""))
-#endif
-        throw Exception(err, "register \"OUTPUT\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "FILE", file_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "FILE", file_handler, ""))
-#endif
-        throw Exception(err, "register \"FILE\" handler");
-
-    // register user-defined commands:
-    Q_FOREACH (std::shared_ptr<AssuanCommandFactory> fac, factories)
+    // register built-in and user-defined commands:
+    for (const DispatchTable::Command &cmd : dispatchTable->commands)
 #ifndef HAVE_ASSUAN2
-        if (const gpg_error_t err = assuan_register_command(ctx.get(), fac->name(), fac->_handler()))
+        if (const gpg_error_t err = assuan_register_command(ctx.get(), cmd.name, cmd.handler))
 #else
-        if (const gpg_error_t err = assuan_register_command(ctx.get(), fac->name(), fac->_handler(), ""))
+        if (const gpg_error_t err = assuan_register_command(ctx.get(), cmd.name, cmd.handler, ""))
 #endif
-            throw Exception(err, std::string("register \"") + fac->name() + "\" handler");
-
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "GETINFO", getinfo_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "GETINFO", getinfo_handler, ""))
-#endif
-        throw Exception(err, "register \"GETINFO\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "START_KEYMANAGER", start_keymanager_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "START_KEYMANAGER", start_keymanager_handler, ""))
-#endif
-        throw Exception(err, "register \"START_KEYMANAGER\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "START_CONFDIALOG", start_confdialog_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "START_CONFDIALOG", start_confdialog_handler, ""))
-#endif
-        throw Exception(err, "register \"START_CONFDIALOG\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "RECIPIENT", recipient_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "RECIPIENT", recipient_handler, ""))
-#endif
-        throw Exception(err, "register \"RECIPIENT\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "SENDER", sender_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "SENDER", sender_handler, ""))
-#endif
-        throw Exception(err, "register \"SENDER\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "SESSION", session_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "SESSION", session_handler, ""))
-#endif
-        throw Exception(err, "register \"SESSION\" handler");
-#ifndef HAVE_ASSUAN2
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "CAPABILITIES", capabilities_handler))
-#else
-    if (const gpg_error_t err = assuan_register_command(ctx.get(), "CAPABILITIES", capabilities_handler, ""))
-#endif
-        throw Exception(err, "register \"CAPABILITIES\" handler");
+            throw Exception(err, std::string("register \"") + cmd.name + "\" handler");
 
     assuan_set_hello_line(ctx.get(), "GPG UI server (Kleopatra/" KLEOPATRA_VERSION_STRING ") ready to serve");
     //assuan_set_hello_line( ctx.get(), GPG UI server (qApp->applicationName() + " v" + kapp->applicationVersion() + "ready to serve" )
 
     // some notifiers we're interested in:
+#ifndef HAVE_ASSUAN2
     if (const gpg_error_t err = assuan_register_reset_notify(ctx.get(), reset_handler)) {
+#else
+    if (const gpg_error_t err = assuan_register_reset_notify(ctx.get(), on_gui_thread<&Private::reset_handler>)) {
+#endif
         throw Exception(err, "register reset notify");
     }
     if (const gpg_error_t err = assuan_register_option_handler(ctx.get(), option_handler)) {
@@ -1059,6 +1218,44 @@ AssuanServerConnection::Private::Private(assuan_fd_t fd_, const std::vector< std
     if (const gpg_error_t err = assuan_accept(ctx.get())) {
         throw Exception(err, "assuan_accept");
     }
+
+    // register FDs with the reactor or the event loop:
+    assuan_fd_t fds[MAX_ACTIVE_FDS];
+    int numFDs = assuan_get_active_fds(ctx.get(), FOR_READING, fds, MAX_ACTIVE_FDS);
+    Q_ASSERT(numFDs != -1);   // == 1
+    if (numFDs < 0) {
+        numFDs = 0;
+    }
+
+    std::vector<assuan_fd_t> activeFDs;
+    if (!numFDs || fds[0] != fd) {
+        activeFDs.push_back(fd);
+    }
+    activeFDs.insert(activeFDs.end(), fds, fds + numFDs);
+
+    if (reactor) {
+        for (assuan_fd_t activeFD : activeFDs) {
+            if (!reactor->add(int(intptr_t(activeFD)), this)) {
+                qCDebug(KLEOPATRA_LOG) << "AssuanServerConnection: cannot use the reactor, falling back to the GUI thread";
+                unregisterFromReactor();
+                reactor.reset();
+                break;
+            }
+            reactorFds.push_back(int(intptr_t(activeFD)));
+        }
+    }
+    if (reactor) {
+        // from now on, the reactor thread owns ctx
+        guiOwnsContext.storeRelease(0);
+        return;
+    }
+
+    notifiers.reserve(activeFDs.size());
+    for (assuan_fd_t activeFD : activeFDs) {
+        const std::shared_ptr<QSocketNotifier> sn(new QSocketNotifier((intptr_t)activeFD, QSocketNotifier::Read), std::mem_fn(&QObject::deleteLater));
+        connect(sn.get(), &QSocketNotifier::activated, this, &Private::slotReadActivity);
+        notifiers.push_back(sn);
+    }
 }
 
 AssuanServerConnection::Private::~Private()
@@ -1066,8 +1263,14 @@ AssuanServerConnection::Private::~Private()
     cleanup();
 }
 
-AssuanServerConnection::AssuanServerConnection(assuan_fd_t fd, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories, QObject *p)
-    : QObject(p), d(new Private(fd, factories, this))
+// static
+std::shared_ptr<const AssuanServerConnection::DispatchTable> AssuanServerConnection::makeDispatchTable(const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories)
+{
+    return Private::makeDispatchTable(factories);
+}
+
+AssuanServerConnection::AssuanServerConnection(assuan_fd_t fd, const std::shared_ptr<const DispatchTable> &dispatchTable, QObject *p)
+    : QObject(p), d(new Private(fd, dispatchTable, this))
 {
 
 }
@@ -1160,7 +1363,9 @@ public:
           informativeSenders(false),
           bias(GpgME::UnknownProtocol),
           done(false),
-          nohup(false)
+          nohup(false),
+          stats(nullptr),
+          lastMarkUs(0)
     {
 
     }
@@ -1178,6 +1383,18 @@ public:
     AssuanContext ctx;
     bool done;
     bool nohup;
+    std::shared_ptr<CommandStats> statsHolder;
+    CommandStats::Entry *stats;
+    QElapsedTimer timer; // since the command was received
+    qint64 lastMarkUs;
+
+    void recordCompletion(bool error)
+    {
+        if (stats && timer.isValid()) {
+            CommandStats::record(stats, CommandStats::Total, timer.nsecsElapsed() / 1000);
+            CommandStats::countCompleted(stats, error);
+        }
+    }
 };
 
 AssuanCommand::AssuanCommand()
@@ -1193,6 +1410,7 @@ AssuanCommand::~AssuanCommand()
 
 int AssuanCommand::start()
 {
+    markPhaseDone(CommandStats::Queued);
     try {
         if (const int err = doStart())
             if (!d->done) {
@@ -1224,10 +1442,23 @@ int AssuanCommand::start()
 
 void AssuanCommand::canceled()
 {
+    if (!d->done) {
+        d->recordCompletion(true);
+    }
     d->done = true;
     doCanceled();
 }
 
+void AssuanCommand::markPhaseDone(CommandStats::Phase phase)
+{
+    if (!d->stats || !d->timer.isValid()) {
+        return;
+    }
+    const qint64 now = d->timer.nsecsElapsed() / 1000;
+    CommandStats::record(d->stats, phase, now - d->lastMarkUs);
+    d->lastMarkUs = now;
+}
+
 // static
 int AssuanCommand::makeError(int code)
 {
@@ -1279,7 +1510,7 @@ const std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> > &AssuanCom
 bool AssuanCommand::hasMemento(const QByteArray &tag) const
 {
     if (const unsigned int id = sessionId()) {
-        return SessionDataHandler::instance()->sessionData(id)->mementos.count(tag) || mementos().count(tag);
+        return SessionDataHandler::instance()->sessionData(id)->hasMemento(tag) || mementos().count(tag);
     } else {
         return mementos().count(tag);
     }
@@ -1288,11 +1519,8 @@ bool AssuanCommand::hasMemento(const QByteArray &tag) const
 std::shared_ptr<AssuanCommand::Memento> AssuanCommand::memento(const QByteArray &tag) const
 {
     if (const unsigned int id = sessionId()) {
-        const std::shared_ptr<SessionDataHandler> sdh = SessionDataHandler::instance();
-        const std::shared_ptr<SessionData> sd = sdh->sessionData(id);
-        const std::map< QByteArray, std::shared_ptr<Memento> >::const_iterator it = sd->mementos.find(tag);
-        if (it != sd->mementos.end()) {
-            return it->second;
+        if (const std::shared_ptr<Memento> mem = SessionDataHandler::instance()->sessionData(id)->memento(tag)) {
+            return mem;
         }
     }
     const std::map< QByteArray, std::shared_ptr<Memento> >::const_iterator it = mementos().find(tag);
@@ -1316,7 +1544,7 @@ QByteArray AssuanCommand::registerMemento(const QByteArray &tag, const std::shar
     AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(d->ctx.get()));
 
     if (const unsigned int id = sessionId()) {
-        SessionDataHandler::instance()->sessionData(id)->mementos[tag] = mem;
+        SessionDataHandler::instance()->sessionData(id)->setMemento(tag, mem);
     } else {
         conn.mementos[tag] = mem;
     }
@@ -1331,7 +1559,7 @@ void AssuanCommand::removeMemento(const QByteArray &tag)
 
     conn.mementos.erase(tag);
     if (const unsigned int id = sessionId()) {
-        SessionDataHandler::instance()->sessionData(id)->mementos.erase(tag);
+        SessionDataHandler::instance()->sessionData(id)->removeMemento(tag);
     }
 }
 
@@ -1443,10 +1671,13 @@ void AssuanCommand::done(const GpgME::Error &err)
     }
 
     d->done = true;
+    markPhaseDone(CommandStats::Crypto);
 
     std::for_each(d->messages.begin(), d->messages.end(), std::mem_fn(&Input::finalize));
     std::for_each(d->inputs.begin(), d->inputs.end(), std::mem_fn(&Input::finalize));
     std::for_each(d->outputs.begin(), d->outputs.end(), std::mem_fn(&Output::finalize));
+    markPhaseDone(CommandStats::Finalize);
+    d->recordCompletion(err.code() != 0);
     d->messages.clear();
     d->inputs.clear();
     d->outputs.clear();
@@ -1526,17 +1757,28 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
     Q_ASSERT(assuan_get_pointer(ctx));
     AssuanServerConnection::Private &conn = *static_cast<AssuanServerConnection::Private *>(assuan_get_pointer(ctx));
 
+    if (conn.inReactorThread()) {
+        // commands are QObject-heavy, create and run them on the GUI thread
+        conn.deferredCommand = commandName;
+        conn.deferredLine = QByteArray(line ? line : "");
+        return 0;
+    }
+
     try {
 
         const std::vector< std::shared_ptr<AssuanCommandFactory> >::const_iterator it
-            = std::lower_bound(conn.factories.begin(), conn.factories.end(), commandName, _detail::ByName<std::less>());
-        kleo_assert(it != conn.factories.end());
+            = std::lower_bound(conn.dispatchTable->factories.begin(), conn.dispatchTable->factories.end(), commandName, _detail::ByName<std::less>());
+        kleo_assert(it != conn.dispatchTable->factories.end());
         kleo_assert(*it);
         kleo_assert(qstricmp((*it)->name(), commandName) == 0);
 
         const std::shared_ptr<AssuanCommand> cmd = (*it)->create();
         kleo_assert(cmd);
 
+        cmd->d->timer.start();
+        cmd->d->statsHolder = conn.stats;
+        cmd->d->stats = conn.stats->entry((*it)->name());
+
         cmd->d->ctx     = conn.ctx;
         cmd->d->options = conn.options;
         cmd->d->inputs.swap(conn.inputs);     kleo_assert(conn.inputs.empty());
@@ -1550,6 +1792,7 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
         cmd->d->bias                  = conn.bias;
         cmd->d->sessionTitle          = conn.sessionTitle;
         cmd->d->sessionId             = conn.sessionId;
+        conn.ioOperationSampled = -1; // the streams gathered so far belong to this command
 
         const std::map<std::string, std::string> cmdline_options = parse_commandline(line);
         for (std::map<std::string, std::string>::const_iterator it = cmdline_options.begin(), end = cmdline_options.end(); it != end; ++it) {
@@ -1581,7 +1824,7 @@ gpg_error_t AssuanCommandFactory::_handle(assuan_context_t ctx, char *line, cons
     }
 }
 
-int AssuanServerConnection::Private::startCommandBottomHalf()
+int AssuanServerConnection::Private::startCommandBottomHalfImpl()
 {
 
     commandWaitingForCryptoCommandsEnabled = currentCommand && !cryptoCommandsEnabled;
@@ -52,7 +52,11 @@ class AssuanServerConnection : public QObject
 {
     Q_OBJECT
 public:
-    AssuanServerConnection(assuan_fd_t fd, const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories, QObject *parent = nullptr);
+    class DispatchTable;
+    //! @p factories must be sorted by name
+    static std::shared_ptr<const DispatchTable> makeDispatchTable(const std::vector< std::shared_ptr<AssuanCommandFactory> > &factories);
+
+    AssuanServerConnection(assuan_fd_t fd, const std::shared_ptr<const DispatchTable> &dispatchTable, QObject *parent = nullptr);
     ~AssuanServerConnection();
 
 public Q_SLOTS:
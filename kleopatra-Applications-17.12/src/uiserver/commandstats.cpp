@@ -0,0 +1,231 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/commandstats.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "commandstats.h"
+
+#include <QByteArray>
+#include <QMutex>
+#include <QtAlgorithms>
+
+#include <atomic>
+#include <map>
+#include <string>
+
+using namespace Kleo;
+
+namespace
+{
+
+class Histogram
+{
+public:
+    enum {
+        SubBucketBits = 3,
+        SubBuckets = 1 << SubBucketBits,
+        MaxExponent = 31, // clamp at ~35 minutes
+        NumBuckets = (MaxExponent - SubBucketBits + 2) * SubBuckets
+    };
+
+    Histogram() : count(0), sum(0), max(0)
+    {
+        for (std::atomic<quint64> &b : buckets) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static int bucketFor(quint64 value)
+    {
+        if (value < SubBuckets) {
+            return int(value);
+        }
+        const int exponent = 63 - int(qCountLeadingZeroBits(value));
+        if (exponent > MaxExponent) {
+            return NumBuckets - 1;
+        }
+        const int sub = int(value >> (exponent - SubBucketBits)) & (SubBuckets - 1);
+        return (exponent - SubBucketBits + 1) * SubBuckets + sub;
+    }
+
+    static quint64 lowerBound(int bucket)
+    {
+        if (bucket < SubBuckets) {
+            return bucket;
+        }
+        const int exponent = bucket / SubBuckets + SubBucketBits - 1;
+        const int sub = bucket % SubBuckets;
+        return quint64(SubBuckets + sub) << (exponent - SubBucketBits);
+    }
+
+    void record(qint64 microseconds)
+    {
+        const quint64 value = microseconds > 0 ? quint64(microseconds) : 0;
+        buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        quint64 m = max.load(std::memory_order_relaxed);
+        while (value > m && !max.compare_exchange_weak(m, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    // reads are not a consistent snapshot, which is fine for statistics
+    quint64 percentile(double p) const
+    {
+        const quint64 n = count.load(std::memory_order_relaxed);
+        const quint64 rank = quint64(p * n + 0.5);
+        quint64 seen = 0;
+        for (int i = 0; i < NumBuckets; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank && seen) {
+                return lowerBound(i);
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<quint64> buckets[NumBuckets];
+    std::atomic<quint64> count;
+    std::atomic<quint64> sum;
+    std::atomic<quint64> max;
+};
+
+static const char *const phaseNames[CommandStats::NumPhases] = {
+    "queued", "resolve", "crypto", "finalize", "total"
+};
+
+}
+
+class CommandStats::Entry
+{
+public:
+    Entry() : completed(0), errors(0) {}
+
+    std::atomic<quint64> completed;
+    std::atomic<quint64> errors;
+    Histogram phases[NumPhases];
+};
+
+class CommandStats::Private
+{
+    friend class ::Kleo::CommandStats;
+public:
+    Private() : mutex(), entries() {}
+
+private:
+    mutable QMutex mutex;
+    std::map<std::string, std::unique_ptr<Entry> > entries;
+};
+
+std::shared_ptr<CommandStats> CommandStats::instance()
+{
+    static std::weak_ptr<CommandStats> self;
+    static QMutex mutex;
+    const QMutexLocker locker(&mutex);
+    try {
+        return std::shared_ptr<CommandStats>(self);
+    } catch (const std::bad_weak_ptr &) {
+        const std::shared_ptr<CommandStats> s(new CommandStats);
+        self = s;
+        return s;
+    }
+}
+
+CommandStats::CommandStats() : d(new Private)
+{
+}
+
+CommandStats::~CommandStats()
+{
+}
+
+CommandStats::Entry *CommandStats::entry(const char *command)
+{
+    if (!command) {
+        return nullptr;
+    }
+    const QMutexLocker locker(&d->mutex);
+    std::unique_ptr<Entry> &e = d->entries[command];
+    if (!e) {
+        e.reset(new Entry);
+    }
+    return e.get();
+}
+
+// static
+void CommandStats::record(Entry *entry, Phase phase, qint64 microseconds)
+{
+    if (entry && phase >= 0 && phase < NumPhases) {
+        entry->phases[phase].record(microseconds);
+    }
+}
+
+// static
+void CommandStats::countCompleted(Entry *entry, bool error)
+{
+    if (!entry) {
+        return;
+    }
+    entry->completed.fetch_add(1, std::memory_order_relaxed);
+    if (error) {
+        entry->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+QByteArray CommandStats::dump() const
+{
+    QByteArray result;
+    const QMutexLocker locker(&d->mutex);
+    for (const auto &e : d->entries) {
+        const Entry &entry = *e.second;
+        result += e.first.c_str();
+        result += " completed=" + QByteArray::number(entry.completed.load(std::memory_order_relaxed))
+                  + " errors=" + QByteArray::number(entry.errors.load(std::memory_order_relaxed)) + '\n';
+        for (int phase = 0; phase < NumPhases; ++phase) {
+            const Histogram &h = entry.phases[phase];
+            const quint64 count = h.count.load(std::memory_order_relaxed);
+            if (!count) {
+                continue;
+            }
+            result += e.first.c_str();
+            result += ' ';
+            result += phaseNames[phase];
+            result += " count=" + QByteArray::number(count)
+                      + " mean_us=" + QByteArray::number(h.sum.load(std::memory_order_relaxed) / count)
+                      + " p50_us=" + QByteArray::number(h.percentile(0.50))
+                      + " p95_us=" + QByteArray::number(h.percentile(0.95))
+                      + " p99_us=" + QByteArray::number(h.percentile(0.99))
+                      + " max_us=" + QByteArray::number(h.max.load(std::memory_order_relaxed)) + '\n';
+        }
+    }
+    return result;
+}
@@ -0,0 +1,96 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/commandstats.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UISERVER_COMMANDSTATS_H__
+#define __KLEOPATRA_UISERVER_COMMANDSTATS_H__
+
+#include <utils/pimpl_ptr.h>
+
+#include <QtGlobal>
+
+#include <memory>
+
+class QByteArray;
+
+namespace Kleo
+{
+
+/*!
+  Counters and latency histograms of the commands handled by the UI
+  server, per command and per phase. Looking up an Entry takes a mutex,
+  recording into it doesn't.
+
+  The histograms have log-linear buckets (8 per power of two, i.e. at
+  most 12.5% relative error) over microseconds, like HdrHistogram with
+  one significant digit.
+*/
+class CommandStats
+{
+public:
+    enum Phase {
+        Queued,     //!< received, but not started yet
+        Resolve,    //!< certificate resolution
+        Crypto,     //!< from start or resolution to done
+        Finalize,   //!< finalizing outputs
+        Total,      //!< received to done
+
+        NumPhases
+    };
+
+    class Entry;
+
+    static std::shared_ptr<CommandStats> instance();
+
+    ~CommandStats();
+
+    //! The returned entry lives as long as this object.
+    Entry *entry(const char *command);
+
+    static void record(Entry *entry, Phase phase, qint64 microseconds);
+    static void countCompleted(Entry *entry, bool error);
+
+    //! One line per command and phase, for GETINFO x-stats
+    QByteArray dump() const;
+
+private:
+    CommandStats();
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+
+    Q_DISABLE_COPY(CommandStats)
+};
+
+}
+
+#endif // __KLEOPATRA_UISERVER_COMMANDSTATS_H__
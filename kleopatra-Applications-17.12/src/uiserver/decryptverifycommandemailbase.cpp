@@ -36,6 +36,9 @@
 
 #include <crypto/decryptverifytask.h>
 #include <crypto/decryptverifyemailcontroller.h>
+#include <crypto/taskscheduler.h>
+
+#include "headlessbatch.h"
 
 #include <utils/hex.h>
 #include <utils/input.h>
@@ -70,7 +73,8 @@ public:
     explicit Private(DecryptVerifyCommandEMailBase *qq)
         : QObject(),
           q(qq),
-          controller()
+          controller(),
+          batch()
     {
     }
 
@@ -79,6 +83,7 @@ public:
     }
 
     void checkForErrors() const;
+    void startHeadless();
 
 public Q_SLOTS:
     void slotProgress(const QString &what, int current, int total);
@@ -96,6 +101,7 @@ public:
 
 private:
     std::shared_ptr<DecryptVerifyEMailController> controller;
+    std::unique_ptr<HeadlessBatch> batch;
 };
 
 DecryptVerifyCommandEMailBase::DecryptVerifyCommandEMailBase()
@@ -111,14 +117,19 @@ int DecryptVerifyCommandEMailBase::doStart()
 
     d->checkForErrors();
 
-    d->controller.reset(new DecryptVerifyEMailController(shared_from_this()));
-
     const QString st = sessionTitle();
     if (!st.isEmpty())
         Q_FOREACH (const std::shared_ptr<Input> &i, inputs()) {
             i->setLabel(st);
         }
 
+    if (HeadlessBatch::isEnabled(this)) {
+        d->startHeadless();
+        return 0;
+    }
+
+    d->controller.reset(new DecryptVerifyEMailController(shared_from_this()));
+
     d->controller->setSessionId(sessionId());
     d->controller->setOperation(operation());
     d->controller->setVerificationMode(messages().empty() ? Opaque : Detached);
@@ -142,6 +153,68 @@ int DecryptVerifyCommandEMailBase::doStart()
     return 0;
 }
 
+// In headless mode (see HeadlessBatch), each INPUT becomes a task of its
+// own; signature results are reported as SIGSTATUS like in the
+// interactive case, but nothing is shown.
+void DecryptVerifyCommandEMailBase::Private::startHeadless()
+{
+    const DecryptVerifyOperation op = q->operation();
+    const GpgME::Protocol proto = q->checkProtocol(q->mode());
+    const std::vector< std::shared_ptr<Input> > &inputs = q->inputs();
+    const std::vector< std::shared_ptr<Input> > &messages = q->messages();
+    const std::vector< std::shared_ptr<Output> > &outputs = q->outputs();
+    const std::vector<KMime::Types::Mailbox> senders = q->informativeSenders() ? q->senders() : std::vector<KMime::Types::Mailbox>();
+
+    if (op != Verify && outputs.empty())
+        throw Kleo::Exception(q->makeError(GPG_ERR_ASS_NO_OUTPUT),
+                              i18n("Decryption without a dialog needs an OUTPUT for each INPUT"));
+
+    std::vector< std::shared_ptr<Task> > tasks;
+    tasks.reserve(inputs.size());
+    for (unsigned int i = 0, end = inputs.size(); i < end; ++i) {
+        std::shared_ptr<AbstractDecryptVerifyTask> task;
+        if (op == Decrypt) {
+            const std::shared_ptr<DecryptTask> t(new DecryptTask);
+            t->setInput(inputs[i]);
+            t->setOutput(outputs[i]);
+            t->setProtocol(proto);
+            task = t;
+        } else if (op == DecryptVerify) {
+            const std::shared_ptr<DecryptVerifyTask> t(new DecryptVerifyTask);
+            t->setInput(inputs[i]);
+            t->setOutput(outputs[i]);
+            t->setProtocol(proto);
+            task = t;
+        } else if (!messages.empty()) {
+            const std::shared_ptr<VerifyDetachedTask> t(new VerifyDetachedTask);
+            t->setInput(inputs[i]);
+            t->setSignedData(messages[i]);
+            t->setProtocol(proto);
+            task = t;
+        } else {
+            const std::shared_ptr<VerifyOpaqueTask> t(new VerifyOpaqueTask);
+            t->setInput(inputs[i]);
+            if (!outputs.empty()) {
+                t->setOutput(outputs[i]);
+            }
+            t->setProtocol(proto);
+            task = t;
+        }
+        if (i < senders.size()) {
+            task->setInformativeSender(senders[i]);
+        }
+        tasks.push_back(task);
+    }
+
+    batch.reset(new HeadlessBatch(q));
+    batch->setTaskDoneCallback([this](Task *, const Task::Result &result) {
+        if (const DecryptVerifyResult *const dvResult = dynamic_cast<const DecryptVerifyResult *>(&result)) {
+            verificationResult(dvResult->verificationResult());
+        }
+    });
+    batch->start(tasks, TaskScheduler::CPU);
+}
+
 void DecryptVerifyCommandEMailBase::Private::checkForErrors() const
 {
     if (!q->senders().empty() && !q->informativeSenders())
@@ -206,6 +279,9 @@ void DecryptVerifyCommandEMailBase::Private::checkForErrors() const
 
 void DecryptVerifyCommandEMailBase::doCanceled()
 {
+    if (d->batch) {
+        d->batch->cancel();
+    }
     if (d->controller) {
         d->controller->cancel();
     }
@@ -34,7 +34,12 @@
 
 #include "encryptcommand.h"
 
+#include <crypto/encryptemailtask.h>
 #include <crypto/newsignencryptemailcontroller.h>
+#include <crypto/recipient.h>
+#include <crypto/taskscheduler.h>
+
+#include "headlessbatch.h"
 
 #include <utils/kleo_assert.h>
 #include <utils/input.h>
@@ -42,10 +47,14 @@
 
 #include <Libkleo/Exception>
 
+#include <gpgme++/key.h>
+
 #include <KLocalizedString>
 
 #include <QTimer>
 
+#include <algorithm>
+
 using namespace Kleo;
 using namespace Kleo::Crypto;
 
@@ -58,13 +67,16 @@ private:
 public:
     explicit Private(EncryptCommand *qq)
         : q(qq),
-          controller()
+          controller(),
+          batch()
     {
 
     }
 
 private:
     void checkForErrors() const;
+    std::vector<GpgME::Key> resolveRecipientsHeadless(GpgME::Protocol proto) const;
+    void startHeadless();
 
 private Q_SLOTS:
     void slotDone();
@@ -73,6 +85,7 @@ private Q_SLOTS:
 
 private:
     std::shared_ptr<NewSignEncryptEMailController> controller;
+    std::unique_ptr<HeadlessBatch> batch;
 };
 
 EncryptCommand::EncryptCommand()
@@ -111,7 +124,7 @@ void EncryptCommand::Private::checkForErrors() const
                         i18n("MESSAGE command is not allowed before ENCRYPT"));
 
     const std::shared_ptr<NewSignEncryptEMailController> m = q->mementoContent< std::shared_ptr<NewSignEncryptEMailController> >(NewSignEncryptEMailController::mementoName());
-    kleo_assert(m);
+    kleo_assert(m || HeadlessBatch::isEnabled(q));
 
     if (m && m->isEncrypting()) {
 
@@ -145,6 +158,64 @@ static void connectController(const QObject *controller, const QObject *d)
 
 }
 
+// In headless mode (see HeadlessBatch), every recipient must have exactly
+// one encryption certificate; nothing is ever asked.
+std::vector<GpgME::Key> EncryptCommand::Private::resolveRecipientsHeadless(GpgME::Protocol proto) const
+{
+    const std::vector<Recipient> recipients = Recipient::fromMailboxes(q->recipients());
+
+    const auto unambiguous = [&recipients](GpgME::Protocol p) {
+        return std::none_of(recipients.cbegin(), recipients.cend(),
+                            [p](const Recipient &r) { return r.isEncryptionAmbiguous(p); });
+    };
+
+    if (proto == GpgME::UnknownProtocol) {
+        // prefer OpenPGP like the controller does
+        if (unambiguous(GpgME::OpenPGP)) {
+            proto = GpgME::OpenPGP;
+        } else if (unambiguous(GpgME::CMS)) {
+            proto = GpgME::CMS;
+        } else {
+            return std::vector<GpgME::Key>();
+        }
+    } else if (!unambiguous(proto)) {
+        return std::vector<GpgME::Key>();
+    }
+
+    std::vector<GpgME::Key> keys;
+    keys.reserve(recipients.size());
+    for (const Recipient &r : recipients) {
+        keys.push_back(r.encryptionCertificateCandidates(proto).front());
+    }
+    return keys;
+}
+
+void EncryptCommand::Private::startHeadless()
+{
+    const GpgME::Protocol proto = q->checkProtocol(EMail, AssuanCommand::AllowProtocolMissing);
+    const std::vector<GpgME::Key> keys = resolveRecipientsHeadless(proto);
+    if (keys.empty())
+        throw Exception(makeError(GPG_ERR_NO_PUBKEY),
+                        i18n("No unambiguous encryption certificate found for at least one recipient"));
+    q->markPhaseDone(CommandStats::Resolve);
+
+    const std::vector< std::shared_ptr<Input> > &inputs = q->inputs();
+    const std::vector< std::shared_ptr<Output> > &outputs = q->outputs();
+
+    std::vector< std::shared_ptr<Task> > tasks;
+    tasks.reserve(inputs.size());
+    for (unsigned int i = 0, end = inputs.size(); i < end; ++i) {
+        const std::shared_ptr<EncryptEMailTask> task(new EncryptEMailTask);
+        task->setInput(inputs[i]);
+        task->setOutput(outputs[i]);
+        task->setRecipients(keys);
+        tasks.push_back(task);
+    }
+
+    batch.reset(new HeadlessBatch(q));
+    batch->start(tasks, TaskScheduler::CPU);
+}
+
 int EncryptCommand::doStart()
 {
 
@@ -152,6 +223,11 @@ int EncryptCommand::doStart()
 
     const std::shared_ptr<NewSignEncryptEMailController> seec = mementoContent< std::shared_ptr<NewSignEncryptEMailController> >(NewSignEncryptEMailController::mementoName());
 
+    if (HeadlessBatch::isEnabled(this) && !(seec && seec->isEncrypting())) {
+        d->startHeadless();
+        return 0;
+    }
+
     if (seec && seec->isEncrypting()) {
         // reuse the controller from a previous PREP_ENCRYPT, if available:
         d->controller = seec;
@@ -184,6 +260,8 @@ int EncryptCommand::doStart()
 
 void EncryptCommand::Private::slotRecipientsResolved()
 {
+    q->markPhaseDone(CommandStats::Resolve);
+
     //hold local std::shared_ptr to member as q->done() deletes *this
     const std::shared_ptr<NewSignEncryptEMailController> cont(controller);
 
@@ -223,6 +301,9 @@ void EncryptCommand::Private::slotError(int err, const QString &details)
 
 void EncryptCommand::doCanceled()
 {
+    if (d->batch) {
+        d->batch->cancel();
+    }
     if (d->controller) {
         d->controller->cancel();
     }
@@ -0,0 +1,205 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/headlessbatch.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "headlessbatch.h"
+
+#include "assuancommand.h"
+
+#include <Libkleo/Exception>
+
+#include <KConfigGroup>
+#include <KLocalizedString>
+#include <KSharedConfig>
+
+#include "kleopatra_debug.h"
+
+#include <algorithm>
+
+using namespace Kleo;
+using namespace Kleo::Crypto;
+
+class HeadlessBatch::Private
+{
+    friend class ::Kleo::HeadlessBatch;
+public:
+    explicit Private(AssuanCommand *cmd)
+        : command(cmd),
+          tasks(),
+          pending(0),
+          failed(0),
+          firstError(0),
+          firstErrorString(),
+          finished(false),
+          continueOnError(cmd->hasOption("continue-on-error"))
+    {
+    }
+
+    int indexOf(const QObject *task) const
+    {
+        const auto it = std::find_if(tasks.cbegin(), tasks.cend(),
+                                     [task](const std::shared_ptr<Task> &t) { return t.get() == task; });
+        return it == tasks.cend() ? -1 : int(it - tasks.cbegin());
+    }
+
+    void cancelRemaining()
+    {
+        const std::vector< std::shared_ptr<Task> > copy = tasks;
+        const std::shared_ptr<TaskScheduler> scheduler = TaskScheduler::mutableInstance();
+        for (const std::shared_ptr<Task> &task : copy) {
+            if (!scheduler->dequeue(task)) {
+                task->cancel();
+            }
+        }
+    }
+
+private:
+    AssuanCommand *const command; // owns us
+    std::vector< std::shared_ptr<Task> > tasks;
+    std::function<void(Task *, const Task::Result &)> taskDone;
+    unsigned int pending;
+    unsigned int failed;
+    int firstError;
+    QString firstErrorString;
+    bool finished;
+    const bool continueOnError;
+};
+
+HeadlessBatch::HeadlessBatch(AssuanCommand *command)
+    : QObject(), d(new Private(command))
+{
+}
+
+HeadlessBatch::~HeadlessBatch() {}
+
+// static
+bool HeadlessBatch::isEnabled(const AssuanCommand *command)
+{
+    if (command && command->hasOption("headless")) {
+        return true;
+    }
+    // not cached, so that changing the setting takes effect without a restart
+    return KConfigGroup(KSharedConfig::openConfig(), "UiServer").readEntry("Headless", false);
+}
+
+void HeadlessBatch::setTaskDoneCallback(const std::function<void(Task *, const Task::Result &)> &callback)
+{
+    d->taskDone = callback;
+}
+
+bool HeadlessBatch::isRunning() const
+{
+    return !d->tasks.empty() && !d->finished;
+}
+
+void HeadlessBatch::start(const std::vector< std::shared_ptr<Task> > &tasks, TaskScheduler::Resource resource)
+{
+    Q_ASSERT(d->tasks.empty());
+    d->tasks = tasks;
+    d->pending = tasks.size();
+
+    for (const std::shared_ptr<Task> &task : tasks) {
+        connect(task.get(), SIGNAL(result(std::shared_ptr<const Kleo::Crypto::Task::Result>)),
+                this, SLOT(slotTaskResult(std::shared_ptr<const Kleo::Crypto::Task::Result>)));
+    }
+
+    qCDebug(KLEOPATRA_LOG) << "HeadlessBatch:" << d->command->name() << "with" << tasks.size() << "message(s)";
+
+    const std::shared_ptr<TaskScheduler> scheduler = TaskScheduler::mutableInstance();
+    for (const std::shared_ptr<Task> &task : tasks) {
+        scheduler->enqueue(task, resource);
+    }
+}
+
+void HeadlessBatch::cancel()
+{
+    d->finished = true;
+    d->cancelRemaining();
+}
+
+void HeadlessBatch::slotTaskResult(const std::shared_ptr<const Task::Result> &result)
+{
+    if (d->finished) {
+        return;
+    }
+
+    AssuanCommand *const command = d->command;
+    Task *const task = qobject_cast<Task *>(sender());
+    const int index = d->indexOf(task);
+    const int err = result->hasError() ? result->errorCode() : 0;
+
+    try {
+        if (!err && d->taskDone && task) {
+            d->taskDone(task, *result);
+        }
+
+        QString status = QString::number(index) + QLatin1Char(' ') + QString::number(err);
+        if (err) {
+            status += QLatin1Char(' ') + result->errorString();
+        }
+        command->sendStatus("X-MESSAGE-DONE", status);
+    } catch (const Exception &e) {
+        cancel();
+        command->done(e.error(), e.message()); // deletes *this
+        return;
+    }
+
+    if (err) {
+        ++d->failed;
+        if (!d->firstError) {
+            d->firstError = err;
+            d->firstErrorString = result->errorString();
+        }
+        if (!d->continueOnError) {
+            const QString details = d->firstErrorString;
+            cancel();
+            command->done(err, details); // deletes *this
+            return;
+        }
+    }
+
+    if (--d->pending) {
+        return;
+    }
+
+    d->finished = true;
+    if (d->failed) {
+        command->done(d->firstError,
+                      i18np("One of %2 messages failed: %3", "%1 of %2 messages failed, the first with: %3",
+                            d->failed, d->tasks.size(), d->firstErrorString)); // deletes *this
+    } else {
+        command->done(); // deletes *this
+    }
+}
+
+#include "moc_headlessbatch.cpp"
@@ -0,0 +1,93 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    uiserver/headlessbatch.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UISERVER_HEADLESSBATCH_H__
+#define __KLEOPATRA_UISERVER_HEADLESSBATCH_H__
+
+#include <QObject>
+
+#include <crypto/task.h>
+#include <crypto/taskscheduler.h>
+
+#include <utils/pimpl_ptr.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Kleo
+{
+
+class AssuanCommand;
+
+/*!
+  Runs the per-message tasks of a headless SIGN or ENCRYPT (one task
+  per INPUT/OUTPUT pair) in parallel on the TaskScheduler.
+
+  Each finished message is reported with a status line
+  \code
+  S X-MESSAGE-DONE <index> <error code> [<error text>]
+  \endcode
+  where \c index counts the INPUTs from 0. When all messages are done,
+  the command is finished: with OK, or with the first error. Unless
+  \c --continue-on-error was given, the first error cancels the
+  remaining messages.
+*/
+class HeadlessBatch : public QObject
+{
+    Q_OBJECT
+public:
+    explicit HeadlessBatch(AssuanCommand *command);
+    ~HeadlessBatch();
+
+    //! Whether \a command should run headless (--headless, or [UiServer] Headless=true).
+    static bool isEnabled(const AssuanCommand *command);
+
+    //! Called with each successfully finished task and its result, before its status line is sent.
+    void setTaskDoneCallback(const std::function<void(Crypto::Task *, const Crypto::Task::Result &)> &callback);
+
+    void start(const std::vector< std::shared_ptr<Crypto::Task> > &tasks, Crypto::TaskScheduler::Resource resource);
+    void cancel();
+
+    bool isRunning() const;
+
+private Q_SLOTS:
+    void slotTaskResult(const std::shared_ptr<const Kleo::Crypto::Task::Result> &result);
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+}
+
+#endif // __KLEOPATRA_UISERVER_HEADLESSBATCH_H__
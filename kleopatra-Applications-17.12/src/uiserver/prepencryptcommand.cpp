@@ -128,6 +128,8 @@ int PrepEncryptCommand::doStart()
 
 void PrepEncryptCommand::Private::slotRecipientsResolved()
 {
+    q->markPhaseDone(CommandStats::Resolve);
+
     //hold local std::shared_ptr to member as q->done() deletes *this
     const std::shared_ptr<NewSignEncryptEMailController> cont = controller;
     QPointer<Private> that(this);
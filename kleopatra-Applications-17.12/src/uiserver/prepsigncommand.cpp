@@ -158,6 +158,8 @@ int PrepSignCommand::doStart()
 
 void PrepSignCommand::Private::slotSignersResolved()
 {
+    q->markPhaseDone(CommandStats::Resolve);
+
     //hold local std::shared_ptr to member as q->done() deletes *this
     const std::shared_ptr<NewSignEncryptEMailController> cont = controller;
     QPointer<Private> that(this);
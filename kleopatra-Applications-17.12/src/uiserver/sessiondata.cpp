@@ -36,44 +36,86 @@
 
 #include "kleopatra_debug.h"
 
-#include <QMutex>
+#include <QCoreApplication>
+#include <QMutexLocker>
 
 
 using namespace Kleo;
 
 static const int GARBAGE_COLLECTION_INTERVAL = 60000; // 1min
 
-static QMutex mutex;
-
 SessionData::SessionData()
-    : mementos(),
+    : mutex(),
+      mementos(),
       ref(0),
       ripe(false)
 {
 
 }
 
+bool SessionData::hasMemento(const QByteArray &tag) const
+{
+    const QMutexLocker locker(&mutex);
+    return mementos.count(tag);
+}
+
+SessionData::MementoPtr SessionData::memento(const QByteArray &tag) const
+{
+    const QMutexLocker locker(&mutex);
+    const auto it = mementos.find(tag);
+    return it == mementos.end() ? MementoPtr() : it->second;
+}
+
+void SessionData::setMemento(const QByteArray &tag, const MementoPtr &mem)
+{
+    const QMutexLocker locker(&mutex);
+    mementos[tag] = mem;
+}
+
+void SessionData::removeMemento(const QByteArray &tag)
+{
+    MementoPtr removed;
+    {
+        const QMutexLocker locker(&mutex);
+        const auto it = mementos.find(tag);
+        if (it == mementos.end()) {
+            return;
+        }
+        removed.swap(it->second);
+        mementos.erase(it);
+    }
+    // 'removed' is destroyed here, outside of the lock
+}
+
 // static
-std::shared_ptr<SessionDataHandler> SessionDataHandler::instance()
+SessionDataHandler *SessionDataHandler::instance()
 {
-    mutex.lock();
     static SessionDataHandler handler;
-    return std::shared_ptr<SessionDataHandler>(&handler, [](SessionDataHandler*) { mutex.unlock(); });
+    return &handler;
 }
 
 SessionDataHandler::SessionDataHandler()
     : QObject(),
-      data(),
+      garbageCollectionScheduled(0),
       timer()
 {
     timer.setInterval(GARBAGE_COLLECTION_INTERVAL);
     timer.setSingleShot(false);
+    connect(&timer, &QTimer::timeout, this, &SessionDataHandler::slotCollectGarbage);
+    // the timer is started and stopped through queued invocations, so it
+    // needs to live in a thread with an event loop, whoever comes first
+    if (QCoreApplication *const app = QCoreApplication::instance()) {
+        timer.moveToThread(app->thread());
+        moveToThread(app->thread());
+    }
 }
 
 void SessionDataHandler::enterSession(unsigned int id)
 {
     qCDebug(KLEOPATRA_LOG) << id;
-    const std::shared_ptr<SessionData> sd = sessionDataInternal(id);
+    Shard &s = shard(id);
+    const QMutexLocker locker(&s.mutex);
+    const std::shared_ptr<SessionData> sd = sessionDataInternal(s, id);
     Q_ASSERT(sd);
     ++sd->ref;
     sd->ripe = false;
@@ -82,54 +124,79 @@ void SessionDataHandler::enterSession(unsigned int id)
 void SessionDataHandler::exitSession(unsigned int id)
 {
     qCDebug(KLEOPATRA_LOG) << id;
-    const std::shared_ptr<SessionData> sd = sessionDataInternal(id);
+    Shard &s = shard(id);
+    const QMutexLocker locker(&s.mutex);
+    const std::shared_ptr<SessionData> sd = sessionDataInternal(s, id);
     Q_ASSERT(sd);
     if (--sd->ref <= 0) {
         sd->ref = 0;
         sd->ripe = false;
-        if (!timer.isActive()) {
+        if (garbageCollectionScheduled.testAndSetOrdered(0, 1)) {
             QMetaObject::invokeMethod(&timer, "start", Qt::QueuedConnection);
         }
     }
 }
 
-std::shared_ptr<SessionData> SessionDataHandler::sessionDataInternal(unsigned int id) const
+// requires shard.mutex to be locked
+std::shared_ptr<SessionData> SessionDataHandler::sessionDataInternal(Shard &shard, unsigned int id) const
 {
     std::map< unsigned int, std::shared_ptr<SessionData> >::iterator
-    it = data.lower_bound(id);
-    if (it == data.end() || it->first != id) {
+    it = shard.data.lower_bound(id);
+    if (it == shard.data.end() || it->first != id) {
         const std::shared_ptr<SessionData> sd(new SessionData);
-        it = data.insert(it, std::make_pair(id, sd));
+        it = shard.data.insert(it, std::make_pair(id, sd));
     }
     return it->second;
 }
 
 std::shared_ptr<SessionData> SessionDataHandler::sessionData(unsigned int id) const
 {
-    return sessionDataInternal(id);
+    Shard &s = shard(id);
+    const QMutexLocker locker(&s.mutex);
+    return sessionDataInternal(s, id);
 }
 
 void SessionDataHandler::clear()
 {
-    data.clear();
+    for (Shard &s : shards) {
+        std::map< unsigned int, std::shared_ptr<SessionData> > doomed;
+        {
+            const QMutexLocker locker(&s.mutex);
+            doomed.swap(s.data);
+        }
+        // the session data (and their mementos) are destroyed here,
+        // outside of the lock
+    }
 }
 
 void SessionDataHandler::slotCollectGarbage()
 {
-    const QMutexLocker locker(&mutex);
-    unsigned int alive = 0;
-    std::map< unsigned int, std::shared_ptr<SessionData> >::iterator it = data.begin(), end = data.end();
-    while (it != end)
-        if (it->second->ripe) {
-            data.erase(it++);
-        } else if (!it->second->ref) {
-            it->second->ripe = true;
-            ++it;
-        } else {
-            ++alive;
-            ++it;
-        }
-    if (alive == data.size()) {
-        QMetaObject::invokeMethod(&timer, "stop", Qt::QueuedConnection);
+    // sessions exiting from now on (re)start the timer themselves
+    garbageCollectionScheduled.storeRelease(0);
+
+    // one shard at a time, so sessions in other shards are never blocked
+    bool anyUnused = false;
+    for (Shard &s : shards) {
+        std::vector< std::shared_ptr<SessionData> > doomed;
+        const QMutexLocker locker(&s.mutex);
+        std::map< unsigned int, std::shared_ptr<SessionData> >::iterator it = s.data.begin(), end = s.data.end();
+        while (it != end)
+            if (it->second->ripe) {
+                doomed.push_back(it->second);
+                s.data.erase(it++);
+            } else if (!it->second->ref) {
+                it->second->ripe = true;
+                anyUnused = true;
+                ++it;
+            } else {
+                ++it;
+            }
+    }
+    if (anyUnused) {
+        garbageCollectionScheduled.storeRelease(1);
+    } else if (!garbageCollectionScheduled.loadAcquire()) {
+        timer.stop();
     }
 }
+
+#include "moc_sessiondata.cpp"
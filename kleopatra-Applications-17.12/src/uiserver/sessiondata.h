@@ -37,6 +37,8 @@
 
 #include "assuancommand.h"
 
+#include <QAtomicInt>
+#include <QMutex>
 #include <QTimer>
 
 #include <memory>
@@ -47,24 +49,43 @@ namespace Kleo
 
 class SessionDataHandler;
 
+/*!
+  The mementos of one UI-server session. All functions lock the
+  session's own mutex only for their duration, so no caller can keep
+  other sessions (or this one) blocked.
+*/
 class SessionData
 {
 public:
+    typedef std::shared_ptr<AssuanCommand::Memento> MementoPtr;
 
-    std::map< QByteArray, std::shared_ptr<AssuanCommand::Memento> > mementos;
+    bool hasMemento(const QByteArray &tag) const;
+    MementoPtr memento(const QByteArray &tag) const;
+    void setMemento(const QByteArray &tag, const MementoPtr &mem);
+    void removeMemento(const QByteArray &tag);
 
 private:
     friend class ::Kleo::SessionDataHandler;
     SessionData();
+
+    mutable QMutex mutex;
+    std::map<QByteArray, MementoPtr> mementos;
+    // protected by the shard mutex of SessionDataHandler:
     int ref;
     bool ripe;
 };
 
+/*!
+  Thread-safe store of the per-session data. Sessions are spread over a
+  fixed number of shards, each with its own mutex, which is only held
+  inside the member functions.
+*/
 class SessionDataHandler : public QObject
 {
+    Q_OBJECT
 public:
 
-    static std::shared_ptr<SessionDataHandler> instance();
+    static SessionDataHandler *instance();
 
     void enterSession(unsigned int id);
     void exitSession(unsigned int id);
@@ -77,11 +98,22 @@ private Q_SLOTS:
     void slotCollectGarbage();
 
 private:
-    mutable std::map< unsigned int, std::shared_ptr<SessionData> > data;
+    enum { NumShards = 16 };
+    struct Shard {
+        mutable QMutex mutex;
+        std::map< unsigned int, std::shared_ptr<SessionData> > data;
+    };
+    Shard &shard(unsigned int id) const
+    {
+        return shards[id % NumShards];
+    }
+
+    mutable Shard shards[NumShards];
+    QAtomicInt garbageCollectionScheduled;
     QTimer timer;
 
 private:
-    std::shared_ptr<SessionData> sessionDataInternal(unsigned int) const;
+    std::shared_ptr<SessionData> sessionDataInternal(Shard &shard, unsigned int) const;
     SessionDataHandler();
 };
 
@@ -34,18 +34,28 @@
 
 #include "signcommand.h"
 
+#include <crypto/certificateresolutioncache.h>
 #include <crypto/newsignencryptemailcontroller.h>
+#include <crypto/signemailtask.h>
+#include <crypto/taskscheduler.h>
+
+#include "headlessbatch.h"
 
 #include <utils/kleo_assert.h>
 #include <utils/input.h>
 #include <utils/output.h>
 
 #include <Libkleo/Exception>
+#include <Libkleo/KeyCache>
+
+#include <gpgme++/key.h>
 
 #include <KLocalizedString>
 
 #include <QTimer>
 
+#include <algorithm>
+
 using namespace Kleo;
 using namespace Kleo::Crypto;
 
@@ -57,13 +67,15 @@ private:
     SignCommand *const q;
 public:
     explicit Private(SignCommand *qq)
-        : q(qq), controller()
+        : q(qq), controller(), batch(), micAlgReported(false)
     {
 
     }
 
 private:
     void checkForErrors() const;
+    std::vector<GpgME::Key> resolveSignersHeadless(GpgME::Protocol proto) const;
+    void startHeadless();
 
 private Q_SLOTS:
     void slotSignersResolved();
@@ -73,6 +85,8 @@ private Q_SLOTS:
 
 private:
     std::shared_ptr<NewSignEncryptEMailController> controller;
+    std::unique_ptr<HeadlessBatch> batch;
+    bool micAlgReported;
 };
 
 SignCommand::SignCommand()
@@ -139,6 +153,102 @@ static void connectController(const QObject *controller, const QObject *d)
     QObject::connect(controller, SIGNAL(error(int,QString)), d, SLOT(slotError(int,QString)));
 }
 
+// In headless mode (see HeadlessBatch), the signer is picked from the
+// SENDER without asking, and no controller or widget is created.
+std::vector<GpgME::Key> SignCommand::Private::resolveSignersHeadless(GpgME::Protocol proto) const
+{
+    const std::shared_ptr<const KeyCache> cache = KeyCache::instance();
+
+    // like EncryptCommand::Private::resolveRecipientsHeadless(), only
+    // accept a protocol with exactly one candidate
+    const auto pick = [proto](const std::vector<GpgME::Key> &keys) {
+        // without an explicit protocol, prefer OpenPGP like the controller does
+        for (const GpgME::Protocol p : { GpgME::OpenPGP, GpgME::CMS }) {
+            if (proto != GpgME::UnknownProtocol && p != proto) {
+                continue;
+            }
+            const auto isProtocol = [p](const GpgME::Key &key) { return key.protocol() == p; };
+            if (std::count_if(keys.cbegin(), keys.cend(), isProtocol) == 1) {
+                return *std::find_if(keys.cbegin(), keys.cend(), isProtocol);
+            }
+        }
+        return GpgME::Key();
+    };
+
+    if (!q->informativeSenders() && !q->senders().empty()) {
+        const std::vector<KMime::Types::Mailbox> &senders = q->senders();
+        const std::shared_ptr<CertificateResolutionCache> resolutionCache = CertificateResolutionCache::instance();
+        std::vector< std::vector<GpgME::Key> > keys;
+        if (!resolutionCache->lookup(CertificateResolutionCache::Signing, GpgME::UnknownProtocol, senders, keys)) {
+            keys.reserve(senders.size());
+            for (const KMime::Types::Mailbox &sender : senders) {
+                keys.push_back(cache->findSigningKeysByMailbox(sender.addrSpec().asString()));
+            }
+            resolutionCache->insert(CertificateResolutionCache::Signing, GpgME::UnknownProtocol, senders, keys);
+        }
+        for (const std::vector<GpgME::Key> &senderKeys : keys) {
+            const GpgME::Key key = pick(senderKeys);
+            if (!key.isNull()) {
+                return std::vector<GpgME::Key>(1, key);
+            }
+        }
+        return std::vector<GpgME::Key>();
+    }
+
+    // no SENDER: only unambiguous if there is exactly one usable secret key
+    std::vector<GpgME::Key> candidates;
+    for (const GpgME::Key &key : cache->secretKeys()) {
+        if (KeyCache::isReadyForSigning(cache->keyFlags(key))
+                && (proto == GpgME::UnknownProtocol || key.protocol() == proto)) {
+            candidates.push_back(key);
+        }
+    }
+    if (candidates.size() == 1) {
+        return candidates;
+    }
+    return std::vector<GpgME::Key>();
+}
+
+void SignCommand::Private::startHeadless()
+{
+    const GpgME::Protocol proto = q->checkProtocol(EMail, AssuanCommand::AllowProtocolMissing);
+    const std::vector<GpgME::Key> signers = resolveSignersHeadless(proto);
+    if (signers.empty())
+        throw Exception(makeError(GPG_ERR_NO_SECKEY),
+                        i18n("No unambiguous signing certificate found for the given sender"));
+    q->markPhaseDone(CommandStats::Resolve);
+
+    const TaskScheduler::Resource resource = signers.front().subkey(0).isCardKey() ? TaskScheduler::Card : TaskScheduler::CPU;
+    const bool detached = q->hasOption("detached");
+    const std::vector< std::shared_ptr<Input> > &inputs = q->inputs();
+    const std::vector< std::shared_ptr<Output> > &outputs = q->outputs();
+
+    std::vector< std::shared_ptr<Task> > tasks;
+    tasks.reserve(inputs.size());
+    for (unsigned int i = 0, end = inputs.size(); i < end; ++i) {
+        const std::shared_ptr<SignEMailTask> task(new SignEMailTask);
+        task->setInput(inputs[i]);
+        task->setOutput(outputs[i]);
+        task->setSigners(signers);
+        task->setDetachedSignature(detached);
+        tasks.push_back(task);
+    }
+
+    batch.reset(new HeadlessBatch(q));
+    batch->setTaskDoneCallback([this](Task *task, const Task::Result &) {
+        const SignEMailTask *const signTask = qobject_cast<const SignEMailTask *>(task);
+        if (micAlgReported || !signTask) {
+            return;
+        }
+        const QString micAlg = signTask->micAlg();
+        if (!micAlg.isEmpty()) {
+            micAlgReported = true;
+            q->sendStatus("MICALG", micAlg);
+        }
+    });
+    batch->start(tasks, resource);
+}
+
 int SignCommand::doStart()
 {
 
@@ -146,6 +256,11 @@ int SignCommand::doStart()
 
     const std::shared_ptr<NewSignEncryptEMailController> seec = mementoContent< std::shared_ptr<NewSignEncryptEMailController> >(NewSignEncryptEMailController::mementoName());
 
+    if (HeadlessBatch::isEnabled(this) && !(seec && seec->isSigning())) {
+        d->startHeadless();
+        return 0;
+    }
+
     if (seec && seec->isSigning()) {
         // reuse the controller from a previous PREP_ENCRYPT --expect-sign, if available:
         d->controller = seec;
@@ -180,6 +295,8 @@ int SignCommand::doStart()
 
 void SignCommand::Private::slotSignersResolved()
 {
+    q->markPhaseDone(CommandStats::Resolve);
+
     //hold local std::shared_ptr to member as q->done() deletes *this
     const std::shared_ptr<NewSignEncryptEMailController> cont(controller);
 
@@ -246,6 +363,9 @@ void SignCommand::doCanceled()
     if (d->controller) {
         d->controller->cancel();
     }
+    if (d->batch) {
+        d->batch->cancel();
+    }
 }
 
 #include "signcommand.moc"
@@ -36,21 +36,26 @@
 #include "uiserver_p.h"
 
 #include "sessiondata.h"
+#include "commandstats.h"
 
 #include <utils/detail_p.h>
 #include <utils/gnupg-helper.h>
+#include <utils/log.h>
 
 #include <Libkleo/Stl_Util>
 #include <Libkleo/Exception>
 
 #include "kleopatra_debug.h"
+#include <KConfigGroup>
 #include <KLocalizedString>
+#include <KSharedConfig>
 
 #include <QTcpSocket>
 #include <QDir>
 #include <QEventLoop>
 #include <QTimer>
 #include <QFile>
+#include <QSaveFile>
 
 #include <algorithm>
 #include <cerrno>
@@ -68,7 +73,11 @@ UiServer::Private::Private(UiServer *qq)
       q(qq),
       file(),
       factories(),
+      dispatchTable(),
       connections(),
+      stats(CommandStats::instance()),
+      resolutionCache(Crypto::CertificateResolutionCache::instance()),
+      statsTimer(),
       suggestedSocketName(),
       actualSocketName(),
       cryptoCommandsEnabled(false)
@@ -79,6 +88,22 @@ UiServer::Private::Private(UiServer *qq)
     assuan_set_gpg_err_source(GPG_ERR_SOURCE_DEFAULT);
     assuan_sock_init();
 #endif
+    resolutionCache->setTimeToLive(KConfigGroup(KSharedConfig::openConfig(), "UiServer").readEntry("ResolutionCacheTTL", resolutionCache->timeToLive()));
+
+    statsTimer.setInterval(60 * 1000);
+    connect(&statsTimer, &QTimer::timeout, this, &Private::slotDumpStats);
+}
+
+void UiServer::Private::slotDumpStats()
+{
+    const std::shared_ptr<const Log> log = Log::instance();
+    if (!log->ioLoggingEnabled() || log->outputDirectory().isEmpty()) {
+        return;
+    }
+    QSaveFile file(log->outputDirectory() + QLatin1String("/uiserver-stats.txt"));
+    if (!file.open(QIODevice::WriteOnly) || file.write(stats->dump()) < 0 || !file.commit()) {
+        qCDebug(KLEOPATRA_LOG) << "UiServer: cannot write statistics to" << file.fileName() << ':' << file.errorString();
+    }
 }
 
 bool UiServer::Private::isStaleAssuanSocket(const QString &fileName)
@@ -124,6 +149,7 @@ bool UiServer::registerCommandFactory(const std::shared_ptr<AssuanCommandFactory
     if (cf && empty(std::equal_range(d->factories.begin(), d->factories.end(), cf, _detail::ByName<std::less>()))) {
         d->factories.push_back(cf);
         std::inplace_merge(d->factories.begin(), d->factories.end() - 1, d->factories.end(), _detail::ByName<std::less>());
+        d->dispatchTable.reset();
         return true;
     } else {
         if (!cf) {
@@ -139,6 +165,9 @@ bool UiServer::registerCommandFactory(const std::shared_ptr<AssuanCommandFactory
 void UiServer::start()
 {
     d->makeListeningSocket();
+    if (Log::instance()->ioLoggingEnabled()) {
+        d->statsTimer.start();
+    }
 }
 
 void UiServer::stop()
@@ -146,6 +175,11 @@ void UiServer::stop()
 
     d->close();
 
+    if (d->statsTimer.isActive()) {
+        d->statsTimer.stop();
+        d->slotDumpStats();
+    }
+
     if (d->file.exists()) {
         d->file.remove();
     }
@@ -224,7 +258,10 @@ void UiServer::Private::incomingConnection(qintptr fd)
             return;
         }
 #endif
-        const std::shared_ptr<AssuanServerConnection> c(new AssuanServerConnection((assuan_fd_t)fd, factories));
+        if (!dispatchTable) {
+            dispatchTable = AssuanServerConnection::makeDispatchTable(factories);
+        }
+        const std::shared_ptr<AssuanServerConnection> c(new AssuanServerConnection((assuan_fd_t)fd, dispatchTable));
         connect(c.get(), &AssuanServerConnection::closed,
                 this, &Private::slotConnectionClosed);
         connect(c.get(), &AssuanServerConnection::startKeyManagerRequested,
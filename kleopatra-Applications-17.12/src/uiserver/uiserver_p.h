@@ -36,11 +36,15 @@
 
 #include "assuanserverconnection.h"
 #include "assuancommand.h"
+#include "commandstats.h"
+
+#include <crypto/certificateresolutioncache.h>
 
 #include <utils/wsastarter.h>
 
 #include <QTcpServer>
 #include <QFile>
+#include <QTimer>
 
 #include <kleo-assuan.h>
 
@@ -82,11 +86,16 @@ protected:
 
 private Q_SLOTS:
     void slotConnectionClosed(Kleo::AssuanServerConnection *conn);
+    void slotDumpStats();
 
 private:
     QFile file;
     std::vector< std::shared_ptr<AssuanCommandFactory> > factories;
+    std::shared_ptr<const AssuanServerConnection::DispatchTable> dispatchTable; // built from factories on demand
     std::vector< std::shared_ptr<AssuanServerConnection> > connections;
+    std::shared_ptr<CommandStats> stats;
+    std::shared_ptr<Crypto::CertificateResolutionCache> resolutionCache; // keeps it alive between connections
+    QTimer statsTimer; // dumps stats to the log directory, with I/O logging only
     QString suggestedSocketName;
     QString actualSocketName;
     assuan_sock_nonce_t nonce;
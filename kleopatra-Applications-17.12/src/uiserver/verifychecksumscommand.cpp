@@ -90,7 +90,18 @@ int VerifyChecksumsCommand::doStart()
     d->controller.reset(new VerifyChecksumsController(shared_from_this()));
 
     d->controller->setFiles(fileNames());
-
+    d->controller->setForceRehash(hasOption("force-rehash"));
+
+    QObject::connect(d->controller.get(), &Controller::progress,
+                     this, [this](int current, int total, const QString &) {
+                         // GnuPG's layout: PROGRESS <what> <char> <cur> <total>
+                         try {
+                             sendStatus("PROGRESS", QStringLiteral("verify_checksums ? %1 %2").arg(current).arg(total));
+                         } catch (const Exception &e) {
+                             d->controller->cancel();
+                             done(e.error(), e.message());
+                         }
+                     });
     QObject::connect(d->controller.get(), SIGNAL(done()),
                      this, SLOT(done()), Qt::QueuedConnection);
     QObject::connect(d->controller.get(), SIGNAL(error(int,QString)),
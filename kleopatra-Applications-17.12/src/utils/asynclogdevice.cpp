@@ -0,0 +1,216 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/asynclogdevice.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "asynclogdevice.h"
+
+#include <QByteArray>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <deque>
+
+using namespace Kleo;
+
+namespace
+{
+
+static const qint64 MAX_PENDING_BYTES = 32 * 1024 * 1024;
+
+class Writer : public QThread
+{
+public:
+    struct Job {
+        std::shared_ptr<QIODevice> target;
+        QByteArray data;
+    };
+
+    static Writer &instance()
+    {
+        // lives until exit, so that the logs of all streams are complete
+        static Writer writer;
+        return writer;
+    }
+
+    ~Writer()
+    {
+        {
+            const QMutexLocker locker(&mutex);
+            stopping = true;
+            wakeUp.wakeOne();
+        }
+        wait();
+    }
+
+    bool enqueue(const std::shared_ptr<QIODevice> &target, const char *data, qint64 size)
+    {
+        const QMutexLocker locker(&mutex);
+        if (pendingBytes + size > MAX_PENDING_BYTES) {
+            dropped += size;
+            return false;
+        }
+        pendingBytes += size;
+        const Job job = { target, QByteArray(data, size) };
+        jobs.push_back(job);
+        if (!isRunning()) {
+            start(QThread::LowPriority);
+        }
+        wakeUp.wakeOne();
+        return true;
+    }
+
+    void flush()
+    {
+        QMutexLocker locker(&mutex);
+        while (!jobs.empty() || busy) {
+            idle.wait(&mutex);
+        }
+    }
+
+    quint64 droppedBytes()
+    {
+        const QMutexLocker locker(&mutex);
+        return dropped;
+    }
+
+private:
+    Writer() : QThread(), mutex(), wakeUp(), idle(), jobs(), pendingBytes(0), dropped(0), busy(false), stopping(false) {}
+
+    void run() override
+    {
+        QMutexLocker locker(&mutex);
+        for (;;) {
+            while (jobs.empty() && !stopping) {
+                wakeUp.wait(&mutex);
+            }
+            if (jobs.empty()) {
+                return;
+            }
+            std::deque<Job> batch;
+            batch.swap(jobs);
+            busy = true;
+            locker.unlock();
+
+            qint64 done = 0;
+            for (Job &job : batch) {
+                write(job.target.get(), job.data);
+                done += job.data.size();
+                job.target.reset(); // may close the file, do it outside of the lock
+            }
+
+            locker.relock();
+            pendingBytes -= done;
+            busy = false;
+            if (jobs.empty()) {
+                idle.wakeAll();
+            }
+        }
+    }
+
+    static void write(QIODevice *dev, const QByteArray &data)
+    {
+        const char *p = data.constData();
+        qint64 toWrite = data.size();
+        while (toWrite > 0) {
+            const qint64 written = dev->write(p, toWrite);
+            if (written < 0) {
+                return;
+            }
+            p += written;
+            toWrite -= written;
+        }
+    }
+
+private:
+    QMutex mutex;
+    QWaitCondition wakeUp, idle;
+    std::deque<Job> jobs;
+    qint64 pendingBytes;
+    quint64 dropped;
+    bool busy;
+    bool stopping;
+};
+
+}
+
+AsyncLogDevice::AsyncLogDevice(const std::shared_ptr<QIODevice> &target, QObject *parent)
+    : QIODevice(parent), m_target(target), m_truncated(false)
+{
+    Q_ASSERT(m_target);
+    QIODevice::open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+AsyncLogDevice::~AsyncLogDevice()
+{
+}
+
+bool AsyncLogDevice::isSequential() const
+{
+    return true;
+}
+
+bool AsyncLogDevice::truncated() const
+{
+    return m_truncated;
+}
+
+// static
+void AsyncLogDevice::flush()
+{
+    Writer::instance().flush();
+}
+
+// static
+quint64 AsyncLogDevice::droppedBytes()
+{
+    return Writer::instance().droppedBytes();
+}
+
+qint64 AsyncLogDevice::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+qint64 AsyncLogDevice::writeData(const char *data, qint64 maxSize)
+{
+    if (!m_truncated && !Writer::instance().enqueue(m_target, data, maxSize)) {
+        m_truncated = true;
+    }
+    // pretend success either way: logging must not make the stream fail
+    return maxSize;
+}
+
+#include "moc_asynclogdevice.cpp"
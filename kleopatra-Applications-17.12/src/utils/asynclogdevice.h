@@ -0,0 +1,79 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/asynclogdevice.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UTILS_ASYNCLOGDEVICE_H__
+#define __KLEOPATRA_UTILS_ASYNCLOGDEVICE_H__
+
+#include <QIODevice>
+
+#include <memory>
+
+namespace Kleo
+{
+
+/*!
+  Write-only device that forwards everything written to it to \a
+  target from a shared background thread, so the writer never waits
+  for the disk.
+
+  The data waiting to be written is bounded (for all devices
+  together). When the bound is hit, the device stops forwarding and
+  truncated() becomes true; a mirror with a gap would be useless.
+*/
+class AsyncLogDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit AsyncLogDevice(const std::shared_ptr<QIODevice> &target, QObject *parent = nullptr);
+    ~AsyncLogDevice();
+
+    bool isSequential() const override;
+
+    bool truncated() const;
+
+    //! Blocks until everything written to any AsyncLogDevice so far reached its target.
+    static void flush();
+    //! Number of bytes dropped so far because the queue was full.
+    static quint64 droppedBytes();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    const std::shared_ptr<QIODevice> m_target;
+    bool m_truncated;
+};
+
+}
+
+#endif // __KLEOPATRA_UTILS_ASYNCLOGDEVICE_H__
@@ -0,0 +1,334 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumcache.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "checksumcache.h"
+
+#include <KConfigGroup>
+#include <KSharedConfig>
+
+#include "kleopatra_debug.h"
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QString>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+# include <sys/types.h>
+# include <sys/stat.h>
+#endif
+
+using namespace Kleo;
+
+static const quint32 CACHE_MAGIC = 0x4b435343; // "KCSC"
+static const quint32 CACHE_VERSION = 2;
+// bounds the size of the cache file (roughly 200 bytes per entry);
+// the least recently used entries are dropped first
+static const int MAX_ENTRIES = 20000;
+
+FileId FileId::fromFile(const QString &fileName)
+{
+    FileId id = { 0, 0, 0, 0 };
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(fileName).constData(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return id;
+    }
+    id.device = st.st_dev;
+    id.inode = st.st_ino;
+    id.size = st.st_size;
+# if defined(Q_OS_MAC)
+    id.mtimeNs = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+# else
+    id.mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+# endif
+#else
+    Q_UNUSED(fileName)
+    // no stable inode numbers: never report a cache hit
+#endif
+    return id;
+}
+
+namespace
+{
+struct CacheKey {
+    FileId id;
+    QString algorithm;
+};
+
+struct CacheEntry {
+    QByteArray digest;
+    QString fileName;
+    qint64 lastUsed; // seconds since the epoch
+};
+
+bool operator==(const CacheKey &lhs, const CacheKey &rhs)
+{
+    return lhs.id == rhs.id && lhs.algorithm == rhs.algorithm;
+}
+
+uint qHash(const CacheKey &key, uint seed = 0)
+{
+    return ::qHash(key.id.device, seed) ^ ::qHash(key.id.inode, seed)
+           ^ ::qHash(key.id.mtimeNs, seed) ^ ::qHash(key.algorithm, seed);
+}
+}
+
+class ChecksumCache::Private
+{
+    friend class ::Kleo::ChecksumCache;
+    ChecksumCache *const q;
+public:
+    explicit Private(ChecksumCache *qq) : q(qq), mutex(), loaded(false), dirty(false), entries(), keysByPath() {}
+
+private:
+    static QString cacheFileName()
+    {
+        return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/checksum-cache");
+    }
+
+    void ensureLoaded() const;
+    void insertEntry(const CacheKey &key, const CacheEntry &entry) const;
+    void removeEntry(const CacheKey &key) const;
+    void evictOutdated(const QString &fileName, const FileId &current) const;
+    void evictLeastRecentlyUsed() const;
+
+private:
+    mutable QMutex mutex;
+    mutable bool loaded;
+    mutable bool dirty;
+    mutable QHash<CacheKey, CacheEntry> entries;
+    mutable QMultiHash<QString, CacheKey> keysByPath;
+};
+
+void ChecksumCache::Private::insertEntry(const CacheKey &key, const CacheEntry &entry) const
+{
+    if (!entries.contains(key)) {
+        keysByPath.insert(entry.fileName, key);
+    }
+    entries.insert(key, entry);
+}
+
+void ChecksumCache::Private::removeEntry(const CacheKey &key) const
+{
+    const auto it = entries.find(key);
+    if (it == entries.end()) {
+        return;
+    }
+    keysByPath.remove(it->fileName, key);
+    entries.erase(it);
+    dirty = true;
+}
+
+// A path can only have one current FileId, entries for older
+// versions of the file can never match again:
+void ChecksumCache::Private::evictOutdated(const QString &fileName, const FileId &current) const
+{
+    const QList<CacheKey> keys = keysByPath.values(fileName);
+    for (const CacheKey &key : keys) {
+        if (key.id != current) {
+            removeEntry(key);
+        }
+    }
+}
+
+void ChecksumCache::Private::evictLeastRecentlyUsed() const
+{
+    if (entries.size() <= MAX_ENTRIES) {
+        return;
+    }
+    std::vector<std::pair<qint64, CacheKey>> byAge;
+    byAge.reserve(entries.size());
+    for (auto it = entries.cbegin(), end = entries.cend(); it != end; ++it) {
+        byAge.push_back(std::make_pair(it->lastUsed, it.key()));
+    }
+    const auto nth = byAge.begin() + (byAge.size() - MAX_ENTRIES);
+    std::nth_element(byAge.begin(), nth, byAge.end(),
+                     [](const std::pair<qint64, CacheKey> &lhs, const std::pair<qint64, CacheKey> &rhs) {
+                         return lhs.first < rhs.first;
+                     });
+    std::for_each(byAge.begin(), nth,
+                  [this](const std::pair<qint64, CacheKey> &p) { removeEntry(p.second); });
+}
+
+void ChecksumCache::Private::ensureLoaded() const
+{
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+
+    QFile file(cacheFileName());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream s(&file);
+    s.setVersion(QDataStream::Qt_5_6);
+    quint32 magic = 0, version = 0, count = 0;
+    s >> magic >> version >> count;
+    if (magic != CACHE_MAGIC || version < 1 || version > CACHE_VERSION) {
+        qCDebug(KLEOPATRA_LOG) << "ChecksumCache: ignoring" << file.fileName() << "(wrong format)";
+        return;
+    }
+    entries.reserve(count);
+    for (quint32 i = 0; i < count && s.status() == QDataStream::Ok; ++i) {
+        CacheKey key;
+        CacheEntry entry = { QByteArray(), QString(), 0 };
+        s >> key.id.device >> key.id.inode >> key.id.size >> key.id.mtimeNs >> key.algorithm
+          >> entry.digest >> entry.fileName;
+        if (version >= 2) {
+            s >> entry.lastUsed;
+        }
+        if (s.status() == QDataStream::Ok) {
+            insertEntry(key, entry);
+        }
+    }
+    qCDebug(KLEOPATRA_LOG) << "ChecksumCache: loaded" << entries.size() << "entries from" << file.fileName();
+}
+
+std::shared_ptr<const ChecksumCache> ChecksumCache::instance()
+{
+    return mutableInstance();
+}
+
+std::shared_ptr<ChecksumCache> ChecksumCache::mutableInstance()
+{
+    static std::weak_ptr<ChecksumCache> self;
+    try {
+        return std::shared_ptr<ChecksumCache>(self);
+    } catch (const std::bad_weak_ptr &) {
+        const std::shared_ptr<ChecksumCache> s(new ChecksumCache);
+        self = s;
+        return s;
+    }
+}
+
+ChecksumCache::ChecksumCache() : d(new Private(this))
+{
+}
+
+ChecksumCache::~ChecksumCache()
+{
+    save();
+}
+
+// static
+bool ChecksumCache::isEnabled()
+{
+    const KConfigGroup group(KSharedConfig::openConfig(), "ChecksumOperations");
+    return group.readEntry("use-verification-cache", false);
+}
+
+QByteArray ChecksumCache::lookup(const FileId &id, const QString &algorithm) const
+{
+    if (id.isNull()) {
+        return QByteArray();
+    }
+    const QMutexLocker locker(&d->mutex);
+    d->ensureLoaded();
+    const CacheKey key = { id, algorithm };
+    const auto it = d->entries.find(key);
+    if (it == d->entries.end()) {
+        return QByteArray();
+    }
+    it->lastUsed = QDateTime::currentMSecsSinceEpoch() / 1000;
+    d->dirty = true;
+    return it->digest;
+}
+
+void ChecksumCache::insert(const FileId &id, const QString &algorithm, const QByteArray &digest, const QString &fileName)
+{
+    if (id.isNull() || digest.isEmpty()) {
+        return;
+    }
+    const QMutexLocker locker(&d->mutex);
+    d->ensureLoaded();
+    const CacheKey key = { id, algorithm };
+    const CacheEntry entry = { digest.toLower(), QFileInfo(fileName).absoluteFilePath(),
+                               QDateTime::currentMSecsSinceEpoch() / 1000 };
+    d->evictOutdated(entry.fileName, id);
+    d->insertEntry(key, entry);
+    d->dirty = true;
+}
+
+void ChecksumCache::clear()
+{
+    const QMutexLocker locker(&d->mutex);
+    d->loaded = true;
+    d->dirty = d->dirty || !d->entries.empty() || QFile::exists(Private::cacheFileName());
+    d->entries.clear();
+    d->keysByPath.clear();
+}
+
+bool ChecksumCache::save() const
+{
+    const QMutexLocker locker(&d->mutex);
+    if (!d->dirty) {
+        return true;
+    }
+
+    d->evictLeastRecentlyUsed();
+
+    const QString fileName = Private::cacheFileName();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCDebug(KLEOPATRA_LOG) << "ChecksumCache: cannot write" << fileName << ':' << file.errorString();
+        return false;
+    }
+
+    QDataStream s(&file);
+    s.setVersion(QDataStream::Qt_5_6);
+    s << CACHE_MAGIC << CACHE_VERSION << quint32(d->entries.size());
+    for (auto it = d->entries.cbegin(), end = d->entries.cend(); it != end; ++it) {
+        s << it.key().id.device << it.key().id.inode << it.key().id.size << it.key().id.mtimeNs << it.key().algorithm
+          << it->digest << it->fileName << it->lastUsed;
+    }
+    if (!file.commit()) {
+        return false;
+    }
+    d->dirty = false;
+    return true;
+}
@@ -0,0 +1,114 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/checksumcache.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UTILS_CHECKSUMCACHE_H__
+#define __KLEOPATRA_UTILS_CHECKSUMCACHE_H__
+
+#include <utils/pimpl_ptr.h>
+
+#include <QtGlobal>
+
+#include <memory>
+
+class QByteArray;
+class QString;
+
+namespace Kleo
+{
+
+/*!
+  Identifies the contents of a file without reading it: if none of
+  device, inode, size and modification time changed, the file is
+  assumed to be unchanged.
+*/
+struct FileId {
+    quint64 device;
+    quint64 inode;
+    quint64 size;
+    qint64 mtimeNs;
+
+    bool isNull() const
+    {
+        return !device && !inode && !size && !mtimeNs;
+    }
+
+    static FileId fromFile(const QString &fileName);
+};
+
+inline bool operator==(const FileId &lhs, const FileId &rhs)
+{
+    return lhs.device == rhs.device && lhs.inode == rhs.inode
+           && lhs.size == rhs.size && lhs.mtimeNs == rhs.mtimeNs;
+}
+
+inline bool operator!=(const FileId &lhs, const FileId &rhs)
+{
+    return !(lhs == rhs);
+}
+
+/*!
+  Persistent map (FileId, checksum definition id) -> digest, used to
+  skip re-hashing files that did not change since they were last
+  verified. Inserting a file replaces the entries for older versions
+  of it, and save() drops the least recently used entries beyond a
+  fixed limit. All functions are thread-safe.
+*/
+class ChecksumCache
+{
+public:
+    static std::shared_ptr<const ChecksumCache> instance();
+    static std::shared_ptr<ChecksumCache> mutableInstance();
+
+    ~ChecksumCache();
+
+    static bool isEnabled();
+
+    QByteArray lookup(const FileId &id, const QString &algorithm) const;
+    void insert(const FileId &id, const QString &algorithm, const QByteArray &digest, const QString &fileName);
+
+    void clear();
+
+    bool save() const;
+
+private:
+    ChecksumCache();
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+
+    Q_DISABLE_COPY(ChecksumCache)
+};
+
+}
+
+#endif // __KLEOPATRA_UTILS_CHECKSUMCACHE_H__
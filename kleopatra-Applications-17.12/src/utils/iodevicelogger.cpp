@@ -34,8 +34,39 @@
 
 #include "iodevicelogger.h"
 
+#include "kleopatra_debug.h"
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+
+#include <algorithm>
+
 using namespace Kleo;
 
+namespace
+{
+// chunk sizes are counted in power-of-two buckets: <=1, <=2, ..., <=512K, more
+static const int NUM_CHUNK_BUCKETS = 21;
+
+struct Traffic {
+    quint64 bytes;
+    quint64 chunks;
+    qint64 logged;
+
+    void add(qint64 num, quint64 *histogram)
+    {
+        bytes += num;
+        ++chunks;
+        int bucket = 0;
+        while (bucket < NUM_CHUNK_BUCKETS - 1 && (qint64(1) << bucket) < num) {
+            ++bucket;
+        }
+        ++histogram[bucket];
+    }
+};
+}
+
 class IODeviceLogger::Private
 {
     IODeviceLogger *const q;
@@ -43,8 +74,13 @@ public:
 
     static bool write(const std::shared_ptr<QIODevice> &dev, const char *data, qint64 max);
 
-    explicit Private(const std::shared_ptr<QIODevice> &io_, IODeviceLogger *qq) : q(qq), io(io_), writeLog(), readLog()
+    explicit Private(const std::shared_ptr<QIODevice> &io_, IODeviceLogger *qq)
+        : q(qq), io(io_), writeLog(), readLog(), logLimit(-1), summaryLabel(), summaryLogged(false), timer()
     {
+        read.bytes = read.chunks = written.bytes = written.chunks = 0;
+        read.logged = written.logged = 0;
+        std::fill_n(histogram, NUM_CHUNK_BUCKETS, 0);
+        timer.start();
         Q_ASSERT(io);
         connect(io.get(), &QIODevice::aboutToClose, q, &QIODevice::aboutToClose);
         connect(io.get(), &QIODevice::bytesWritten, q, &QIODevice::bytesWritten);
@@ -56,11 +92,43 @@ public:
     {
     }
 
+    void mirror(const std::shared_ptr<QIODevice> &dev, Traffic &traffic, const char *data, qint64 num);
+    void logSummary();
+
     const std::shared_ptr<QIODevice> io;
     std::shared_ptr<QIODevice> writeLog;
     std::shared_ptr<QIODevice> readLog;
+    qint64 logLimit;
+    QString summaryLabel;
+    bool summaryLogged;
+    QElapsedTimer timer;
+    Traffic read, written;
+    quint64 histogram[NUM_CHUNK_BUCKETS];
 };
 
+void IODeviceLogger::Private::mirror(const std::shared_ptr<QIODevice> &dev, Traffic &traffic, const char *data, qint64 num)
+{
+    traffic.add(num, histogram);
+    if (!dev) {
+        return;
+    }
+    const qint64 toLog = logLimit < 0 ? num : qMin(num, logLimit - traffic.logged);
+    if (toLog > 0) {
+        write(dev, data, toLog);
+        traffic.logged += toLog;
+    }
+}
+
+void IODeviceLogger::Private::logSummary()
+{
+    if (summaryLogged || summaryLabel.isEmpty()) {
+        return;
+    }
+    summaryLogged = true;
+    // a warning, so that the log writer neither rate-limits nor drops it
+    qCWarning(KLEOPATRA_LOG) << "IO" << summaryLabel << q->summary();
+}
+
 bool IODeviceLogger::Private::write(const std::shared_ptr<QIODevice> &dev, const char *data, qint64 max)
 {
     Q_ASSERT(dev);
@@ -83,6 +151,7 @@ IODeviceLogger::IODeviceLogger(const std::shared_ptr<QIODevice> &iod, QObject *p
 
 IODeviceLogger::~IODeviceLogger()
 {
+    d->logSummary();
 }
 
 void IODeviceLogger::setWriteLogDevice(const std::shared_ptr<QIODevice> &dev)
@@ -95,6 +164,39 @@ void IODeviceLogger::setReadLogDevice(const std::shared_ptr<QIODevice> &dev)
     d->readLog = dev;
 }
 
+void IODeviceLogger::setLogLimit(qint64 bytes)
+{
+    d->logLimit = bytes;
+}
+
+qint64 IODeviceLogger::logLimit() const
+{
+    return d->logLimit;
+}
+
+void IODeviceLogger::setSummaryLabel(const QString &label)
+{
+    d->summaryLabel = label;
+}
+
+QString IODeviceLogger::summary() const
+{
+    QStringList chunks;
+    for (int i = 0; i < NUM_CHUNK_BUCKETS; ++i) {
+        if (d->histogram[i]) {
+            const QString bound = i == NUM_CHUNK_BUCKETS - 1
+                                  ? QStringLiteral(">%1").arg(qint64(1) << (i - 1))
+                                  : QStringLiteral("<=%1").arg(qint64(1) << i);
+            chunks.push_back(bound + QLatin1Char(':') + QString::number(d->histogram[i]));
+        }
+    }
+    return QStringLiteral("read=%1/%2 written=%3/%4 msecs=%5 chunks=%6")
+           .arg(d->read.bytes).arg(d->read.chunks)
+           .arg(d->written.bytes).arg(d->written.chunks)
+           .arg(d->timer.elapsed())
+           .arg(chunks.join(QLatin1Char(',')));
+}
+
 bool IODeviceLogger::atEnd() const
 {
     return d->io->atEnd();
@@ -117,6 +219,7 @@ bool IODeviceLogger::canReadLine() const
 
 void IODeviceLogger::close()
 {
+    d->logSummary();
     d->io->close();
 }
 
@@ -164,8 +267,8 @@ bool IODeviceLogger::waitForReadyRead(int msecs)
 qint64 IODeviceLogger::readData(char *data, qint64 maxSize)
 {
     const qint64 num = d->io->read(data, maxSize);
-    if (num > 0 && d->readLog) {
-        Private::write(d->readLog, data, num);
+    if (num > 0) {
+        d->mirror(d->readLog, d->read, data, num);
     }
     return num;
 }
@@ -173,8 +276,8 @@ qint64 IODeviceLogger::readData(char *data, qint64 maxSize)
 qint64 IODeviceLogger::writeData(const char *data, qint64 maxSize)
 {
     const qint64 num = d->io->write(data, maxSize);
-    if (num > 0 && d->writeLog) {
-        Private::write(d->writeLog, data, num);
+    if (num > 0) {
+        d->mirror(d->writeLog, d->written, data, num);
     }
     return num;
 }
@@ -182,8 +285,8 @@ qint64 IODeviceLogger::writeData(const char *data, qint64 maxSize)
 qint64 IODeviceLogger::readLineData(char *data, qint64 maxSize)
 {
     const qint64 num = d->io->readLine(data, maxSize);
-    if (num > 0 && d->readLog) {
-        Private::write(d->readLog, data, num);
+    if (num > 0) {
+        d->mirror(d->readLog, d->read, data, num);
     }
     return num;
 }
@@ -52,6 +52,15 @@ public:
     void setWriteLogDevice(const std::shared_ptr<QIODevice> &dev);
     void setReadLogDevice(const std::shared_ptr<QIODevice> &dev);
 
+    //! Mirror only the first \a bytes in each direction (-1: everything).
+    void setLogLimit(qint64 bytes);
+    qint64 logLimit() const;
+
+    //! If not empty, summary() is logged under this label when the device is closed.
+    void setSummaryLabel(const QString &label);
+    //! Sizes, timing and chunk size histogram of the traffic so far.
+    QString summary() const;
+
     bool atEnd() const override;
     qint64 bytesAvailable() const override;
     qint64 bytesToWrite() const override;
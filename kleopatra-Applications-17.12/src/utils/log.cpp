@@ -33,7 +33,9 @@
 #include <config-kleopatra.h>
 
 #include "log.h"
+#include "asynclogdevice.h"
 #include "iodevicelogger.h"
+#include "logwriter.h"
 
 #include <Libkleo/Exception>
 
@@ -43,25 +45,73 @@
 #include <QDateTime>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QString>
 
+#include <atomic>
 #include <cstdio>
 
 using namespace Kleo;
 
+namespace
+{
+// -1: no operation in progress, otherwise the operation's sampling decision
+thread_local int s_ioOperationSampled = -1;
+}
+
 class Log::Private
 {
     Log *const q;
 public:
-    explicit Private(Log *qq) : q(qq), m_ioLoggingEnabled(false), m_logFile(nullptr) {}
+    explicit Private(Log *qq);
     ~Private();
     bool m_ioLoggingEnabled;
+    IOLoggingMode m_ioLoggingMode;
+    qint64 m_ioLoggingHeaderSize;
+    unsigned int m_ioLoggingSampleRate;
+    mutable std::atomic<unsigned int> m_ioLoggingCounter;
     QString m_outputDirectory;
     FILE *m_logFile;
+    qint64 m_maxLogFileSize;
+    int m_logRateLimit;
+    std::unique_ptr<LogWriter> m_writer;
 };
 
+// The defaults can be overridden from the environment, like the output
+// directory: KLEOPATRA_IOLOG_MODE=full|headers|metadata,
+// KLEOPATRA_IOLOG_HEADER_SIZE=<bytes>, KLEOPATRA_IOLOG_SAMPLE_RATE=<n>.
+Log::Private::Private(Log *qq)
+    : q(qq),
+      m_ioLoggingEnabled(false),
+      m_ioLoggingMode(FullIOLogging),
+      m_ioLoggingHeaderSize(4096),
+      m_ioLoggingSampleRate(1),
+      m_ioLoggingCounter(0),
+      m_logFile(nullptr),
+      m_maxLogFileSize(10 * 1024 * 1024),
+      m_logRateLimit(200),
+      m_writer()
+{
+    const QByteArray mode = qgetenv("KLEOPATRA_IOLOG_MODE");
+    if (mode == "headers") {
+        m_ioLoggingMode = HeadersOnlyIOLogging;
+    } else if (mode == "metadata") {
+        m_ioLoggingMode = MetadataOnlyIOLogging;
+    }
+    bool ok = false;
+    const int headerSize = qEnvironmentVariableIntValue("KLEOPATRA_IOLOG_HEADER_SIZE", &ok);
+    if (ok && headerSize >= 0) {
+        m_ioLoggingHeaderSize = headerSize;
+    }
+    const int sampleRate = qEnvironmentVariableIntValue("KLEOPATRA_IOLOG_SAMPLE_RATE", &ok);
+    if (ok && sampleRate > 0) {
+        m_ioLoggingSampleRate = sampleRate;
+    }
+}
+
 Log::Private::~Private()
 {
+    m_writer.reset();
     if (m_logFile) {
         fclose(m_logFile);
     }
@@ -69,26 +119,16 @@ Log::Private::~Private()
 
 void Log::messageHandler(QtMsgType type, const QMessageLogContext &ctx, const QString& msg)
 {
-    Q_UNUSED(type)
-    Q_UNUSED(ctx)
-    const QByteArray local8str = msg.toLocal8Bit();
-    FILE *const file = Log::instance()->logFile();
-    if (!file) {
-        fprintf(stderr, "Log::messageHandler[!file]: %s", local8str.constData());
+    const std::shared_ptr<const Log> log = Log::instance();
+    LogWriter *const writer = log->d->m_writer.get();
+    if (!writer) {
+        fprintf(stderr, "Log::messageHandler[!file]: %s", msg.toLocal8Bit().constData());
         return;
     }
 
-    qint64 toWrite = local8str.size();
-    while (toWrite > 0) {
-        const qint64 written = fprintf(file, "%s", local8str.constData());
-        if (written == -1) {
-            return;
-        }
-        toWrite -= written;
-    }
-    //append newline:
-    while (fprintf(file, "\n") == 0);
-    fflush(file);
+    // the actual writing happens in the LogWriter's thread, except for
+    // fatal messages:
+    writer->post(type, ctx.category, msg.toLocal8Bit() + '\n');
 }
 
 std::shared_ptr<const Log> Log::instance()
@@ -131,6 +171,52 @@ bool Log::ioLoggingEnabled() const
     return d->m_ioLoggingEnabled;
 }
 
+Log::IOLoggingMode Log::ioLoggingMode() const
+{
+    return d->m_ioLoggingMode;
+}
+
+void Log::setIOLoggingMode(IOLoggingMode mode)
+{
+    d->m_ioLoggingMode = mode;
+}
+
+qint64 Log::ioLoggingHeaderSize() const
+{
+    return d->m_ioLoggingHeaderSize;
+}
+
+void Log::setIOLoggingHeaderSize(qint64 bytes)
+{
+    d->m_ioLoggingHeaderSize = qMax(qint64(0), bytes);
+}
+
+unsigned int Log::ioLoggingSampleRate() const
+{
+    return d->m_ioLoggingSampleRate;
+}
+
+void Log::setIOLoggingSampleRate(unsigned int n)
+{
+    d->m_ioLoggingSampleRate = qMax(1U, n);
+}
+
+bool Log::sampleIOOperation() const
+{
+    return d->m_ioLoggingCounter.fetch_add(1, std::memory_order_relaxed) % d->m_ioLoggingSampleRate == 0;
+}
+
+Log::IOOperationScope::IOOperationScope(bool sampled)
+    : m_previous(s_ioOperationSampled)
+{
+    s_ioOperationSampled = sampled;
+}
+
+Log::IOOperationScope::~IOOperationScope()
+{
+    s_ioOperationSampled = m_previous;
+}
+
 QString Log::outputDirectory() const
 {
     return d->m_outputDirectory;
@@ -146,6 +232,27 @@ void Log::setOutputDirectory(const QString &path)
     const QString lfn = path + QLatin1String("/kleo-log");
     d->m_logFile = fopen(QDir::toNativeSeparators(lfn).toLocal8Bit().constData(), "a");
     Q_ASSERT(d->m_logFile);
+    if (d->m_logFile) {
+        d->m_writer.reset(new LogWriter(d->m_logFile, lfn));
+        d->m_writer->setMaxFileSize(d->m_maxLogFileSize);
+        d->m_writer->setRateLimit(d->m_logRateLimit);
+    }
+}
+
+void Log::setMaxLogFileSize(qint64 bytes)
+{
+    d->m_maxLogFileSize = bytes;
+    if (d->m_writer) {
+        d->m_writer->setMaxFileSize(bytes);
+    }
+}
+
+void Log::setLogRateLimit(int messagesPerSecond)
+{
+    d->m_logRateLimit = messagesPerSecond;
+    if (d->m_writer) {
+        d->m_writer->setRateLimit(messagesPerSecond);
+    }
 }
 
 std::shared_ptr<QIODevice> Log::createIOLogger(const std::shared_ptr<QIODevice> &io, const QString &prefix, OpenMode mode) const
@@ -153,22 +260,37 @@ std::shared_ptr<QIODevice> Log::createIOLogger(const std::shared_ptr<QIODevice>
     if (!d->m_ioLoggingEnabled) {
         return io;
     }
+    // streams created outside of an IOOperationScope count as operations of their own
+    const bool sampled = s_ioOperationSampled >= 0 ? s_ioOperationSampled : sampleIOOperation();
+    if (!sampled) {
+        return io;
+    }
 
     std::shared_ptr<IODeviceLogger> logger(new IODeviceLogger(io));
 
     const QString timestamp = QDateTime::currentDateTime().toString(QStringLiteral("yyMMdd-hhmmss"));
 
     const QString fn = d->m_outputDirectory + QLatin1Char('/') + prefix + QLatin1Char('-') + timestamp + QLatin1Char('-') + KRandom::randomString(4);
+    logger->setSummaryLabel(QFileInfo(fn).fileName());
+    if (d->m_ioLoggingMode == MetadataOnlyIOLogging) {
+        return logger;
+    }
+
     std::shared_ptr<QFile> file(new QFile(fn));
 
     if (!file->open(QIODevice::WriteOnly)) {
         throw Exception(gpg_error(GPG_ERR_EIO), i18n("Log Error: Could not open log file \"%1\" for writing.", fn));
     }
 
+    // the mirror is written by a background thread:
+    const std::shared_ptr<QIODevice> dev(new AsyncLogDevice(file));
     if (mode & Read) {
-        logger->setReadLogDevice(file);
+        logger->setReadLogDevice(dev);
     } else { // Write
-        logger->setWriteLogDevice(file);
+        logger->setWriteLogDevice(dev);
+    }
+    if (d->m_ioLoggingMode == HeadersOnlyIOLogging) {
+        logger->setLogLimit(d->m_ioLoggingHeaderSize);
     }
 
     return logger;
@@ -54,6 +54,15 @@ public:
         Write = 0x2
     };
 
+    enum IOLoggingMode {
+        //! mirror all data of each stream into its own file
+        FullIOLogging,
+        //! mirror only the first ioLoggingHeaderSize() bytes of each stream
+        HeadersOnlyIOLogging,
+        //! only log sizes, timing and chunk sizes of each stream to the log file
+        MetadataOnlyIOLogging
+    };
+
     static void messageHandler(QtMsgType type, const QMessageLogContext &ctx,
                                const QString &msg);
 
@@ -65,6 +74,30 @@ public:
     bool ioLoggingEnabled() const;
     void setIOLoggingEnabled(bool enabled);
 
+    IOLoggingMode ioLoggingMode() const;
+    void setIOLoggingMode(IOLoggingMode mode);
+
+    qint64 ioLoggingHeaderSize() const;
+    void setIOLoggingHeaderSize(qint64 bytes);
+
+    //! Log only one in \a n operations (1: all).
+    unsigned int ioLoggingSampleRate() const;
+    void setIOLoggingSampleRate(unsigned int n);
+
+    //! Draw the sampling decision for one operation; call once per operation.
+    bool sampleIOOperation() const;
+
+    //! Makes createIOLogger() follow \a sampled instead of sampling each stream.
+    class IOOperationScope
+    {
+    public:
+        explicit IOOperationScope(bool sampled);
+        ~IOOperationScope();
+    private:
+        const int m_previous;
+        Q_DISABLE_COPY(IOOperationScope)
+    };
+
     QString outputDirectory() const;
     void setOutputDirectory(const QString &path);
 
@@ -72,6 +105,11 @@ public:
 
     FILE *logFile() const;
 
+    //! Rotate the log file when it grows beyond \a bytes (0: never).
+    void setMaxLogFileSize(qint64 bytes);
+    //! Drop debug and info messages beyond \a messagesPerSecond per category (0: no limit).
+    void setLogRateLimit(int messagesPerSecond);
+
 private:
     Log();
 
@@ -0,0 +1,407 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/logwriter.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "logwriter.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <memory>
+
+using namespace Kleo;
+
+namespace
+{
+static const quint32 RING_SIZE = 4096; // must be a power of two
+static const unsigned int NUM_CATEGORY_SLOTS = 64;
+static const unsigned long DRAIN_INTERVAL_MSECS = 100;
+static const int MAX_BATCH_SIZE = 64 * 1024;
+
+struct RingSlot {
+    std::atomic<quint32> sequence;
+    QByteArray line;
+};
+
+// per-category message counter for the current second:
+struct CategorySlot {
+    std::atomic<const char *> category;
+    std::atomic<qint64> second;
+    std::atomic<int> count;
+};
+}
+
+class LogWriter::Private : public QThread
+{
+    friend class ::Kleo::LogWriter;
+    LogWriter *const q;
+public:
+    Private(LogWriter *qq, FILE *f, const QString &fn);
+    ~Private();
+
+private:
+    void run() Q_DECL_OVERRIDE;
+
+    bool tryEnqueue(const QByteArray &line);
+    bool enqueue(const QByteArray &line);
+    bool dequeue(QByteArray &line);
+    CategorySlot *categorySlot(const char *category);
+    bool admit(const char *category);
+    void drain();
+    void drainLocked();
+    void writeNow(const QByteArray &line);
+    void write(const QByteArray &batch);
+    void rotate();
+
+private:
+    FILE *const file;
+    const QString fileName;
+
+    // bounded MPSC queue (D. Vyukov): producers claim a position with a
+    // CAS on enqueuePos, the slot's sequence number publishes the line
+    const std::unique_ptr<RingSlot[]> ring;
+    std::atomic<quint32> enqueuePos;
+    quint32 dequeuePos; // guarded by drainMutex
+
+    CategorySlot categories[NUM_CATEGORY_SLOTS];
+    QElapsedTimer clock;
+    std::atomic<int> rateLimit;
+
+    mutable QMutex drainMutex;
+    qint64 maxFileSize;   // guarded by drainMutex
+    int maxBackups;       // guarded by drainMutex
+    quint64 reportedDropped;
+
+    QMutex waitMutex;
+    QWaitCondition wakeUp;
+    std::atomic<bool> stopping;
+
+    std::atomic<quint64> written, dropped, suppressed, rotations;
+};
+
+LogWriter::Private::Private(LogWriter *qq, FILE *f, const QString &fn)
+    : QThread(),
+      q(qq),
+      file(f),
+      fileName(fn),
+      ring(new RingSlot[RING_SIZE]),
+      enqueuePos(0),
+      dequeuePos(0),
+      clock(),
+      rateLimit(200),
+      drainMutex(),
+      maxFileSize(10 * 1024 * 1024),
+      maxBackups(3),
+      reportedDropped(0),
+      waitMutex(),
+      wakeUp(),
+      stopping(false),
+      written(0),
+      dropped(0),
+      suppressed(0),
+      rotations(0)
+{
+    for (quint32 i = 0; i < RING_SIZE; ++i) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    for (CategorySlot &slot : categories) {
+        slot.category.store(nullptr, std::memory_order_relaxed);
+        slot.second.store(-1, std::memory_order_relaxed);
+        slot.count.store(0, std::memory_order_relaxed);
+    }
+    clock.start();
+    start(QThread::LowPriority);
+}
+
+LogWriter::Private::~Private()
+{
+    stopping.store(true);
+    {
+        const QMutexLocker locker(&waitMutex);
+        wakeUp.wakeOne();
+    }
+    wait();
+}
+
+void LogWriter::Private::run()
+{
+    while (!stopping.load()) {
+        drain();
+        const QMutexLocker locker(&waitMutex);
+        if (!stopping.load()) {
+            wakeUp.wait(&waitMutex, DRAIN_INTERVAL_MSECS);
+        }
+    }
+    drain();
+}
+
+bool LogWriter::Private::tryEnqueue(const QByteArray &line)
+{
+    quint32 pos = enqueuePos.load(std::memory_order_relaxed);
+    RingSlot *slot;
+    for (;;) {
+        slot = &ring[pos & (RING_SIZE - 1)];
+        const qint32 diff = qint32(slot->sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    slot->line = line;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    // the writer also wakes up on its own every DRAIN_INTERVAL_MSECS;
+    // only hurry it when a quarter of the ring has filled up since:
+    if ((pos & (RING_SIZE / 4 - 1)) == RING_SIZE / 4 - 1) {
+        wakeUp.wakeOne();
+    }
+    return true;
+}
+
+bool LogWriter::Private::enqueue(const QByteArray &line)
+{
+    if (tryEnqueue(line)) {
+        return true;
+    }
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool LogWriter::Private::dequeue(QByteArray &line)
+{
+    RingSlot &slot = ring[dequeuePos & (RING_SIZE - 1)];
+    if (qint32(slot.sequence.load(std::memory_order_acquire) - (dequeuePos + 1)) < 0) {
+        return false;
+    }
+    line.swap(slot.line);
+    slot.line.clear();
+    slot.sequence.store(dequeuePos + RING_SIZE, std::memory_order_release);
+    ++dequeuePos;
+    return true;
+}
+
+CategorySlot *LogWriter::Private::categorySlot(const char *category)
+{
+    // category names are string literals, so compare them by address
+    const unsigned int start = (quintptr(category) >> 3) % NUM_CATEGORY_SLOTS;
+    for (unsigned int i = 0; i < NUM_CATEGORY_SLOTS; ++i) {
+        CategorySlot &slot = categories[(start + i) % NUM_CATEGORY_SLOTS];
+        const char *current = slot.category.load(std::memory_order_acquire);
+        if (!current && slot.category.compare_exchange_strong(current, category)) {
+            return &slot;
+        }
+        if (current == category) {
+            return &slot;
+        }
+    }
+    return nullptr; // table full: don't limit this category
+}
+
+bool LogWriter::Private::admit(const char *category)
+{
+    const int limit = rateLimit.load(std::memory_order_relaxed);
+    if (limit <= 0 || !category) {
+        return true;
+    }
+    CategorySlot *const slot = categorySlot(category);
+    if (!slot) {
+        return true;
+    }
+
+    const qint64 now = clock.elapsed() / 1000;
+    qint64 second = slot->second.load(std::memory_order_relaxed);
+    if (second != now && slot->second.compare_exchange_strong(second, now)) {
+        const int previous = slot->count.exchange(0);
+        if (previous > limit) {
+            enqueue(QByteArray(category) + ": " + QByteArray::number(previous - limit)
+                    + " messages suppressed (more than " + QByteArray::number(limit) + " per second)\n");
+        }
+    }
+    if (slot->count.fetch_add(1, std::memory_order_relaxed) >= limit) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void LogWriter::Private::drain()
+{
+    const QMutexLocker locker(&drainMutex);
+    drainLocked();
+}
+
+void LogWriter::Private::drainLocked()
+{
+    QByteArray batch, line;
+    quint64 lines = 0;
+    while (dequeue(line)) {
+        batch += line;
+        ++lines;
+        if (batch.size() >= MAX_BATCH_SIZE) {
+            write(batch);
+            batch.clear();
+        }
+    }
+    const quint64 droppedNow = dropped.load(std::memory_order_relaxed);
+    if (droppedNow != reportedDropped) {
+        batch += "Log: " + QByteArray::number(droppedNow - reportedDropped) + " messages dropped (log buffer full)\n";
+        reportedDropped = droppedNow;
+    }
+    if (!batch.isEmpty()) {
+        write(batch);
+    }
+    written.fetch_add(lines, std::memory_order_relaxed);
+}
+
+// Writes line in the calling thread, after everything queued before it
+void LogWriter::Private::writeNow(const QByteArray &line)
+{
+    const QMutexLocker locker(&drainMutex);
+    drainLocked();
+    write(line);
+    written.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LogWriter::Private::write(const QByteArray &batch)
+{
+    fwrite(batch.constData(), 1, batch.size(), file);
+    fflush(file);
+    if (maxFileSize > 0 && ftell(file) > maxFileSize) {
+        rotate();
+    }
+}
+
+// Rotation copies the file and truncates it in place instead of renaming
+// it: the FILE stays valid for everybody holding it, and this also works
+// on Windows, where open files cannot be renamed.
+void LogWriter::Private::rotate()
+{
+    if (maxBackups > 0) {
+        const auto backup = [this](int i) {
+            return fileName + QLatin1Char('.') + QString::number(i);
+        };
+        QFile::remove(backup(maxBackups));
+        for (int i = maxBackups - 1; i > 0; --i) {
+            QFile::rename(backup(i), backup(i + 1));
+        }
+        if (!QFile::copy(fileName, backup(1))) {
+            return;
+        }
+    }
+    if (QFile::resize(fileName, 0)) {
+        rotations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+LogWriter::LogWriter(FILE *file, const QString &fileName)
+    : d(new Private(this, file, fileName))
+{
+}
+
+LogWriter::~LogWriter()
+{
+}
+
+bool LogWriter::post(QtMsgType type, const char *category, const QByteArray &line)
+{
+    if (type == QtDebugMsg || type == QtInfoMsg) {
+        return d->admit(category) && d->enqueue(line);
+    }
+    // warnings and worse are neither limited nor dropped, and a fatal
+    // message has to be on disk before Qt aborts
+    if (type == QtFatalMsg || !d->tryEnqueue(line)) {
+        d->writeNow(line);
+    }
+    return true;
+}
+
+void LogWriter::flush()
+{
+    d->drain();
+}
+
+void LogWriter::setMaxFileSize(qint64 bytes)
+{
+    const QMutexLocker locker(&d->drainMutex);
+    d->maxFileSize = bytes;
+}
+
+qint64 LogWriter::maxFileSize() const
+{
+    const QMutexLocker locker(&d->drainMutex);
+    return d->maxFileSize;
+}
+
+void LogWriter::setMaxBackups(int count)
+{
+    const QMutexLocker locker(&d->drainMutex);
+    d->maxBackups = qMax(0, count);
+}
+
+int LogWriter::maxBackups() const
+{
+    const QMutexLocker locker(&d->drainMutex);
+    return d->maxBackups;
+}
+
+void LogWriter::setRateLimit(int messagesPerSecond)
+{
+    d->rateLimit.store(messagesPerSecond);
+}
+
+int LogWriter::rateLimit() const
+{
+    return d->rateLimit.load();
+}
+
+LogWriter::Statistics LogWriter::statistics() const
+{
+    const Statistics stats = {
+        d->written.load(),
+        d->dropped.load(),
+        d->suppressed.load(),
+        d->rotations.load()
+    };
+    return stats;
+}
@@ -0,0 +1,107 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/logwriter.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UTILS_LOGWRITER_H__
+#define __KLEOPATRA_UTILS_LOGWRITER_H__
+
+#include <utils/pimpl_ptr.h>
+
+#include <QtGlobal>
+
+#include <cstdio>
+
+class QByteArray;
+class QString;
+
+namespace Kleo
+{
+
+/*!
+  Writes log lines to a FILE from a background thread.
+
+  post() only copies the line into a fixed-size lock-free ring and
+  returns; it never waits for the disk. If the ring is full, a debug
+  or info line is dropped and counted. The writer thread drains the
+  ring in batches, rotates the file once it grows beyond maxFileSize()
+  and notes dropped and rate-limited messages in the log itself.
+
+  Only debug and info messages are rate-limited. Warnings and critical
+  messages that find the ring full are written by the calling thread,
+  and fatal messages are always written before post() returns.
+
+  The FILE is not owned. Rotation copies the file away and truncates
+  it in place, so others holding the FILE (e.g. libassuan) can keep
+  writing to it.
+*/
+class LogWriter
+{
+public:
+    LogWriter(FILE *file, const QString &fileName);
+    ~LogWriter();
+
+    //! Thread-safe. Never blocks for debug and info messages.
+    //! \a line should end with a newline.
+    bool post(QtMsgType type, const char *category, const QByteArray &line);
+
+    //! Writes everything posted so far, in the calling thread.
+    void flush();
+
+    //! 0 disables rotation.
+    void setMaxFileSize(qint64 bytes);
+    qint64 maxFileSize() const;
+
+    //! Number of rotated files (fileName.1 ... fileName.N) to keep.
+    void setMaxBackups(int count);
+    int maxBackups() const;
+
+    //! Debug and info messages per second and category; 0 disables rate limiting.
+    void setRateLimit(int messagesPerSecond);
+    int rateLimit() const;
+
+    struct Statistics {
+        quint64 written;
+        quint64 dropped;
+        quint64 suppressed;
+        quint64 rotations;
+    };
+    Statistics statistics() const;
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+
+    Q_DISABLE_COPY(LogWriter)
+};
+
+}
+
+#endif // __KLEOPATRA_UTILS_LOGWRITER_H__
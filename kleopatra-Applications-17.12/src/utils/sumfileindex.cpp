@@ -0,0 +1,138 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/sumfileindex.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "sumfileindex.h"
+
+#include "kleopatra_debug.h"
+
+#include <QDir>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include <utility>
+#include <vector>
+
+using namespace Kleo;
+
+namespace
+{
+struct DirEntry {
+    QStringList sumFiles;
+    // one set of listed names per sum file, same order as sumFiles:
+    std::vector< QSet<QString> > listedFiles;
+    bool parsed;
+};
+}
+
+class SumFileIndex::Private
+{
+    friend class ::Kleo::SumFileIndex;
+    SumFileIndex *const q;
+public:
+    Private(SumFileIndex *qq, const SumFileLister &l, const SumFileParser &p, Qt::CaseSensitivity c)
+        : q(qq), lister(l), parser(p), cs(c), dirs() {}
+
+private:
+    QString normalized(const QString &fileName) const
+    {
+        return cs == Qt::CaseSensitive ? fileName : fileName.toCaseFolded();
+    }
+
+    DirEntry &entry(const QDir &dir);
+    void parse(const QDir &dir, DirEntry &e);
+
+private:
+    const SumFileLister lister;
+    const SumFileParser parser;
+    const Qt::CaseSensitivity cs;
+    QHash<QString, DirEntry> dirs;
+};
+
+DirEntry &SumFileIndex::Private::entry(const QDir &dir)
+{
+    const QString key = normalized(dir.absolutePath());
+    auto it = dirs.find(key);
+    if (it == dirs.end()) {
+        const DirEntry e = { lister(dir), std::vector< QSet<QString> >(), false };
+        it = dirs.insert(key, e);
+    }
+    return *it;
+}
+
+void SumFileIndex::Private::parse(const QDir &dir, DirEntry &e)
+{
+    if (e.parsed) {
+        return;
+    }
+    e.parsed = true;
+    e.listedFiles.reserve(e.sumFiles.size());
+    for (const QString &sumFile : qAsConst(e.sumFiles)) {
+        const QStringList listed = parser(dir.absoluteFilePath(sumFile));
+        qCDebug(KLEOPATRA_LOG) << "SumFileIndex: found" << listed.size()
+                               << "files listed in" << qPrintable(dir.absoluteFilePath(sumFile));
+        QSet<QString> names;
+        names.reserve(listed.size());
+        for (const QString &name : listed) {
+            names.insert(normalized(name));
+        }
+        e.listedFiles.push_back(std::move(names));
+    }
+}
+
+SumFileIndex::SumFileIndex(const SumFileLister &lister, const SumFileParser &parser, Qt::CaseSensitivity cs)
+    : d(new Private(this, lister, parser, cs))
+{
+
+}
+
+SumFileIndex::~SumFileIndex() {}
+
+QStringList SumFileIndex::sumFiles(const QDir &dir)
+{
+    return d->entry(dir).sumFiles;
+}
+
+QString SumFileIndex::findSumFile(const QDir &dir, const QString &fileName)
+{
+    DirEntry &e = d->entry(dir);
+    d->parse(dir, e);
+    const QString name = d->normalized(fileName);
+    for (unsigned int i = 0, end = e.listedFiles.size(); i < end; ++i)
+        if (e.listedFiles[i].contains(name)) {
+            return e.sumFiles.at(i);
+        }
+    return QString();
+}
@@ -0,0 +1,78 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/sumfileindex.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UTILS_SUMFILEINDEX_H__
+#define __KLEOPATRA_UTILS_SUMFILEINDEX_H__
+
+#include <utils/pimpl_ptr.h>
+
+#include <QtGlobal>
+
+#include <functional>
+
+class QDir;
+class QString;
+class QStringList;
+
+namespace Kleo
+{
+
+/*!
+  Answers "which checksum file in this directory lists that file?"
+  for many files at once. Each directory is listed, and each of its
+  checksum files parsed, at most once per index, so looking up N
+  files is linear in N plus the total size of the checksum files.
+*/
+class SumFileIndex
+{
+public:
+    //! returns the names of the checksum files in a directory
+    typedef std::function<QStringList(const QDir &)> SumFileLister;
+    //! returns the file names listed in a checksum file (absolute path)
+    typedef std::function<QStringList(const QString &)> SumFileParser;
+
+    SumFileIndex(const SumFileLister &lister, const SumFileParser &parser, Qt::CaseSensitivity cs);
+    ~SumFileIndex();
+
+    QStringList sumFiles(const QDir &dir);
+    QString findSumFile(const QDir &dir, const QString &fileName);
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+
+    Q_DISABLE_COPY(SumFileIndex)
+};
+
+}
+
+#endif /* __KLEOPATRA_UTILS_SUMFILEINDEX_H__ */
@@ -0,0 +1,123 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/throughputmeter.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "throughputmeter.h"
+
+#include <KFormat>
+#include <KLocalizedString>
+
+#include <QString>
+
+using namespace Kleo;
+
+ThroughputMeter::ThroughputMeter()
+    : m_timer(),
+      m_lastReport(0),
+      m_totalBytes(0),
+      m_bytesDone(0),
+      m_bytesSkipped(0),
+      m_totalFiles(0),
+      m_filesDone(0)
+{
+
+}
+
+void ThroughputMeter::start(quint64 totalBytes, unsigned int totalFiles)
+{
+    m_totalBytes = totalBytes;
+    m_totalFiles = totalFiles;
+    m_bytesDone = 0;
+    m_bytesSkipped = 0;
+    m_filesDone = 0;
+    m_lastReport = 0;
+    m_timer.start();
+}
+
+void ThroughputMeter::setTotalBytes(quint64 totalBytes)
+{
+    m_totalBytes = totalBytes;
+}
+
+void ThroughputMeter::addFile(quint64 bytes)
+{
+    m_bytesDone += bytes;
+    ++m_filesDone;
+}
+
+void ThroughputMeter::addSkippedFile(quint64 bytes)
+{
+    m_bytesSkipped += bytes;
+    addFile(bytes);
+}
+
+double ThroughputMeter::bytesPerSecond() const
+{
+    const qint64 elapsed = m_timer.isValid() ? m_timer.elapsed() : 0;
+    if (elapsed <= 0) {
+        return 0;
+    }
+    return (m_bytesDone - m_bytesSkipped) * 1000.0 / elapsed;
+}
+
+qint64 ThroughputMeter::msecsRemaining() const
+{
+    const double rate = bytesPerSecond();
+    if (rate <= 0 || m_bytesDone > m_totalBytes) {
+        return -1;
+    }
+    return qint64((m_totalBytes - m_bytesDone) * 1000.0 / rate);
+}
+
+bool ThroughputMeter::shouldReport(int intervalMSecs)
+{
+    const qint64 now = m_timer.elapsed();
+    if (m_filesDone != m_totalFiles && now - m_lastReport < intervalMSecs) {
+        return false;
+    }
+    m_lastReport = now;
+    return true;
+}
+
+QString ThroughputMeter::toString() const
+{
+    const KFormat format;
+    const QString files = i18n("%1 of %2 files", m_filesDone, m_totalFiles);
+    const QString rate = i18nc("transfer rate, e.g. 12.3 MiB/s", "%1/s", format.formatByteSize(bytesPerSecond()));
+    const qint64 remaining = msecsRemaining();
+    if (remaining < 0) {
+        return i18nc("n of m files, transfer rate", "%1, %2", files, rate);
+    }
+    return i18nc("n of m files, transfer rate, remaining time", "%1, %2, %3 remaining",
+                 files, rate, format.formatDuration(remaining));
+}
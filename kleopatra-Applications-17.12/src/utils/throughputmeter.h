@@ -0,0 +1,100 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/throughputmeter.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UTILS_THROUGHPUTMETER_H__
+#define __KLEOPATRA_UTILS_THROUGHPUTMETER_H__
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+class QString;
+
+namespace Kleo
+{
+
+/*!
+  Accumulates bytes and files processed by one worker and derives
+  throughput and remaining time from them. Skipped files (e.g. found
+  in a cache) advance the progress without inflating the throughput.
+  Not thread-safe; each worker owns its own meter.
+*/
+class ThroughputMeter
+{
+public:
+    ThroughputMeter();
+
+    void start(quint64 totalBytes, unsigned int totalFiles);
+    //! for totals that only become known after start()
+    void setTotalBytes(quint64 totalBytes);
+    void addFile(quint64 bytes);
+    //! counts towards the progress, but not towards the throughput
+    void addSkippedFile(quint64 bytes);
+
+    quint64 bytesDone() const
+    {
+        return m_bytesDone;
+    }
+    quint64 totalBytes() const
+    {
+        return m_totalBytes;
+    }
+    unsigned int filesDone() const
+    {
+        return m_filesDone;
+    }
+    unsigned int totalFiles() const
+    {
+        return m_totalFiles;
+    }
+
+    double bytesPerSecond() const;
+    //! -1 if unknown
+    qint64 msecsRemaining() const;
+
+    //! true at most every \a intervalMSecs (and for the last file)
+    bool shouldReport(int intervalMSecs = 100);
+
+    QString toString() const;
+
+private:
+    QElapsedTimer m_timer;
+    qint64 m_lastReport;
+    quint64 m_totalBytes;
+    quint64 m_bytesDone;
+    quint64 m_bytesSkipped;
+    unsigned int m_totalFiles;
+    unsigned int m_filesDone;
+};
+
+}
+
+#endif /* __KLEOPATRA_UTILS_THROUGHPUTMETER_H__ */
@@ -686,35 +686,16 @@ void KeyListController::enableDisableActions(const QItemSelectionModel *sm) cons
         }
 }
 
-static bool all_secret_are_not_owner_trust_ultimate(const std::vector<Key> &keys)
+static Command::Restrictions find_root_restrictions(KeyCache::KeyFlags all, KeyCache::KeyFlags any)
 {
-    for (const Key &key : keys)
-        if (key.hasSecret() && key.ownerTrust() == Key::Ultimate) {
-            return false;
-        }
-    return true;
-}
-
-Command::Restrictions find_root_restrictions(const std::vector<Key> &keys)
-{
-    bool trusted = false, untrusted = false;
-    for (const Key &key : keys)
-        if (key.isRoot())
-            if (key.userID(0).validity() == UserID::Ultimate) {
-                trusted = true;
-            } else {
-                untrusted = true;
-            }
-        else {
-            return Command::NoRestriction;
-        }
-    if (trusted)
-        if (untrusted) {
-            return Command::NoRestriction;
-        } else {
-            return Command::MustBeTrustedRoot;
-        }
-    else if (untrusted) {
+    if (!(all & KeyCache::IsRoot)) {
+        return Command::NoRestriction;
+    }
+    const bool trusted = any & KeyCache::IsUltimatelyValid;
+    const bool untrusted = !(all & KeyCache::IsUltimatelyValid);
+    if (trusted && !untrusted) {
+        return Command::MustBeTrustedRoot;
+    } else if (untrusted && !trusted) {
         return Command::MustBeUntrustedRoot;
     } else {
         return Command::NoRestriction;
@@ -743,23 +724,37 @@ Command::Restrictions KeyListController::Private::calculateRestrictionsMask(cons
         result |= Command::OnlyOneKey;
     }
 
-    if (std::all_of(keys.cbegin(), keys.cend(), std::mem_fn(&Key::hasSecret))) {
+    // one pass over the precomputed key flags: 'all' holds the bits set
+    // in every selected key, 'any' those set in at least one of them
+    const std::shared_ptr<const KeyCache> cache = KeyCache::instance();
+    KeyCache::KeyFlags all = ~KeyCache::KeyFlags(), any;
+    bool anySecretIsOwnerTrustUltimate = false;
+    for (const Key &key : keys) {
+        const KeyCache::KeyFlags flags = cache->keyFlags(key);
+        all &= flags;
+        any |= flags;
+        if ((flags & KeyCache::HasSecret) && (flags & KeyCache::HasUltimateOwnerTrust)) {
+            anySecretIsOwnerTrustUltimate = true;
+        }
+    }
+
+    if (all & KeyCache::HasSecret) {
         result |= Command::NeedSecretKey;
-    } else if (!std::any_of(keys.cbegin(), keys.cend(), std::mem_fn(&Key::hasSecret))) {
+    } else if (!(any & KeyCache::HasSecret)) {
         result |= Command::MustNotBeSecretKey;
     }
 
-    if (std::all_of(keys.cbegin(), keys.cend(), [](const Key &key) { return key.protocol() == OpenPGP; })) {
+    if (all & KeyCache::IsOpenPGP) {
         result |= Command::MustBeOpenPGP;
-    } else if (std::all_of(keys.cbegin(), keys.cend(), [](const Key &key) { return key.protocol() == CMS; })) {
+    } else if (all & KeyCache::IsCMS) {
         result |= Command::MustBeCMS;
     }
 
-    if (all_secret_are_not_owner_trust_ultimate(keys)) {
+    if (!anySecretIsOwnerTrustUltimate) {
         result |= Command::MayOnlyBeSecretKeyIfOwnerTrustIsNotYetUltimate;
     }
 
-    result |= find_root_restrictions(keys);
+    result |= find_root_restrictions(all, any);
 
     if (const ReaderStatus *rs = ReaderStatus::instance()) {
         if (rs->anyCardHasNullPin()) {
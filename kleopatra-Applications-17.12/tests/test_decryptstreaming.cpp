@@ -0,0 +1,393 @@
+/*
+    This file is part of Kleopatra's test suite.
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include <config-kleopatra.h>
+
+#include "kleo_test.h"
+
+#include <crypto/decryptverifytask.h>
+
+#include <utils/input.h>
+#include <utils/output.h>
+
+#include <QGpgME/Protocol>
+#include <QGpgME/EncryptJob>
+#include <QGpgME/DecryptVerifyJob>
+#include <QGpgME/KeyListJob>
+#include <QGpgME/SignJob>
+#include <QGpgME/SignEncryptJob>
+
+#include <gpgme++/decryptionresult.h>
+#include <gpgme++/encryptionresult.h>
+#include <gpgme++/key.h>
+#include <gpgme++/keylistresult.h>
+#include <gpgme++/verificationresult.h>
+
+#include <QEventLoop>
+#include <QFile>
+#include <QIODevice>
+#include <QObject>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <QTimer>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace Kleo;
+using namespace Kleo::Crypto;
+
+Q_DECLARE_METATYPE(GpgME::DecryptionResult)
+Q_DECLARE_METATYPE(GpgME::VerificationResult)
+
+namespace
+{
+char generatedByte(qint64 pos)
+{
+    return static_cast<char>('a' + pos % 26);
+}
+
+// Produces size bytes of generated data without ever holding them
+class GeneratorDevice : public QIODevice
+{
+public:
+    explicit GeneratorDevice(qint64 size) : QIODevice(), m_size(size), m_pos(0) {}
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+    qint64 bytesAvailable() const override
+    {
+        return m_size - m_pos + QIODevice::bytesAvailable();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const qint64 n = qMin(maxSize, m_size - m_pos);
+        for (qint64 i = 0; i < n; ++i) {
+            data[i] = generatedByte(m_pos + i);
+        }
+        m_pos += n;
+        return n;
+    }
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    const qint64 m_size;
+    qint64 m_pos;
+};
+
+// Discards everything written to it, only counting the bytes
+class SinkDevice : public QIODevice
+{
+public:
+    SinkDevice() : QIODevice(), m_written(0) {}
+
+    bool isSequential() const override
+    {
+        return true;
+    }
+    qint64 written() const
+    {
+        return m_written;
+    }
+
+protected:
+    qint64 readData(char *, qint64) override
+    {
+        return -1;
+    }
+    qint64 writeData(const char *, qint64 size) override
+    {
+        m_written += size;
+        return size;
+    }
+
+private:
+    qint64 m_written;
+};
+
+qint64 peakRssKiB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Compares the file in chunks, so that the check itself does not
+// load the plaintext
+bool isGenerated(const QString &fileName, qint64 size)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() != size) {
+        return false;
+    }
+    qint64 pos = 0;
+    while (!file.atEnd()) {
+        const QByteArray chunk = file.read(64 * 1024);
+        for (const char c : chunk) {
+            if (c != generatedByte(pos++)) {
+                return false;
+            }
+        }
+    }
+    return pos == size;
+}
+
+int timeoutFor(qint64 mib)
+{
+    return 60 * 1000 + mib * 1000;
+}
+
+enum Operation {
+    Decrypt,
+    DecryptVerify,
+    VerifyOpaque
+};
+}
+
+class DecryptStreamingTest : public QObject
+{
+    Q_OBJECT
+private:
+    const QGpgME::Protocol *mBackend;
+    std::vector<GpgME::Key> mRecipients;
+    std::vector<GpgME::Key> mSigners;
+    QTemporaryDir mDir;
+
+    // Writes size bytes of generated data, encrypted and/or signed
+    // as needed for op, to fileName
+    bool createInput(Operation op, qint64 size, const QString &fileName)
+    {
+        const std::shared_ptr<QFile> out = std::make_shared<QFile>(fileName);
+        const std::shared_ptr<GeneratorDevice> in = std::make_shared<GeneratorDevice>(size);
+        if (!out->open(QIODevice::WriteOnly) || !in->open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        QGpgME::Job *job = nullptr;
+        switch (op) {
+        case Decrypt: {
+            QGpgME::EncryptJob *const j = mBackend->encryptJob();
+            j->start(mRecipients, in, out, true);
+            job = j;
+            break;
+        }
+        case DecryptVerify: {
+            QGpgME::SignEncryptJob *const j = mBackend->signEncryptJob();
+            j->start(mSigners, mRecipients, in, out, true);
+            job = j;
+            break;
+        }
+        case VerifyOpaque: {
+            QGpgME::SignJob *const j = mBackend->signJob();
+            j->start(mSigners, in, out, GpgME::NormalSignatureMode);
+            job = j;
+            break;
+        }
+        }
+        QSignalSpy spy(job, &QGpgME::Job::done);
+        return spy.wait(timeoutFor(size >> 20)) && out->size() > 0;
+    }
+
+    // Runs the task for op from inputFile into outputFile and returns
+    // its result
+    std::shared_ptr<const DecryptVerifyResult> runTask(Operation op, qint64 size, const QString &inputFile, const QString &outputFile)
+    {
+        const std::shared_ptr<Input> input = Input::createFromFile(inputFile);
+        const std::shared_ptr<Output> output = Output::createFromFile(outputFile, true);
+        std::shared_ptr<AbstractDecryptVerifyTask> task;
+        switch (op) {
+        case Decrypt: {
+            const std::shared_ptr<DecryptTask> t(new DecryptTask);
+            t->setInput(input);
+            t->setOutput(output);
+            t->setProtocol(GpgME::OpenPGP);
+            task = t;
+            break;
+        }
+        case DecryptVerify: {
+            const std::shared_ptr<DecryptVerifyTask> t(new DecryptVerifyTask);
+            t->setInput(input);
+            t->setOutput(output);
+            t->setProtocol(GpgME::OpenPGP);
+            task = t;
+            break;
+        }
+        case VerifyOpaque: {
+            const std::shared_ptr<VerifyOpaqueTask> t(new VerifyOpaqueTask);
+            t->setInput(input);
+            t->setOutput(output);
+            t->setProtocol(GpgME::OpenPGP);
+            task = t;
+            break;
+        }
+        }
+        std::shared_ptr<const DecryptVerifyResult> result;
+        QEventLoop loop;
+        connect(task.get(), &AbstractDecryptVerifyTask::decryptVerifyResult,
+                &loop, [&result, &loop](const std::shared_ptr<const DecryptVerifyResult> &r) {
+                    result = r;
+                    loop.quit();
+                });
+        QTimer::singleShot(timeoutFor(size >> 20), &loop, &QEventLoop::quit);
+        task->start();
+        if (!result) {
+            loop.exec();
+        }
+        return result;
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        qRegisterMetaType<GpgME::DecryptionResult>();
+        qRegisterMetaType<GpgME::VerificationResult>();
+
+        mBackend = QGpgME::openpgp();
+        QVERIFY(mDir.isValid());
+
+        std::vector<GpgME::Key> keys;
+        QVERIFY(!mBackend->keyListJob()->exec(QStringList(), false, keys).error());
+        const auto recipient = std::find_if(keys.cbegin(), keys.cend(), std::mem_fn(&GpgME::Key::canEncrypt));
+        QVERIFY(recipient != keys.cend());
+        mRecipients.push_back(*recipient);
+
+        keys.clear();
+        QVERIFY(!mBackend->keyListJob()->exec(QStringList(), true, keys).error());
+        const auto signer = std::find_if(keys.cbegin(), keys.cend(), std::mem_fn(&GpgME::Key::canSign));
+        QVERIFY(signer != keys.cend());
+        mSigners.push_back(*signer);
+    }
+
+    /* Runs DecryptTask, DecryptVerifyTask and VerifyOpaqueTask with a
+     * file Output, like the decrypt/verify commands do, and checks that
+     * the plaintext ends up in the output file only: while all three
+     * results are alive, peak memory use must stay well below the size
+     * of a single plaintext. The size in MiB can be set with
+     * KLEO_TEST_STREAMING_TASK_MIB. */
+    void testTasksDoNotKeepStreamedPlaintext()
+    {
+        const qint64 mib = qEnvironmentVariableIsSet("KLEO_TEST_STREAMING_TASK_MIB") ?
+                           qEnvironmentVariableIntValue("KLEO_TEST_STREAMING_TASK_MIB") : 32;
+        const qint64 size = mib * 1024 * 1024;
+        const Operation ops[] = { Decrypt, DecryptVerify, VerifyOpaque };
+
+        for (const Operation op : ops) {
+            QVERIFY(createInput(op, 1024, mDir.filePath(QStringLiteral("small-%1.gpg").arg(op))));
+            QVERIFY(createInput(op, size, mDir.filePath(QStringLiteral("large-%1.gpg").arg(op))));
+        }
+
+        // a first round on small messages sets up the KeyCache and
+        // everything else that stays around, so that it does not count
+        for (const Operation op : ops) {
+            const std::shared_ptr<const DecryptVerifyResult> result =
+                runTask(op, 1024, mDir.filePath(QStringLiteral("small-%1.gpg").arg(op)),
+                        mDir.filePath(QStringLiteral("small-%1.out").arg(op)));
+            QVERIFY(result);
+            QVERIFY2(!result->hasError(), qPrintable(result->errorString()));
+        }
+
+        const qint64 baseline = peakRssKiB();
+        std::vector<std::shared_ptr<const DecryptVerifyResult>> results;
+        for (const Operation op : ops) {
+            const QString outputFile = mDir.filePath(QStringLiteral("large-%1.out").arg(op));
+            results.push_back(runTask(op, size, mDir.filePath(QStringLiteral("large-%1.gpg").arg(op)), outputFile));
+            QVERIFY(results.back());
+            QVERIFY2(!results.back()->hasError(), qPrintable(results.back()->errorString()));
+            if (op != Decrypt) {
+                QCOMPARE(results.back()->verificationResult().numSignatures(), 1U);
+            }
+            QVERIFY(isGenerated(outputFile, size));
+        }
+
+        const qint64 growthKiB = peakRssKiB() - baseline;
+        qDebug("ran %d tasks on %lld MiB each, peak RSS grew by %lld KiB", int(results.size()), mib, growthKiB);
+        QVERIFY(growthKiB < size / 1024 / 2);
+    }
+
+    /* Benchmark: decrypts a large message from a file into an output
+     * device, like the tasks do with a real Output, and checks that the
+     * peak memory use of the process does not grow with the message size.
+     * Only runs if the size in MiB is given with KLEO_TEST_STREAMING_MIB,
+     * e.g. 4096 for a multi-GB run. */
+    void benchmarkDecryptLargeStream()
+    {
+        if (!qEnvironmentVariableIsSet("KLEO_TEST_STREAMING_MIB")) {
+            QSKIP("set KLEO_TEST_STREAMING_MIB to run this benchmark");
+        }
+        const qint64 mib = qEnvironmentVariableIntValue("KLEO_TEST_STREAMING_MIB");
+        const qint64 size = mib * 1024 * 1024;
+
+        const qint64 baseline = peakRssKiB();
+
+        const std::shared_ptr<QTemporaryFile> cipherText = std::make_shared<QTemporaryFile>();
+        QVERIFY(cipherText->open());
+        {
+            const std::shared_ptr<GeneratorDevice> plainText = std::make_shared<GeneratorDevice>(size);
+            QVERIFY(plainText->open(QIODevice::ReadOnly));
+            QGpgME::EncryptJob *const job = mBackend->encryptJob();
+            QSignalSpy spy(job, &QGpgME::Job::done);
+            job->start(mRecipients, plainText, cipherText, true);
+            QVERIFY(spy.wait(timeoutFor(mib)));
+        }
+        QVERIFY(cipherText->size() > 0);
+        QVERIFY(cipherText->seek(0));
+
+        const std::shared_ptr<SinkDevice> output = std::make_shared<SinkDevice>();
+        QVERIFY(output->open(QIODevice::WriteOnly));
+        QGpgME::DecryptVerifyJob *const job = mBackend->decryptVerifyJob();
+        QSignalSpy spy(job, SIGNAL(result(GpgME::DecryptionResult,GpgME::VerificationResult,QByteArray)));
+        job->start(cipherText, output);
+        QVERIFY(spy.wait(timeoutFor(mib)));
+
+        const GpgME::DecryptionResult result = spy.first().at(0).value<GpgME::DecryptionResult>();
+        QVERIFY(!result.error());
+        QVERIFY(spy.first().at(2).toByteArray().isEmpty());
+        QCOMPARE(output->written(), size);
+
+        const qint64 growthKiB = peakRssKiB() - baseline;
+        qDebug("decrypted %lld MiB, peak RSS grew by %lld KiB", mib, growthKiB);
+        QVERIFY(growthKiB < 64 * 1024);
+    }
+};
+
+QTEST_KLEOMAIN(DecryptStreamingTest)
+
+#include "test_decryptstreaming.moc"
@@ -32,6 +32,7 @@
 
 //
 // Usage: test_uiserver <socket> --verify-detached <signed data> <signature>
+//        test_uiserver <socket> --connect-bench <n>
 //
 
 #include <config-kleopatra.h>
@@ -52,6 +53,8 @@
 # include <errno.h>
 #endif
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <map>
@@ -84,10 +87,69 @@ static void usage(const std::string &msg = std::string())
               "      <io>: [--input <file>] [--output <file>] [--message <file>]\n"
 #endif
               " <options>: *[--option name=value]\n"
-              " <inquire>: [--inquire keyword=<file>]\n";
+              " <inquire>: [--inquire keyword=<file>]\n"
+              "\n"
+              "       test_uiserver <socket> --connect-bench <n>\n"
+              "connects <n> times and reports the latency from connect to the first GETINFO reply\n";
     exit(1);
 }
 
+static int connectBenchmark(const char *socket, int count)
+{
+    std::vector<double> latencies;
+    latencies.reserve(count);
+
+    for (int i = 0; i < count; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+
+        assuan_context_t ctx = nullptr;
+#ifndef HAVE_ASSUAN2
+        if (const gpg_error_t err = assuan_socket_connect_ext(&ctx, socket, -1, ASSUAN_CONNECT_FLAGS)) {
+            qDebug("%s", Exception(err, "assuan_socket_connect_ext").what());
+            return 1;
+        }
+#else
+        if (const gpg_error_t err = assuan_new(&ctx)) {
+            qDebug("%s", Exception(err, "assuan_new").what());
+            return 1;
+        }
+        if (const gpg_error_t err = assuan_socket_connect(ctx, socket, -1, ASSUAN_CONNECT_FLAGS)) {
+            qDebug("%s", Exception(err, "assuan_socket_connect").what());
+            assuan_release(ctx);
+            return 1;
+        }
+#endif
+
+        const gpg_error_t err = assuan_transact(ctx, "GETINFO version", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr);
+
+        latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+#ifndef HAVE_ASSUAN2
+        assuan_disconnect(ctx);
+#else
+        assuan_release(ctx);
+#endif
+        if (err) {
+            qDebug("%s", Exception(err, "GETINFO version").what());
+            return 1;
+        }
+    }
+
+    if (latencies.empty()) {
+        return 0;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](double p) {
+        return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+    };
+    std::cout << "connections: " << latencies.size() << "\n"
+              << "connect-to-first-reply (ms): min " << latencies.front()
+              << ", median " << percentile(0.5)
+              << ", p95 " << percentile(0.95)
+              << ", max " << latencies.back() << std::endl;
+    return 0;
+}
+
 #ifndef HAVE_ASSUAN2
 static assuan_error_t data(void *void_ctx, const void *buffer, size_t len)
 {
@@ -95,8 +157,9 @@ static assuan_error_t data(void *void_ctx, const void *buffer, size_t len)
 static gpg_error_t data(void *void_ctx, const void *buffer, size_t len)
 {
 #endif
-    (void)void_ctx; (void)buffer; (void)len;
-    return 0; // ### implement me
+    (void)void_ctx;
+    std::cout.write(static_cast<const char *>(buffer), len);
+    return std::cout ? 0 : gpg_error(GPG_ERR_EIO);
 }
 
 #ifndef HAVE_ASSUAN2
@@ -153,6 +216,13 @@ int main(int argc, char *argv[])
 
     const char *socket = argv[1];
 
+    if (qstrcmp(argv[2], "--connect-bench") == 0) {
+        if (argc < 4 || std::atoi(argv[3]) <= 0) {
+            usage("--connect-bench needs a positive number of connections");
+        }
+        return connectBenchmark(socket, std::atoi(argv[3]));
+    }
+
     std::vector<const char *> options;
 
     std::string command;
@@ -0,0 +1,369 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    tests/test_uiserver_load.cpp
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+//
+// Usage: test_uiserver_load <socket> [--connections <n>] [--iterations <m>] <script>...
+//
+// Replays gpg-connect-agent style scripts (see gpg-connect-agent-scripts/)
+// over <n> concurrent connections, <m> times each, and reports
+// throughput and latency percentiles per command.
+//
+
+#include <config-kleopatra.h>
+
+#include <kleo-assuan.h>
+#include <gpg-error.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const unsigned int ASSUAN_CONNECT_FLAGS = 1; // fd passing
+
+namespace
+{
+
+struct Script {
+    std::string name;
+    std::vector<std::string> lines;
+};
+
+typedef std::map<std::string, std::vector<double> > Samples; // command -> latencies in ms
+
+struct Stats {
+    Samples samples;
+    std::map<std::string, unsigned int> errors;
+    unsigned long long dataBytes = 0;
+    unsigned long long statusLines = 0;
+
+    void merge(const Stats &other)
+    {
+        for (const auto &s : other.samples) {
+            std::vector<double> &v = samples[s.first];
+            v.insert(v.end(), s.second.begin(), s.second.end());
+        }
+        for (const auto &e : other.errors) {
+            errors[e.first] += e.second;
+        }
+        dataBytes += other.dataBytes;
+        statusLines += other.statusLines;
+    }
+};
+
+struct Reply {
+    assuan_context_t ctx;
+    Stats *stats;
+};
+
+}
+
+static std::string cwd;
+
+static void usage(const std::string &msg = std::string())
+{
+    std::cerr << msg << std::endl <<
+              "\n"
+              "Usage: test_uiserver_load <socket> [--connections <n>] [--iterations <m>] <script>...\n"
+              "Each of the <n> connections runs all scripts <m> times. Scripts use the\n"
+              "gpg-connect-agent syntax of gpg-connect-agent-scripts/, with /sendfd and\n"
+              "/subst (${get cwd} only); files opened for writing are replaced by /dev/null.\n";
+    exit(1);
+}
+
+static bool readScript(const char *fileName, Script &script)
+{
+    std::ifstream in(fileName);
+    if (!in) {
+        return false;
+    }
+    script.name = fileName;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        script.lines.push_back(line);
+    }
+    return true;
+}
+
+static std::string substitute(std::string line)
+{
+    static const std::string var = "${get cwd}";
+    for (size_t pos = line.find(var); pos != std::string::npos; pos = line.find(var, pos + cwd.size())) {
+        line.replace(pos, var.size(), cwd);
+    }
+    return line;
+}
+
+#ifndef HAVE_ASSUAN2
+static assuan_error_t data(void *void_reply, const void *buffer, size_t len)
+{
+#else
+static gpg_error_t data(void *void_reply, const void *buffer, size_t len)
+{
+#endif
+    (void)buffer;
+    static_cast<Reply *>(void_reply)->stats->dataBytes += len;
+    return 0;
+}
+
+#ifndef HAVE_ASSUAN2
+static assuan_error_t status(void *void_reply, const char *line)
+{
+#else
+static gpg_error_t status(void *void_reply, const char *line)
+{
+#endif
+    (void)line;
+    ++static_cast<Reply *>(void_reply)->stats->statusLines;
+    return 0;
+}
+
+#ifndef HAVE_ASSUAN2
+static assuan_error_t inquire(void *void_reply, const char *keyword)
+{
+#else
+static gpg_error_t inquire(void *void_reply, const char *keyword)
+{
+#endif
+    (void)void_reply; (void)keyword;
+    return gpg_error(GPG_ERR_UNKNOWN_COMMAND);
+}
+
+static std::string commandName(const std::string &line)
+{
+    return line.substr(0, line.find(' '));
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// returns false if the script had to be aborted
+static bool runScript(const char *socket, const Script &script, Stats &stats)
+{
+    const auto scriptStart = std::chrono::steady_clock::now();
+
+    assuan_context_t ctx = nullptr;
+#ifndef HAVE_ASSUAN2
+    if (assuan_socket_connect_ext(&ctx, socket, -1, ASSUAN_CONNECT_FLAGS)) {
+#else
+    if (assuan_new(&ctx)) {
+        ++stats.errors["<connect>"];
+        return false;
+    }
+    if (assuan_socket_connect(ctx, socket, -1, ASSUAN_CONNECT_FLAGS)) {
+        assuan_release(ctx);
+#endif
+        ++stats.errors["<connect>"];
+        return false;
+    }
+    stats.samples["<connect>"].push_back(elapsedMs(scriptStart));
+
+    Reply reply = { ctx, &stats };
+    bool subst = false;
+    bool ok = true;
+    for (const std::string &rawLine : script.lines) {
+        const std::string line = subst ? substitute(rawLine) : rawLine;
+        if (line == "/subst") {
+            subst = true;
+            continue;
+        }
+        if (line.compare(0, 8, "/sendfd ") == 0) {
+            const size_t modePos = line.rfind(' ');
+            const std::string file = line.substr(8, modePos - 8);
+            const bool write = line.compare(modePos + 1, std::string::npos, "w") == 0;
+            const int fd = write ? ::open("/dev/null", O_WRONLY) : ::open(file.c_str(), O_RDONLY);
+            if (fd == -1) {
+                std::cerr << script.name << ": " << file << ": " << strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+            const gpg_error_t err = assuan_sendfd(ctx, fd);
+            ::close(fd);
+            if (err) {
+                ++stats.errors["<sendfd>"];
+                ok = false;
+                break;
+            }
+            continue;
+        }
+        if (line[0] == '/') {
+            continue; // other gpg-connect-agent directives don't matter here
+        }
+        if (line == "BYE") {
+            break;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const gpg_error_t err = assuan_transact(ctx, line.c_str(), data, &reply, inquire, &reply, status, &reply);
+        const std::string cmd = commandName(line);
+        stats.samples[cmd].push_back(elapsedMs(start));
+        if (err) {
+            ++stats.errors[cmd];
+            ok = false;
+            break;
+        }
+    }
+
+#ifndef HAVE_ASSUAN2
+    assuan_disconnect(ctx);
+#else
+    assuan_release(ctx);
+#endif
+    stats.samples["<script>"].push_back(elapsedMs(scriptStart));
+    return ok;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+static void report(Stats &stats, double wallMs)
+{
+    const unsigned int scripts = stats.samples["<script>"].size();
+    std::cout << "scripts run: " << scripts << " in " << wallMs / 1000 << "s"
+              << " (" << (wallMs > 0 ? scripts * 1000 / wallMs : 0) << "/s)\n"
+              << "data received: " << stats.dataBytes << " bytes, status lines: " << stats.statusLines << "\n\n";
+
+    std::printf("%-24s %8s %8s %10s %10s %10s %10s\n", "command", "count", "errors", "p50 ms", "p95 ms", "p99 ms", "max ms");
+    for (auto &s : stats.samples) {
+        std::vector<double> &v = s.second;
+        if (v.empty()) {
+            continue;
+        }
+        std::sort(v.begin(), v.end());
+        std::printf("%-24s %8u %8u %10.2f %10.2f %10.2f %10.2f\n", s.first.c_str(),
+                    unsigned(v.size()), stats.errors[s.first],
+                    percentile(v, 0.5), percentile(v, 0.95), percentile(v, 0.99), v.back());
+    }
+    for (const auto &e : stats.errors) {
+        if (!stats.samples.count(e.first)) {
+            std::printf("%-24s %8s %8u\n", e.first.c_str(), "-", e.second);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+#ifndef HAVE_ASSUAN2
+    assuan_set_assuan_err_source(GPG_ERR_SOURCE_DEFAULT);
+#else
+    assuan_set_gpg_err_source(GPG_ERR_SOURCE_DEFAULT);
+#endif
+
+    if (argc < 3) {
+        usage();    // need socket and script, at least
+    }
+
+    const char *socket = argv[1];
+    int connections = 1;
+    int iterations = 1;
+    std::vector<Script> scripts;
+
+    for (int optind = 2; optind < argc; ++optind) {
+        const char *const arg = argv[optind];
+        if (std::strcmp(arg, "--connections") == 0 && optind + 1 < argc) {
+            connections = std::atoi(argv[++optind]);
+        } else if (std::strcmp(arg, "--iterations") == 0 && optind + 1 < argc) {
+            iterations = std::atoi(argv[++optind]);
+        } else {
+            Script script;
+            if (!readScript(arg, script)) {
+                usage(std::string("cannot read script ") + arg);
+            }
+            scripts.push_back(script);
+        }
+    }
+    if (scripts.empty() || connections <= 0 || iterations <= 0) {
+        usage("need at least one script, and positive numbers of connections and iterations");
+    }
+
+    char buffer[4096];
+    if (getcwd(buffer, sizeof buffer)) {
+        cwd = buffer;
+    }
+
+    std::vector<Stats> perWorker(connections);
+    std::atomic<int> aborted(0);
+    std::vector<std::thread> workers;
+    workers.reserve(connections);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < connections; ++i) {
+        workers.emplace_back([&, i]() {
+            for (int it = 0; it < iterations; ++it) {
+                // stagger the mix, so that not all connections run the same command at once
+                for (size_t s = 0; s < scripts.size(); ++s) {
+                    if (!runScript(socket, scripts[(s + i) % scripts.size()], perWorker[i])) {
+                        ++aborted;
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread &t : workers) {
+        t.join();
+    }
+    const double wallMs = elapsedMs(start);
+
+    Stats total;
+    for (const Stats &s : perWorker) {
+        total.merge(s);
+    }
+    report(total, wallMs);
+
+    if (aborted) {
+        std::cout << "\n" << aborted << " script runs failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -37,21 +37,56 @@
 #include <QGpgME/KeyListJob>
 #include <QGpgME/DecryptVerifyJob>
 
+#include <crypto/signerkeyresolver.h>
+
+#include <Libkleo/KeyCache>
 
 #include <gpgme++/error.h>
 #include <gpgme++/verificationresult.h>
 #include <gpgme++/decryptionresult.h>
 #include <gpgme++/key.h>
+#include <QElapsedTimer>
 #include <QTimer>
 #include <QObject>
 #include <QSignalSpy>
 
+#include <vector>
+
 // Replace this with a gpgme version check once GnuPG Bug #2092
 // ( https://bugs.gnupg.org/gnupg/issue2092 ) is fixed.
 #define GPGME_MULTITHREADED_KEYLIST_BROKEN
 
 Q_DECLARE_METATYPE(GpgME::VerificationResult)
 
+// Measures the longest time the event loop did not get to run
+class EventLoopStallMeter : public QObject
+{
+    Q_OBJECT
+public:
+    EventLoopStallMeter() : mMaxStall(0)
+    {
+        connect(&mTimer, &QTimer::timeout, this, &EventLoopStallMeter::tick);
+        mTimer.start(0);
+        mSinceLastTick.start();
+    }
+
+    qint64 maxStall()
+    {
+        tick();
+        return mMaxStall;
+    }
+
+private:
+    void tick()
+    {
+        mMaxStall = qMax(mMaxStall, mSinceLastTick.restart());
+    }
+
+    QTimer mTimer;
+    QElapsedTimer mSinceLastTick;
+    qint64 mMaxStall;
+};
+
 class VerifyTest : public QObject
 {
     Q_OBJECT
@@ -198,6 +233,101 @@ private Q_SLOTS:
                     QLatin1String("/* -*- mode: c++; c-basic-offset:4 -*-")));
     }
 
+    /* Drives Kleo::Crypto::SignerKeyResolver through all its paths:
+     * waiting for the KeyCache, one batched KeyListJob for the cache
+     * misses of many results, cache hits, signers known to be
+     * unavailable, and receivers destroyed while waiting. The number of
+     * results can be set with KLEO_TEST_VERIFY_COUNT. */
+    void testSignerKeyResolver()
+    {
+        using Kleo::Crypto::SignerKeyResolver;
+
+        const int count = qEnvironmentVariableIsSet("KLEO_TEST_VERIFY_COUNT") ?
+                          qEnvironmentVariableIntValue("KLEO_TEST_VERIFY_COUNT") : 50;
+
+        std::vector<GpgME::VerificationResult> results;
+        for (int i = 0; i < count; ++i) {
+            results.push_back(mBackend->verifyDetachedJob()->exec(mSignature, mSignedData));
+            QCOMPARE(results.back().numSignatures(), 1U);
+        }
+        const char *const fpr = results.front().signature(0).fingerprint();
+        QVERIFY(fpr && *fpr);
+
+        // nothing else uses the KeyCache in this test, so the resolver
+        // gets a fresh one and has to wait for its initial listing
+        const std::shared_ptr<SignerKeyResolver> resolver = SignerKeyResolver::instance();
+        const std::shared_ptr<Kleo::KeyCache> cache = Kleo::KeyCache::mutableInstance();
+        QVERIFY(!cache->initialized());
+        int called = 0;
+        resolver->resolve(results.front(), mBackend, this, [&called]() { ++called; });
+        QCOMPARE(called, 0);
+        QTRY_COMPARE_WITH_TIMEOUT(called, 1, 10000);
+        QVERIFY(cache->initialized());
+
+        // cache misses of all results are listed by one job
+        const GpgME::Key signer = cache->findByKeyIDOrFingerprint(fpr);
+        QVERIFY(!signer.isNull());
+        cache->remove(signer);
+        SignerKeyResolver::Statistics before = resolver->statistics();
+        called = 0;
+        {
+            EventLoopStallMeter meter;
+            QElapsedTimer timer;
+            timer.start();
+            for (const GpgME::VerificationResult &result : results) {
+                resolver->resolve(result, mBackend, this, [&called]() { ++called; });
+            }
+            QCOMPARE(called, 0);
+            QTRY_COMPARE_WITH_TIMEOUT(called, count, 10000);
+            qDebug("resolving %d signers took %lld ms, event loop blocked for up to %lld ms",
+                   count, timer.elapsed(), meter.maxStall());
+        }
+        SignerKeyResolver::Statistics after = resolver->statistics();
+        QCOMPARE(after.keyListJobs, before.keyListJobs + 1);
+        QCOMPARE(after.lookups, before.lookups + count);
+        QVERIFY(!cache->findByKeyIDOrFingerprint(fpr).isNull());
+        for (const GpgME::VerificationResult &result : results) {
+            QCOMPARE(cache->findSigners(result).size(), size_t(1));
+        }
+
+        // now that the signer is cached, the callback is called right away
+        before = after;
+        called = 0;
+        resolver->resolve(results.front(), mBackend, this, [&called]() { ++called; });
+        QCOMPARE(called, 1);
+        after = resolver->statistics();
+        QCOMPARE(after.cacheHits, before.cacheHits + 1);
+        QCOMPARE(after.keyListJobs, before.keyListJobs);
+
+        // a receiver destroyed while waiting is not called back
+        cache->remove(cache->findByKeyIDOrFingerprint(fpr));
+        int orphanCalled = 0;
+        called = 0;
+        {
+            QObject receiver;
+            resolver->resolve(results.front(), mBackend, &receiver, [&orphanCalled]() { ++orphanCalled; });
+        }
+        resolver->resolve(results.front(), mBackend, this, [&called]() { ++called; });
+        QTRY_COMPARE_WITH_TIMEOUT(called, 1, 10000);
+        QCOMPARE(orphanCalled, 0);
+
+        // gpgsm does not know the OpenPGP signer: after one listing it is
+        // remembered as unavailable and not listed again
+        if (const QGpgME::Protocol *const smime = QGpgME::smime()) {
+            cache->remove(cache->findByKeyIDOrFingerprint(fpr));
+            before = resolver->statistics();
+            called = 0;
+            resolver->resolve(results.front(), smime, this, [&called]() { ++called; });
+            QTRY_COMPARE_WITH_TIMEOUT(called, 1, 10000);
+            QCOMPARE(resolver->statistics().keyListJobs, before.keyListJobs + 1);
+            QVERIFY(cache->findByKeyIDOrFingerprint(fpr).isNull());
+
+            resolver->resolve(results.front(), smime, this, [&called]() { ++called; });
+            QCOMPARE(called, 2);
+            QCOMPARE(resolver->statistics().keyListJobs, before.keyListJobs + 1);
+        }
+    }
+
 #ifndef GPGME_MULTITHREADED_KEYLIST_BROKEN
     // The following two tests are disabled because they trigger an
     // upstream bug in gpgme. See: https://bugs.gnupg.org/gnupg/issue2092
@@ -48,6 +48,7 @@
 
 #include <qgpgme/protocol.h>
 #include <qgpgme/listallkeysjob.h>
+#include <qgpgme/keylistjob.h>
 
 #include <gpg-error.h>
 
@@ -57,6 +58,10 @@
 #include <QPointer>
 #include <QTimer>
 #include <QEventLoop>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QSet>
 
 #include <utility>
 #include <algorithm>
@@ -87,7 +92,7 @@ class KeyCache::Private
     friend class ::Kleo::KeyCache;
     KeyCache *const q;
 public:
-    explicit Private(KeyCache *qq) : q(qq), m_refreshInterval(1), m_initalized(false)
+    explicit Private(KeyCache *qq) : q(qq), m_openPGPReloadPending(false), m_cmsReloadPending(false), m_pendingChanges(NoChange), m_fileSystemChangesScheduled(false), m_refreshInterval(1), m_initalized(false)
     {
         connect(&m_autoKeyListingTimer, &QTimer::timeout, q, [this]() { q->startKeyListing(); });
         updateAutoKeyListingTimer();
@@ -98,8 +103,29 @@ public:
         if (m_refreshJob) {
             m_refreshJob->cancel();
         }
+        if (m_refreshSecretKeysJob) {
+            m_refreshSecretKeysJob->cancel();
+        }
     }
 
+    // what a change of a file in the GnuPG home directory affects
+    enum Change {
+        NoChange = 0,
+        OpenPGPKeysChanged = 1,     // pubring.gpg
+        CMSKeysChanged = 2,         // pubring.kbx (also used by gpg)
+        OpenPGPTrustChanged = 4,    // trustdb.gpg
+        CMSTrustChanged = 8,        // trustlist.txt
+        SecretKeysChanged = 16,     // private-keys-v1.d, secring.gpg
+        UnknownChange = 32
+    };
+
+    static unsigned int classifyChange(const QString &path);
+    void fileChanged(const QString &path);
+    void directoryChanged(const QString &path);
+    void scheduleFileSystemChanges();
+    void processFileSystemChanges();
+    void refreshSecretKeys();
+
     template < template <template <typename U> class Op> class Comp>
     std::vector<Key>::const_iterator find(const std::vector<Key> &keys, const char *key) const
     {
@@ -141,6 +167,7 @@ public:
     }
 
     std::vector<Key> find_mailbox(const QString &email, bool sign) const;
+    std::vector< std::vector<Key> > find_mailboxes(const QStringList &emails, bool sign) const;
 
     std::vector<Subkey>::const_iterator find_subkeyid(const char *subkeyid) const
     {
@@ -168,6 +195,7 @@ public:
     }
 
     void refreshJobDone(const KeyListResult &result);
+    void refreshSecretKeysJobDone(const KeyListResult &result);
 
     void setRefreshInterval(int interval)
     {
@@ -195,9 +223,16 @@ public:
 
     void ensureCachePopulated() const;
 
+    void mergeIntoIndexes(std::vector<Key> &sorted);
+
 private:
     QPointer<RefreshKeysJob> m_refreshJob;
+    QPointer<RefreshSecretKeysJob> m_refreshSecretKeysJob;
+    bool m_openPGPReloadPending, m_cmsReloadPending; // requested while m_refreshJob was running
     std::vector<std::shared_ptr<FileSystemWatcher> > m_fsWatchers;
+    unsigned int m_pendingChanges;
+    bool m_fileSystemChangesScheduled;
+    QSet<QString> m_changedDirectories, m_changedFilesDirectories;
     QTimer m_autoKeyListingTimer;
     int m_refreshInterval;
 
@@ -205,6 +240,8 @@ private:
         std::vector<Key> fpr, keyid, shortkeyid, chainid;
         std::vector< std::pair<std::string, Key> > email;
         std::vector<Subkey> subkeyid;
+        // keyed by the gpgme key, which all copies in the indexes share
+        QHash<gpgme_key_t, KeyCache::KeyFlags> flags;
     } by;
     bool m_initalized;
 };
@@ -251,16 +288,28 @@ int KeyCache::refreshInterval() const
     return d->refreshInterval();
 }
 
-void KeyCache::reload(GpgME::Protocol /*proto*/)
+void KeyCache::reload(GpgME::Protocol proto)
 {
     if (d->m_refreshJob) {
+        // the running job may have listed the keys before they changed,
+        // so reload once it is done:
+        d->m_openPGPReloadPending |= proto != GpgME::CMS;
+        d->m_cmsReloadPending |= proto != GpgME::OpenPGP;
         return;
     }
 
-    d->updateAutoKeyListingTimer();
+    if (!d->m_initalized) {
+        proto = GpgME::UnknownProtocol;
+    }
+    if (proto == GpgME::UnknownProtocol) {
+        d->updateAutoKeyListingTimer();
+    }
+    if (d->m_refreshSecretKeysJob) {
+        d->m_refreshSecretKeysJob->cancel();
+    }
 
     enableFileSystemWatcher(false);
-    d->m_refreshJob = new RefreshKeysJob(this);
+    d->m_refreshJob = new RefreshKeysJob(this, proto);
     connect(d->m_refreshJob.data(), &RefreshKeysJob::done,
             this, [this](const GpgME::KeyListResult &r) {
                 d->refreshJobDone(r);
@@ -273,6 +322,7 @@ void KeyCache::cancelKeyListing()
     if (!d->m_refreshJob) {
         return;
     }
+    d->m_openPGPReloadPending = d->m_cmsReloadPending = false;
     d->m_refreshJob->cancel();
 }
 
@@ -283,18 +333,139 @@ void KeyCache::addFileSystemWatcher(const std::shared_ptr<FileSystemWatcher> &wa
     }
     d->m_fsWatchers.push_back(watcher);
     connect(watcher.get(), &FileSystemWatcher::directoryChanged,
-            this, [this]() { startKeyListing(); });
+            this, [this](const QString &path) { d->directoryChanged(path); });
     connect(watcher.get(), &FileSystemWatcher::fileChanged,
-            this, [this]() { startKeyListing(); });
+            this, [this](const QString &path) { d->fileChanged(path); });
 
     watcher->setEnabled(d->m_refreshJob == nullptr);
 }
 
+unsigned int KeyCache::Private::classifyChange(const QString &path)
+{
+    const QFileInfo fi(path);
+    const QString fileName = fi.fileName();
+    if (fileName == QLatin1String("pubring.gpg")) {
+        return OpenPGPKeysChanged;
+    }
+    if (fileName == QLatin1String("pubring.kbx")) {
+        return OpenPGPKeysChanged | CMSKeysChanged;
+    }
+    if (fileName == QLatin1String("trustdb.gpg")) {
+        return OpenPGPTrustChanged;
+    }
+    if (fileName == QLatin1String("trustlist.txt")) {
+        return CMSTrustChanged;
+    }
+    if (fileName == QLatin1String("secring.gpg")
+        || fileName == QLatin1String("private-keys-v1.d")
+        || fi.dir().dirName() == QLatin1String("private-keys-v1.d")) {
+        return SecretKeysChanged;
+    }
+    return UnknownChange;
+}
+
+// FileSystemWatcher reports a burst of changes in one go, so we collect
+// them and decide afterwards what needs to be refreshed.
+void KeyCache::Private::fileChanged(const QString &path)
+{
+    const unsigned int change = classifyChange(path);
+    qCDebug(LIBKLEO_LOG) << "KeyCache:" << path << "changed, classified as" << change;
+    m_changedFilesDirectories.insert(QFileInfo(path).absolutePath());
+    m_pendingChanges |= change;
+    scheduleFileSystemChanges();
+}
+
+void KeyCache::Private::directoryChanged(const QString &path)
+{
+    // on its own, a directory change only tells us that "something" changed,
+    // but usually it comes together with changes of the files therein:
+    m_changedDirectories.insert(QFileInfo(path).absoluteFilePath());
+    scheduleFileSystemChanges();
+}
+
+void KeyCache::Private::scheduleFileSystemChanges()
+{
+    if (m_fileSystemChangesScheduled) {
+        return;
+    }
+    m_fileSystemChangesScheduled = true;
+    QTimer::singleShot(0, q, [this]() { processFileSystemChanges(); });
+}
+
+void KeyCache::Private::processFileSystemChanges()
+{
+    m_fileSystemChangesScheduled = false;
+    for (const QString &dir : qAsConst(m_changedDirectories)) {
+        if (QFileInfo(dir).fileName() == QLatin1String("private-keys-v1.d")) {
+            m_pendingChanges |= SecretKeysChanged;
+        } else if (!m_changedFilesDirectories.contains(dir)) {
+            m_pendingChanges |= UnknownChange;
+        }
+    }
+    m_changedDirectories.clear();
+    m_changedFilesDirectories.clear();
+
+    const unsigned int changes = m_pendingChanges;
+    m_pendingChanges = NoChange;
+    if (changes == NoChange) {
+        return;
+    }
+
+    const bool openpgp = changes & (OpenPGPKeysChanged | OpenPGPTrustChanged | UnknownChange);
+    const bool cms = changes & (CMSKeysChanged | CMSTrustChanged | UnknownChange);
+    qCDebug(LIBKLEO_LOG) << "KeyCache: file system changes" << changes
+                         << "-> relisting OpenPGP:" << openpgp << "CMS:" << cms;
+    if (openpgp && cms) {
+        q->reload(GpgME::UnknownProtocol);
+    } else if (openpgp) {
+        q->reload(GpgME::OpenPGP);
+    } else if (cms) {
+        q->reload(GpgME::CMS);
+    }
+
+    if ((changes & SecretKeysChanged) && !(openpgp && cms)) {
+        refreshSecretKeys();
+    }
+}
+
+void KeyCache::Private::refreshSecretKeys()
+{
+    if (!m_initalized) {
+        q->reload();
+        return;
+    }
+    if (m_refreshSecretKeysJob) {
+        // the running job might have missed this change; a full refresh won't
+        q->reload();
+        return;
+    }
+    m_refreshSecretKeysJob = new RefreshSecretKeysJob(q);
+    connect(m_refreshSecretKeysJob.data(), &RefreshSecretKeysJob::done,
+            q, [this](const GpgME::KeyListResult &r) {
+                refreshSecretKeysJobDone(r);
+            });
+    m_refreshSecretKeysJob->start();
+}
+
 void KeyCache::Private::refreshJobDone(const KeyListResult &result)
 {
+    m_refreshJob.clear(); // deletes itself later
     q->enableFileSystemWatcher(true);
     m_initalized = true;
     Q_EMIT q->keyListingDone(result);
+
+    if (m_openPGPReloadPending || m_cmsReloadPending) {
+        const GpgME::Protocol proto = !m_cmsReloadPending ? GpgME::OpenPGP
+                                      : !m_openPGPReloadPending ? GpgME::CMS
+                                      : GpgME::UnknownProtocol;
+        m_openPGPReloadPending = m_cmsReloadPending = false;
+        q->reload(proto);
+    }
+}
+
+void KeyCache::Private::refreshSecretKeysJobDone(const KeyListResult &result)
+{
+    Q_EMIT q->keyListingDone(result);
 }
 
 const Key &KeyCache::findByFingerprint(const char *fpr) const
@@ -466,50 +637,65 @@ std::vector<Key> KeyCache::findEncryptionKeysByMailbox(const QString &mb) const
     return d->find_mailbox(mb, false);
 }
 
-namespace
+std::vector< std::vector<Key> > KeyCache::findSigningKeysByMailboxes(const QStringList &mbs) const
 {
-#define DO( op, meth, meth2 ) if ( op key.meth() ) {} else { qDebug( "rejecting for signing: %s: %s", #meth2, key.primaryFingerprint() ); return false; }
-#define ACCEPT( meth ) DO( !!, meth, !meth )
-#define REJECT( meth ) DO( !, meth, meth )
-struct ready_for_signing : std::unary_function<Key, bool> {
-    bool operator()(const Key &key) const
-    {
-#if 1
-        ACCEPT(hasSecret);
-        ACCEPT(canReallySign);
-        REJECT(isRevoked);
-        REJECT(isExpired);
-        REJECT(isDisabled);
-        REJECT(isInvalid);
-        return true;
-#else
-        return key.hasSecret() &&
-               key.canReallySign() && !key.isRevoked() && !key.isExpired() && !key.isDisabled() && !key.isInvalid();
-#endif
-#undef DO
-    }
-};
+    return d->find_mailboxes(mbs, true);
+}
 
-struct ready_for_encryption : std::unary_function<Key, bool> {
-#define DO( op, meth, meth2 ) if ( op key.meth() ) {} else { qDebug( "rejecting for encrypting: %s: %s", #meth2, key.primaryFingerprint() ); return false; }
-    bool operator()(const Key &key) const
-    {
-#if 1
-        ACCEPT(canEncrypt);
-        REJECT(isRevoked);
-        REJECT(isExpired);
-        REJECT(isDisabled);
-        REJECT(isInvalid);
-        return true;
-#else
-        return
-            key.canEncrypt()    && !key.isRevoked() && !key.isExpired() && !key.isDisabled() && !key.isInvalid();
-#endif
+std::vector< std::vector<Key> > KeyCache::findEncryptionKeysByMailboxes(const QStringList &mbs) const
+{
+    return d->find_mailboxes(mbs, false);
+}
+
+// static
+KeyCache::KeyFlags KeyCache::computeKeyFlags(const Key &key)
+{
+    KeyFlags flags;
+    if (key.isNull()) {
+        return flags;
     }
-#undef DO
-#undef ACCEPT
-#undef REJECT
-};
+    if (key.hasSecret()) {
+        flags |= HasSecret;
+    }
+    if (key.canReallySign()) {
+        flags |= CanSign;
+    }
+    if (key.canEncrypt()) {
+        flags |= CanEncrypt;
+    }
+    if (key.isRevoked()) {
+        flags |= IsRevoked;
+    }
+    if (key.isExpired()) {
+        flags |= IsExpired;
+    }
+    if (key.isDisabled()) {
+        flags |= IsDisabled;
+    }
+    if (key.isInvalid()) {
+        flags |= IsInvalid;
+    }
+    if (key.protocol() == OpenPGP) {
+        flags |= IsOpenPGP;
+    } else if (key.protocol() == CMS) {
+        flags |= IsCMS;
+    }
+    if (key.isRoot()) {
+        flags |= IsRoot;
+    }
+    if (key.numUserIDs() && key.userID(0).validity() == UserID::Ultimate) {
+        flags |= IsUltimatelyValid;
+    }
+    if (key.ownerTrust() == Key::Ultimate) {
+        flags |= HasUltimateOwnerTrust;
+    }
+    return flags;
+}
+
+KeyCache::KeyFlags KeyCache::keyFlags(const Key &key) const
+{
+    const auto it = d->by.flags.constFind(key.impl());
+    return it == d->by.flags.cend() ? computeKeyFlags(key) : *it;
 }
 
 std::vector<Key> KeyCache::Private::find_mailbox(const QString &email, bool sign) const
@@ -519,17 +705,67 @@ std::vector<Key> KeyCache::Private::find_mailbox(const QString &email, bool sign
     }
 
     const auto pair = find_email(email.toUtf8().constData());
+    const auto ready = sign ? &KeyCache::isReadyForSigning : &KeyCache::isReadyForEncryption;
     std::vector<Key> result;
     result.reserve(std::distance(pair.first, pair.second));
-    if (sign)
-        kdtools::copy_2nd_if(pair.first, pair.second,
-                             std::back_inserter(result),
-                             ready_for_signing());
-    else
-        kdtools::copy_2nd_if(pair.first, pair.second,
-                             std::back_inserter(result),
-                             ready_for_encryption());
+    for (auto it = pair.first; it != pair.second; ++it) {
+        const KeyCache::KeyFlags flags = q->keyFlags(it->second);
+        if (ready(flags)) {
+            result.push_back(it->second);
+        } else {
+            qCDebug(LIBKLEO_LOG) << "rejecting for" << (sign ? "signing:" : "encrypting:")
+                                 << it->second.primaryFingerprint() << flags;
+        }
+    }
+
+    return result;
+}
+
+std::vector< std::vector<Key> > KeyCache::Private::find_mailboxes(const QStringList &emails, bool sign) const
+{
+    std::vector< std::vector<Key> > result(emails.size());
+    if (emails.empty()) {
+        return result;
+    }
+    ensureCachePopulated();
+
+    // sort the queries once and walk them and the email index in parallel,
+    // instead of one binary search per query
+    std::vector< std::pair<std::string, int> > queries;
+    queries.reserve(emails.size());
+    for (int i = 0, end = emails.size(); i < end; ++i) {
+        if (!emails[i].isEmpty()) {
+            queries.push_back(std::make_pair(std::string(emails[i].toUtf8().constData()), i));
+        }
+    }
+    std::sort(queries.begin(), queries.end(), ByEMail<std::less>());
 
+    const auto ready = sign ? &KeyCache::isReadyForSigning : &KeyCache::isReadyForEncryption;
+    auto idx = by.email.cbegin();
+    const auto idxEnd = by.email.cend();
+    for (auto query = queries.cbegin(), qEnd = queries.cend(); query != qEnd && idx != idxEnd;) {
+        const int cmp = qstricmp(query->first.c_str(), idx->first.c_str());
+        if (cmp > 0) {
+            ++idx;
+            continue;
+        }
+        // all queries equal to *query get the same keys
+        const auto qGroupEnd = std::find_if(query, qEnd, [query](const std::pair<std::string, int> &other) {
+            return qstricmp(other.first.c_str(), query->first.c_str()) != 0;
+        });
+        if (cmp == 0) {
+            std::vector<Key> keys;
+            for (; idx != idxEnd && qstricmp(idx->first.c_str(), query->first.c_str()) == 0; ++idx) {
+                if (ready(q->keyFlags(idx->second))) {
+                    keys.push_back(idx->second);
+                }
+            }
+            for (auto it = query; it != qGroupEnd; ++it) {
+                result[it->second] = keys;
+            }
+        }
+        query = qGroupEnd;
+    }
     return result;
 }
 
@@ -709,6 +945,9 @@ void KeyCache::remove(const Key &key)
     {
         const auto range = std::equal_range(d->by.fpr.begin(), d->by.fpr.end(), fpr,
                                             _detail::ByFingerprint<std::less>());
+        for (auto it = range.first; it != range.second; ++it) {
+            d->by.flags.remove(it->impl());
+        }
         d->by.fpr.erase(range.first, range.second);
     }
 
@@ -832,14 +1071,27 @@ void KeyCache::insert(const std::vector<Key> &keys)
         remove(key);    // this is sub-optimal, but makes implementation from here on much easier
     }
 
+    d->mergeIntoIndexes(sorted);
+
+    for (const Key &key : qAsConst(sorted)) {
+        Q_EMIT added(key);
+    }
+
+    Q_EMIT keysMayHaveChanged();
+}
+
+// Merges sorted, which holds keys not in the cache, into the indexes.
+// sorted is left in an unspecified order.
+void KeyCache::Private::mergeIntoIndexes(std::vector<Key> &sorted)
+{
     // 2. sort by fingerprint:
     std::sort(sorted.begin(), sorted.end(), _detail::ByFingerprint<std::less>());
 
     // 2a. insert into fpr index:
     std::vector<Key> by_fpr;
-    by_fpr.reserve(sorted.size() + d->by.fpr.size());
+    by_fpr.reserve(sorted.size() + by.fpr.size());
     std::merge(sorted.begin(), sorted.end(),
-               d->by.fpr.begin(), d->by.fpr.end(),
+               by.fpr.begin(), by.fpr.end(),
                std::back_inserter(by_fpr),
                _detail::ByFingerprint<std::less>());
 
@@ -856,9 +1108,9 @@ void KeyCache::insert(const std::vector<Key> &keys)
 
     // 3a. insert into email index:
     std::vector< std::pair<std::string, Key> > by_email;
-    by_email.reserve(pairs.size() + d->by.email.size());
+    by_email.reserve(pairs.size() + by.email.size());
     std::merge(pairs.begin(), pairs.end(),
-               d->by.email.begin(), d->by.email.end(),
+               by.email.begin(), by.email.end(),
                std::back_inserter(by_email),
                ByEMail<std::less>());
 
@@ -869,12 +1121,12 @@ void KeyCache::insert(const std::vector<Key> &keys)
     std::vector<Key> nonroot;
     nonroot.reserve(sorted.size());
     std::vector<Key> by_chainid;
-    by_chainid.reserve(sorted.size() + d->by.chainid.size());
+    by_chainid.reserve(sorted.size() + by.chainid.size());
     std::copy_if(sorted.cbegin(), sorted.cend(),
                  std::back_inserter(nonroot),
                  [](const Key &key) { return !key.isRoot(); });
     std::merge(nonroot.cbegin(), nonroot.cend(),
-               d->by.chainid.cbegin(), d->by.chainid.cend(),
+               by.chainid.cbegin(), by.chainid.cend(),
                std::back_inserter(by_chainid),
                lexicographically<_detail::ByChainID, _detail::ByFingerprint>());
 
@@ -883,9 +1135,9 @@ void KeyCache::insert(const std::vector<Key> &keys)
 
     // 4a. insert into keyid index:
     std::vector<Key> by_keyid;
-    by_keyid.reserve(sorted.size() + d->by.keyid.size());
+    by_keyid.reserve(sorted.size() + by.keyid.size());
     std::merge(sorted.begin(), sorted.end(),
-               d->by.keyid.begin(), d->by.keyid.end(),
+               by.keyid.begin(), by.keyid.end(),
                std::back_inserter(by_keyid),
                _detail::ByKeyID<std::less>());
 
@@ -894,9 +1146,9 @@ void KeyCache::insert(const std::vector<Key> &keys)
 
     // 5a. insert into short keyid index:
     std::vector<Key> by_shortkeyid;
-    by_shortkeyid.reserve(sorted.size() + d->by.shortkeyid.size());
+    by_shortkeyid.reserve(sorted.size() + by.shortkeyid.size());
     std::merge(sorted.begin(), sorted.end(),
-               d->by.shortkeyid.begin(), d->by.shortkeyid.end(),
+               by.shortkeyid.begin(), by.shortkeyid.end(),
                std::back_inserter(by_shortkeyid),
                _detail::ByShortKeyID<std::less>());
 
@@ -913,21 +1165,121 @@ void KeyCache::insert(const std::vector<Key> &keys)
 
     // 6b. insert into subkey ID index:
     std::vector<Subkey> by_subkeyid;
-    by_email.reserve(subkeys.size() + d->by.subkeyid.size());
+    by_email.reserve(subkeys.size() + by.subkeyid.size());
     std::merge(subkeys.begin(), subkeys.end(),
-               d->by.subkeyid.begin(), d->by.subkeyid.end(),
+               by.subkeyid.begin(), by.subkeyid.end(),
                std::back_inserter(by_subkeyid),
                _detail::ByKeyID<std::less>());
 
     // now commit (well, we already removed keys...)
-    by_fpr.swap(d->by.fpr);
-    by_keyid.swap(d->by.keyid);
-    by_shortkeyid.swap(d->by.shortkeyid);
-    by_email.swap(d->by.email);
-    by_subkeyid.swap(d->by.subkeyid);
-    by_chainid.swap(d->by.chainid);
-
+    by_fpr.swap(by.fpr);
+    by_keyid.swap(by.keyid);
+    by_shortkeyid.swap(by.shortkeyid);
+    by_email.swap(by.email);
+    by_subkeyid.swap(by.subkeyid);
+    by_chainid.swap(by.chainid);
+
+    // the flags index is keyed by gpgme key, so it needs no merging:
+    by.flags.reserve(by.fpr.size());
     for (const Key &key : qAsConst(sorted)) {
+        by.flags.insert(key.impl(), computeKeyFlags(key));
+    }
+}
+
+static bool userIDsDiffer(const Key &lhs, const Key &rhs)
+{
+    const std::vector<UserID> l = lhs.userIDs();
+    const std::vector<UserID> r = rhs.userIDs();
+    return l.size() != r.size()
+           || !std::equal(l.begin(), l.end(), r.begin(),
+                          [](const UserID &a, const UserID &b) {
+                              return qstrcmp(a.id(), b.id()) == 0
+                                     && a.validity() == b.validity()
+                                     && a.isRevoked() == b.isRevoked()
+                                     && a.numSignatures() == b.numSignatures();
+                          });
+}
+
+static bool subkeysDiffer(const Key &lhs, const Key &rhs)
+{
+    const std::vector<Subkey> l = lhs.subkeys();
+    const std::vector<Subkey> r = rhs.subkeys();
+    return l.size() != r.size()
+           || !std::equal(l.begin(), l.end(), r.begin(),
+                          [](const Subkey &a, const Subkey &b) {
+                              return qstrcmp(a.keyID(), b.keyID()) == 0
+                                     && a.expirationTime() == b.expirationTime()
+                                     && a.isRevoked() == b.isRevoked()
+                                     && a.isExpired() == b.isExpired()
+                                     && a.isDisabled() == b.isDisabled()
+                                     && a.isSecret() == b.isSecret();
+                          });
+}
+
+// whether a listing of a cached key shows anything users of the cache
+// would notice
+static bool keyChanged(const Key &cached, const Key &listed)
+{
+    return KeyCache::computeKeyFlags(cached) != KeyCache::computeKeyFlags(listed)
+           || cached.ownerTrust() != listed.ownerTrust()
+           || qstrcmp(cached.issuerSerial(), listed.issuerSerial()) != 0
+           || userIDsDiffer(cached, listed)
+           || subkeysDiffer(cached, listed);
+}
+
+void KeyCache::replaceKeys(GpgME::Protocol proto, const std::vector<Key> &keys)
+{
+    // like insert(), but a single merge of the two sorted lists instead of
+    // removing every listed key on its own
+    std::vector<Key> listed;
+    listed.reserve(keys.size());
+    std::remove_copy_if(keys.begin(), keys.end(),
+                        std::back_inserter(listed),
+                        [](const Key &key) {
+                            auto fp = key.primaryFingerprint();
+                            return !fp || !*fp;
+                        });
+
+    const std::vector<Key> &cached = d->by.fpr;
+    std::vector<Key> merged, removed, changed;
+    merged.reserve(cached.size() + listed.size());
+    _detail::ByFingerprint<std::less> byFingerprint;
+    auto c = cached.cbegin();
+    auto k = listed.cbegin();
+    while (c != cached.cend() || k != listed.cend()) {
+        if (k == listed.cend() || (c != cached.cend() && byFingerprint(*c, *k))) {
+            if (c->protocol() == proto) {
+                removed.push_back(*c);
+            } else {
+                merged.push_back(*c);
+            }
+            ++c;
+        } else if (c == cached.cend() || byFingerprint(*k, *c)) {
+            merged.push_back(*k);
+            changed.push_back(*k);
+            ++k;
+        } else {
+            // keep the cached key if nothing changed, it is the one that
+            // the users of the cache already hold
+            if (keyChanged(*c, *k)) {
+                merged.push_back(*k);
+                changed.push_back(*k);
+            } else {
+                merged.push_back(*c);
+            }
+            ++c;
+            ++k;
+        }
+    }
+
+    for (const Key &key : qAsConst(removed)) {
+        Q_EMIT aboutToRemove(key);
+    }
+
+    d->by = Private::By();
+    d->mergeIntoIndexes(merged);
+
+    for (const Key &key : qAsConst(changed)) {
         Q_EMIT added(key);
     }
 
@@ -949,7 +1301,7 @@ class KeyCache::RefreshKeysJob::Private
 {
     RefreshKeysJob *const q;
 public:
-    Private(KeyCache *cache, RefreshKeysJob *qq);
+    Private(KeyCache *cache, GpgME::Protocol protocol, RefreshKeysJob *qq);
     void doStart();
     Error startKeyListing(GpgME::Protocol protocol);
     void listAllKeysJobDone(const KeyListResult &res, const std::vector<Key> &nextKeys)
@@ -970,6 +1322,7 @@ public:
     void updateKeyCache();
 
     QPointer<KeyCache> m_cache;
+    GpgME::Protocol m_protocol;
     QVector<QGpgME::ListAllKeysJob*> m_jobsPending;
     std::vector<Key> m_keys;
     KeyListResult m_mergedResult;
@@ -979,9 +1332,10 @@ private:
     void jobDone(const KeyListResult &res);
 };
 
-KeyCache::RefreshKeysJob::Private::Private(KeyCache *cache, RefreshKeysJob *qq)
+KeyCache::RefreshKeysJob::Private::Private(KeyCache *cache, GpgME::Protocol protocol, RefreshKeysJob *qq)
     : q(qq)
     , m_cache(cache)
+    , m_protocol(protocol)
     , m_canceled(false)
 {
     Q_ASSERT(m_cache);
@@ -1014,7 +1368,8 @@ void KeyCache::RefreshKeysJob::Private::emitDone(const KeyListResult &res)
     Q_EMIT q->done(res);
 }
 
-KeyCache::RefreshKeysJob::RefreshKeysJob(KeyCache *cache, QObject *parent) : QObject(parent), d(new Private(cache, this))
+KeyCache::RefreshKeysJob::RefreshKeysJob(KeyCache *cache, GpgME::Protocol protocol, QObject *parent)
+    : QObject(parent), d(new Private(cache, protocol, this))
 {
 }
 
@@ -1041,8 +1396,12 @@ void KeyCache::RefreshKeysJob::Private::doStart()
     }
 
     Q_ASSERT(m_jobsPending.size() == 0);
-    m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::OpenPGP)));
-    m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::CMS)));
+    if (m_protocol != GpgME::CMS) {
+        m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::OpenPGP)));
+    }
+    if (m_protocol != GpgME::OpenPGP) {
+        m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::CMS)));
+    }
 
     if (m_jobsPending.size() != 0) {
         return;
@@ -1059,6 +1418,12 @@ void KeyCache::RefreshKeysJob::Private::updateKeyCache()
         return;
     }
 
+    if (m_protocol != GpgME::UnknownProtocol && m_cache->initialized()) {
+        // refresh() would drop the keys of the other protocol
+        m_cache->replaceKeys(m_protocol, m_keys);
+        return;
+    }
+
     std::vector<Key> cachedKeys = m_cache->initialized() ? m_cache->keys() : std::vector<Key>();
     std::sort(cachedKeys.begin(), cachedKeys.end(), _detail::ByFingerprint<std::less>());
     std::vector<Key> keysToRemove;
@@ -1114,6 +1479,217 @@ Error KeyCache::RefreshKeysJob::Private::startKeyListing(GpgME::Protocol proto)
     return error;
 }
 
+//
+//
+// RefreshSecretKeysJob
+//
+//
+
+class KeyCache::RefreshSecretKeysJob::Private
+{
+    RefreshSecretKeysJob *const q;
+public:
+    Private(KeyCache *cache, RefreshSecretKeysJob *qq)
+        : q(qq), m_cache(cache), m_relisting(false), m_canceled(false)
+    {
+        Q_ASSERT(m_cache);
+    }
+
+    void doStart();
+    void keyListJobDone(const KeyListResult &res, const std::vector<Key> &keys);
+
+    Error startKeyListing(GpgME::Protocol proto, const QStringList &patterns, bool secretOnly);
+    void updateSecretKeys();
+    void dropDeletedKeys();
+    void emitDone(const KeyListResult &result);
+
+    QPointer<KeyCache> m_cache;
+    QVector<QGpgME::KeyListJob *> m_jobsPending;
+    std::vector<Key> m_secretKeys;
+    std::vector<Key> m_relistedKeys;
+    std::vector<Key> m_lostSecret;
+    KeyListResult m_mergedResult;
+    bool m_relisting;
+    bool m_canceled;
+};
+
+KeyCache::RefreshSecretKeysJob::RefreshSecretKeysJob(KeyCache *cache, QObject *parent)
+    : QObject(parent), d(new Private(cache, this))
+{
+}
+
+KeyCache::RefreshSecretKeysJob::~RefreshSecretKeysJob()
+{
+    delete d;
+}
+
+void KeyCache::RefreshSecretKeysJob::start()
+{
+    QTimer::singleShot(0, this, [this](){ d->doStart(); });
+}
+
+void KeyCache::RefreshSecretKeysJob::cancel()
+{
+    d->m_canceled = true;
+    Q_EMIT canceled();
+}
+
+void KeyCache::RefreshSecretKeysJob::Private::doStart()
+{
+    if (m_canceled || !m_cache) {
+        q->deleteLater();
+        return;
+    }
+
+    m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::OpenPGP, QStringList(), true)));
+    m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::CMS, QStringList(), true)));
+    if (m_jobsPending.empty()) {
+        emitDone(m_mergedResult);
+    }
+}
+
+Error KeyCache::RefreshSecretKeysJob::Private::startKeyListing(GpgME::Protocol proto, const QStringList &patterns, bool secretOnly)
+{
+    const auto * const protocol = (proto == GpgME::OpenPGP) ? QGpgME::openpgp() : QGpgME::smime();
+    if (!protocol) {
+        return Error();
+    }
+    QGpgME::KeyListJob *const job = protocol->keyListJob(/*remote*/false, /*includeSigs*/false, /*validate*/!secretOnly);
+    if (!job) {
+        return Error();
+    }
+
+    // old style connect, see RefreshKeysJob::Private::startKeyListing()
+    connect(job, SIGNAL(result(GpgME::KeyListResult,std::vector<GpgME::Key>)),
+            q, SLOT(keyListJobDone(GpgME::KeyListResult,std::vector<GpgME::Key>)));
+
+    connect(q, &RefreshSecretKeysJob::canceled, job, &QGpgME::Job::slotCancel);
+
+    const Error error = job->start(patterns, secretOnly);
+
+    if (!error && !error.isCanceled()) {
+        m_jobsPending.push_back(job);
+    }
+    return error;
+}
+
+void KeyCache::RefreshSecretKeysJob::Private::keyListJobDone(const KeyListResult &result, const std::vector<Key> &keys)
+{
+    if (m_canceled) {
+        q->deleteLater();
+        return;
+    }
+
+    QObject *const sender = q->sender();
+    if (sender) {
+        sender->disconnect(q);
+    }
+    m_jobsPending.removeOne(qobject_cast<QGpgME::KeyListJob *>(sender));
+    m_mergedResult.mergeWith(result);
+    std::vector<Key> &target = m_relisting ? m_relistedKeys : m_secretKeys;
+    target.insert(target.end(), keys.begin(), keys.end());
+    if (!m_jobsPending.empty()) {
+        return;
+    }
+
+    if (!m_relisting) {
+        updateSecretKeys();
+    } else if (m_cache) {
+        std::sort(m_relistedKeys.begin(), m_relistedKeys.end(), _detail::ByFingerprint<std::less>());
+        for (Key &key : m_relistedKeys) {
+            const auto it = std::lower_bound(m_secretKeys.cbegin(), m_secretKeys.cend(), key,
+                                             _detail::ByFingerprint<std::less>());
+            if (it != m_secretKeys.cend() && _detail::ByFingerprint<std::equal_to>()(*it, key)) {
+                key.mergeWith(*it);
+            }
+        }
+        m_cache->insert(m_relistedKeys);
+        dropDeletedKeys();
+    }
+
+    if (m_jobsPending.empty()) {
+        emitDone(m_mergedResult);
+    }
+}
+
+void KeyCache::RefreshSecretKeysJob::Private::updateSecretKeys()
+{
+    if (!m_cache) {
+        return;
+    }
+
+    std::sort(m_secretKeys.begin(), m_secretKeys.end(), _detail::ByFingerprint<std::less>());
+    std::vector<Key> cachedKeys = m_cache->keys();
+    std::sort(cachedKeys.begin(), cachedKeys.end(), _detail::ByFingerprint<std::less>());
+
+    std::vector<Key> gainedSecret;
+    QStringList relistOpenPGP, relistCMS;
+    const auto relist = [&relistOpenPGP, &relistCMS](const Key &key) {
+        (key.protocol() == GpgME::CMS ? relistCMS : relistOpenPGP) << QString::fromLatin1(key.primaryFingerprint());
+    };
+
+    auto secIt = m_secretKeys.cbegin();
+    const auto secEnd = m_secretKeys.cend();
+    for (const Key &key : qAsConst(cachedKeys)) {
+        while (secIt != secEnd && _detail::ByFingerprint<std::less>()(*secIt, key)) {
+            relist(*secIt++); // secret key without cached public key
+        }
+        const bool hasSecret = secIt != secEnd && _detail::ByFingerprint<std::equal_to>()(*secIt, key);
+        if (hasSecret && !key.hasSecret()) {
+            Key merged = key;
+            merged.mergeWith(*secIt);
+            gainedSecret.push_back(merged);
+        } else if (!hasSecret && key.hasSecret()) {
+            relist(key);
+            m_lostSecret.push_back(key);
+        }
+        if (hasSecret) {
+            ++secIt;
+        }
+    }
+    while (secIt != secEnd) {
+        relist(*secIt++);
+    }
+
+    qCDebug(LIBKLEO_LOG) << "RefreshSecretKeysJob:" << gainedSecret.size() << "keys gained a secret key,"
+                         << relistOpenPGP.size() + relistCMS.size() << "keys need to be relisted";
+    m_cache->insert(gainedSecret);
+
+    m_relisting = true;
+    if (!relistOpenPGP.empty()) {
+        m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::OpenPGP, relistOpenPGP, false)));
+    }
+    if (!relistCMS.empty()) {
+        m_mergedResult.mergeWith(KeyListResult(startKeyListing(GpgME::CMS, relistCMS, false)));
+    }
+    if (m_jobsPending.empty()) {
+        dropDeletedKeys();
+    }
+}
+
+// Keys whose secret key vanished and which the relisting did not
+// return either were deleted altogether:
+void KeyCache::RefreshSecretKeysJob::Private::dropDeletedKeys()
+{
+    if (!m_cache || m_mergedResult.error()) {
+        return;
+    }
+    std::vector<Key> deleted;
+    std::set_difference(m_lostSecret.cbegin(), m_lostSecret.cend(),
+                        m_relistedKeys.cbegin(), m_relistedKeys.cend(),
+                        std::back_inserter(deleted), _detail::ByFingerprint<std::less>());
+    if (!deleted.empty()) {
+        qCDebug(LIBKLEO_LOG) << "RefreshSecretKeysJob:" << deleted.size() << "keys were deleted";
+        m_cache->remove(deleted);
+    }
+}
+
+void KeyCache::RefreshSecretKeysJob::Private::emitDone(const KeyListResult &res)
+{
+    q->deleteLater();
+    Q_EMIT q->done(res);
+}
+
 bool KeyCache::initialized() const
 {
     return d->m_initalized;
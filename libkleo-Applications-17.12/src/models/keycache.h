@@ -34,6 +34,7 @@
 #define __KLEOPATRA_MODELS_KEYCACHE_H__
 
 #include <QObject>
+#include <QStringList>
 
 #include <kleo_export.h>
 
@@ -116,6 +117,10 @@ public:
     std::vector<GpgME::Key> findSigningKeysByMailbox(const QString &mb) const;
     std::vector<GpgME::Key> findEncryptionKeysByMailbox(const QString &mb) const;
 
+    /** Bulk versions of the above: result[i] holds the keys for mbs[i]. */
+    std::vector< std::vector<GpgME::Key> > findSigningKeysByMailboxes(const QStringList &mbs) const;
+    std::vector< std::vector<GpgME::Key> > findEncryptionKeysByMailboxes(const QStringList &mbs) const;
+
     enum Option {
         NoOption = 0,
         RecursiveSearch = 1,
@@ -123,6 +128,40 @@ public:
     };
     Q_DECLARE_FLAGS(Options, Option)
 
+    /** Capability and status bits of a key, computed once when the key is
+        inserted into the cache. */
+    enum KeyFlag {
+        NoKeyFlags = 0,
+        HasSecret = 0x0001,
+        CanSign = 0x0002, // canReallySign()
+        CanEncrypt = 0x0004,
+        IsRevoked = 0x0008,
+        IsExpired = 0x0010,
+        IsDisabled = 0x0020,
+        IsInvalid = 0x0040,
+        IsOpenPGP = 0x0080,
+        IsCMS = 0x0100,
+        IsRoot = 0x0200,
+        IsUltimatelyValid = 0x0400, // validity of the first user ID
+        HasUltimateOwnerTrust = 0x0800,
+
+        IsUnusable = IsRevoked | IsExpired | IsDisabled | IsInvalid
+    };
+    Q_DECLARE_FLAGS(KeyFlags, KeyFlag)
+
+    static KeyFlags computeKeyFlags(const GpgME::Key &key);
+    /** Returns the cached flags of @p key, or computes them if @p key is not in the cache. */
+    KeyFlags keyFlags(const GpgME::Key &key) const;
+
+    static bool isReadyForSigning(KeyFlags flags)
+    {
+        return (flags & (HasSecret | CanSign | IsUnusable)) == (HasSecret | CanSign);
+    }
+    static bool isReadyForEncryption(KeyFlags flags)
+    {
+        return (flags & (CanEncrypt | IsUnusable)) == CanEncrypt;
+    }
+
     std::vector<GpgME::Key> findSubjects(const GpgME::Key &key, Options option = RecursiveSearch) const;
     std::vector<GpgME::Key> findSubjects(const std::vector<GpgME::Key> &keys, Options options = RecursiveSearch) const;
     std::vector<GpgME::Key> findSubjects(std::vector<GpgME::Key>::const_iterator first, std::vector<GpgME::Key>::const_iterator last, Options options = RecursiveSearch) const;
@@ -152,6 +191,11 @@ Q_SIGNALS:
 
 private:
     class RefreshKeysJob;
+    class RefreshSecretKeysJob;
+
+    // Replaces the cached keys of protocol proto with keys, which are
+    // sorted by fingerprint; signals only the keys that changed
+    void replaceKeys(GpgME::Protocol proto, const std::vector<GpgME::Key> &keys);
 
     class Private;
     QScopedPointer<Private> const d;
@@ -160,5 +204,6 @@ private:
 }
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(Kleo::KeyCache::Options)
+Q_DECLARE_OPERATORS_FOR_FLAGS(Kleo::KeyCache::KeyFlags)
 
 #endif /* __KLEOPATRA_MODELS_KEYCACHE_H__ */
@@ -48,7 +48,7 @@ class KeyCache::RefreshKeysJob : public QObject
     Q_OBJECT
 public:
 
-    explicit RefreshKeysJob(KeyCache *cache, QObject *parent = nullptr);
+    explicit RefreshKeysJob(KeyCache *cache, GpgME::Protocol protocol = GpgME::UnknownProtocol, QObject *parent = nullptr);
     ~RefreshKeysJob();
 
     void start();
@@ -64,6 +64,31 @@ private:
     Private * const d;
     Q_PRIVATE_SLOT(d, void listAllKeysJobDone(GpgME::KeyListResult, std::vector<GpgME::Key>))
 };
+
+// Updates only the secret key status of the cached keys: lists the
+// secret keys and re-lists just those public keys which gained or lost
+// their secret part.
+class KeyCache::RefreshSecretKeysJob : public QObject
+{
+    Q_OBJECT
+public:
+
+    explicit RefreshSecretKeysJob(KeyCache *cache, QObject *parent = nullptr);
+    ~RefreshSecretKeysJob();
+
+    void start();
+    void cancel();
+
+Q_SIGNALS:
+    void done(const GpgME::KeyListResult &);
+    void canceled();
+
+private:
+    class Private;
+    friend class Private;
+    Private * const d;
+    Q_PRIVATE_SLOT(d, void keyListJobDone(GpgME::KeyListResult, std::vector<GpgME::Key>))
+};
 }
 
 #endif // __KLEOPATRA_KEYCACHE_P_H__
@@ -0,0 +1,117 @@
+/*
+    test_filesystemwatcher.cpp
+
+    This file is part of libkleopatra's test suite.
+    Copyright (c) 2018 Intevation GmbH
+
+    Libkleopatra is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License,
+    version 2, as published by the Free Software Foundation.
+
+    Libkleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include "utils/filesystemwatcher_p.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QRegExp>
+#include <QStringList>
+
+#include <functional>
+
+// Measures the black-/whitelist matching FileSystemWatcher does for
+// every changed file, against the previous implementation (one QRegExp
+// per pattern and file) as a baseline. No files are created, so this
+// measures the matching only, not the file system.
+//
+// usage: test_filesystemwatcher [number of file names] [number of rounds]
+
+static bool baseline_matches(const QString &file, const QStringList &patterns)
+{
+    for (const QString &pattern : patterns)
+        if (QRegExp(pattern, Qt::CaseInsensitive, QRegExp::Wildcard).exactMatch(file)) {
+            return true;
+        }
+    return false;
+}
+
+static qint64 measure(const QStringList &files, int rounds, int &matched,
+                      const std::function<bool(const QString &)> &matches)
+{
+    QElapsedTimer timer;
+    timer.start();
+    matched = 0;
+    for (int i = 0; i < rounds; ++i) {
+        for (const QString &file : files) {
+            if (matches(file)) {
+                ++matched;
+            }
+        }
+    }
+    return timer.elapsed();
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    const int numFiles = argc > 1 ? QString::fromLocal8Bit(argv[1]).toInt() : 10000;
+    const int numRounds = argc > 2 ? QString::fromLocal8Bit(argv[2]).toInt() : 20;
+
+    // the names found in a GnuPG home directory with many private keys
+    QStringList files;
+    files.reserve(numFiles + 6);
+    for (int i = 0; i < numFiles; ++i) {
+        files.push_back(QStringLiteral("%1.key").arg(i, 40, 10, QLatin1Char('0')));
+    }
+    files << QStringLiteral("pubring.kbx") << QStringLiteral("pubring.kbx~") << QStringLiteral("trustdb.gpg")
+          << QStringLiteral(".#lk0x1234.host.42") << QStringLiteral("random_seed") << QStringLiteral("S.gpg-agent");
+
+    // typical lists for watching a GnuPG home directory
+    const QStringList whitelist = QStringList() << QStringLiteral("pubring.gpg") << QStringLiteral("pubring.kbx")
+                                  << QStringLiteral("trustdb.gpg") << QStringLiteral("private-keys-v1.d")
+                                  << QStringLiteral("*.key");
+    const QStringList blacklist = QStringList() << QStringLiteral("*.lock") << QStringLiteral("*.tmp")
+                                  << QStringLiteral("*~") << QStringLiteral(".#*");
+
+    Kleo::_detail::PatternMatcher white, black;
+    white.addPatterns(whitelist);
+    black.addPatterns(blacklist);
+
+    int baselineMatched = 0, matched = 0;
+    const qint64 baseline = measure(files, numRounds, baselineMatched, [&](const QString &file) {
+        return !baseline_matches(file, blacklist) && baseline_matches(file, whitelist);
+    });
+    const qint64 compiled = measure(files, numRounds, matched, [&](const QString &file) {
+        return !black.matches(file) && white.matches(file);
+    });
+
+    if (matched != baselineMatched) {
+        qWarning() << "PatternMatcher matched" << matched << "names, the baseline" << baselineMatched;
+        return 1;
+    }
+    qDebug() << numRounds << "rounds of" << files.size() << "names:"
+             << "QRegExp per pattern" << baseline << "ms,"
+             << "PatternMatcher" << compiled << "ms";
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+    test_mailboxlookup.cpp
+
+    This file is part of libkleopatra's test suite.
+    Copyright (c) 2018 Intevation GmbH
+
+    Libkleopatra is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License,
+    version 2, as published by the Free Software Foundation.
+
+    Libkleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#include "models/keycache.h"
+
+#include <gpgme++/key.h>
+#include <gpgme++/keylistresult.h>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QStringList>
+
+#include <algorithm>
+#include <set>
+#include <string>
+
+// Compares looking up the encryption keys of many mailboxes one by one
+// with the bulk lookup, against the keys in the current GnuPG home.
+// The mailboxes are all addresses found in the keyring, each followed
+// by an exact duplicate, an upper case and a mixed case variant, plus
+// as many unknown addresses, up to the requested number. Every mailbox
+// must get the same keys from both lookups, and every variant the same
+// keys as the address it was made from. It also checks that the key
+// flags cached at insert time agree with the gpgme accessors.
+//
+// usage: test_mailboxlookup [number of mailboxes]
+
+static std::vector<std::string> fingerprints(const std::vector<GpgME::Key> &keys)
+{
+    std::vector<std::string> fprs;
+    fprs.reserve(keys.size());
+    for (const GpgME::Key &key : keys) {
+        fprs.push_back(key.primaryFingerprint());
+    }
+    std::sort(fprs.begin(), fprs.end());
+    return fprs;
+}
+
+static QString mixedCase(const QString &address)
+{
+    QString result = address;
+    for (int i = 0; i < result.size(); i += 2) {
+        result[i] = result[i].toUpper();
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    const int numMailboxes = argc > 1 ? QString::fromLocal8Bit(argv[1]).toInt() : 2000;
+
+    const std::shared_ptr<Kleo::KeyCache> cache = Kleo::KeyCache::mutableInstance();
+    QEventLoop loop;
+    QObject::connect(cache.get(), &Kleo::KeyCache::keyListingDone, &loop, &QEventLoop::quit);
+    cache->startKeyListing();
+    loop.exec();
+
+    std::set<QString> known;
+    for (const GpgME::Key &key : cache->keys()) {
+        for (const GpgME::UserID &uid : key.userIDs()) {
+            if (uid.email() && *uid.email()) {
+                known.insert(QString::fromUtf8(uid.email()).remove(QLatin1Char('<')).remove(QLatin1Char('>')));
+            }
+        }
+    }
+
+    // origin[i] is the address mailboxes[i] was made from
+    QStringList mailboxes, origin;
+    for (auto it = known.cbegin(); mailboxes.size() < numMailboxes; ++it) {
+        if (it == known.cend()) {
+            it = known.cbegin();
+            if (it == known.cend()) {
+                break;
+            }
+        }
+        const QString unknown = QStringLiteral("unknown-%1@example.org").arg(mailboxes.size());
+        mailboxes << *it << *it << it->toUpper() << mixedCase(*it) << unknown;
+        origin << *it << *it << *it << *it << unknown;
+    }
+    while (mailboxes.size() < numMailboxes) {
+        const QString unknown = QStringLiteral("unknown-%1@example.org").arg(mailboxes.size());
+        mailboxes << unknown;
+        origin << unknown;
+    }
+    mailboxes = mailboxes.mid(0, numMailboxes);
+    origin = origin.mid(0, numMailboxes);
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector< std::vector<GpgME::Key> > single;
+    single.reserve(mailboxes.size());
+    for (const QString &mb : qAsConst(mailboxes)) {
+        single.push_back(cache->findEncryptionKeysByMailbox(mb));
+    }
+    const qint64 singleTime = timer.nsecsElapsed();
+
+    timer.restart();
+    const std::vector< std::vector<GpgME::Key> > bulk = cache->findEncryptionKeysByMailboxes(mailboxes);
+    const qint64 bulkTime = timer.nsecsElapsed();
+
+    int mismatches = 0;
+    for (const GpgME::Key &key : cache->keys()) {
+        if (cache->keyFlags(key) != Kleo::KeyCache::computeKeyFlags(key)) {
+            qWarning() << "stale key flags for" << key.primaryFingerprint();
+            ++mismatches;
+        }
+    }
+    if (bulk.size() != single.size()) {
+        qWarning() << "bulk lookup returned" << bulk.size() << "results for" << single.size() << "mailboxes";
+        return 1;
+    }
+    int found = 0;
+    for (int i = 0; i < mailboxes.size(); ++i) {
+        const std::vector<std::string> expected = fingerprints(single[i]);
+        if (fingerprints(bulk[i]) != expected) {
+            qWarning() << "bulk and single lookup disagree for" << mailboxes[i];
+            ++mismatches;
+        }
+        if (origin[i] != mailboxes[i]
+            && fingerprints(cache->findEncryptionKeysByMailbox(origin[i])) != expected) {
+            qWarning() << mailboxes[i] << "and" << origin[i] << "have different keys";
+            ++mismatches;
+        }
+        if (!expected.empty()) {
+            ++found;
+        }
+    }
+    if (!known.empty() && !found) {
+        qWarning() << "no mailbox has an encryption key; nothing was compared";
+    }
+
+    qDebug() << mailboxes.size() << "mailboxes," << found << "with keys," << cache->keys().size() << "keys:"
+             << "one by one" << singleTime / 1000 << "us,"
+             << "bulk" << bulkTime / 1000 << "us";
+    return mismatches ? 1 : 0;
+}
@@ -43,12 +43,25 @@
 #include <QByteArrayMatcher>
 #include <QMap>
 #include <QRegularExpression>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
 
 #include <gpgme++/data.h>
 #include <qgpgme/dataprovider.h>
 
+#include <atomic>
+#include <cstring>
 #include <iterator>
 #include <functional>
+#include <memory>
+#include <numeric>
+
+#ifdef Q_OS_UNIX
+# include <cerrno>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
 
 using namespace Kleo::Class;
 
@@ -57,6 +70,11 @@ namespace
 
 const unsigned int ExamineContentHint = 0x8000;
 
+// as much as gpgme_data_identify looks at
+static const int HEADER_SIZE = 4096;
+// don't bother other threads for fewer files than this:
+static const int MIN_FILES_PER_THREAD = 16;
+
 static const struct _classification {
     char extension[4];
     unsigned int classification;
@@ -172,11 +190,8 @@ unsigned int Kleo::classify(const QStringList &fileNames)
     if (fileNames.empty()) {
         return 0;
     }
-    unsigned int result = classify(fileNames.front());
-    for (const QString &fileName : fileNames) {
-        result &= classify(fileName);
-    }
-    return result;
+    const std::vector<unsigned int> classes = classifyFiles(fileNames);
+    return std::accumulate(classes.cbegin(), classes.cend(), classes.front(), std::bit_and<unsigned int>());
 }
 
 static unsigned int classifyExtension(const QFileInfo &fi)
@@ -193,35 +208,77 @@ static unsigned int classifyExtension(const QFileInfo &fi)
                                         : it->classification;
 }
 
-unsigned int Kleo::classify(const QString &filename)
+namespace
 {
-    Q_ASSERT(std::is_sorted(std::begin(classifications), std::end(classifications), ByExtension<std::less>()));
-
-    const QFileInfo fi(filename);
+enum HeaderResult {
+    HeaderRead,
+    FileMissing,
+    FileUnreadable
+};
+}
 
-    if (!fi.exists()) {
-        return 0;
+// reads the first HEADER_SIZE bytes without the QFile/QFileInfo overhead
+static HeaderResult readHeader(const QString &fileName, QByteArray &header)
+{
+#ifdef Q_OS_UNIX
+    const int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT || errno == ENOTDIR ? FileMissing : FileUnreadable;
+    }
+    char buffer[HEADER_SIZE];
+    ssize_t n;
+    do {
+        n = ::pread(fd, buffer, sizeof buffer, 0);
+    } while (n < 0 && errno == EINTR);
+    ::close(fd);
+    if (n < 0) {
+        return FileUnreadable;
+    }
+    header = QByteArray(buffer, n);
+    return HeaderRead;
+#else
+    if (!QFileInfo::exists(fileName)) {
+        return FileMissing;
     }
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return FileUnreadable;
+    }
+    header = file.read(HEADER_SIZE);
+    return HeaderRead;
+#endif
+}
+
+static unsigned int classifyFile(const QString &filename, bool fineGrainedIdentify)
+{
+    const QFileInfo fi(filename);
 
-    QFile file(filename);
     /* The least reliable but always availabe classification */
     const unsigned int extClass = classifyExtension(fi);
-    if (!GpgME::hasFeature(0, GpgME::BinaryAndFineGrainedIdentify) &&
-        !(extClass & ExamineContentHint)) {
+    if (!fineGrainedIdentify && !(extClass & ExamineContentHint)) {
         /* GpgME's identfiy and our internal Classify were so incomplete
          * before BinaryAndFineGrainedIdentify that we are better of
          * to just use the file extension if ExamineContentHint is not set. */
+        if (!fi.exists()) {
+            return 0;
+        }
         qCDebug(LIBKLEO_LOG) << "Classified based only on extension.";
         return extClass;
     }
 
-    if (!file.open(QIODevice::ReadOnly)) {
+    QByteArray header;
+    switch (readHeader(filename, header)) {
+    case FileMissing:
+        return 0;
+    case FileUnreadable:
         qCDebug(LIBKLEO_LOG) << "Failed to open file: " << filename << " for classification.";
         return extClass;
+    case HeaderRead:
+        break;
     }
 
     /* More reliable */
-    const unsigned int contentClass = classifyContent(file.read(4096));
+    const unsigned int contentClass = classifyContent(header);
     if (contentClass != defaultClassification) {
         qCDebug(LIBKLEO_LOG) << "Classified based on content.";
         return contentClass;
@@ -233,6 +290,71 @@ unsigned int Kleo::classify(const QString &filename)
     return extClass;
 }
 
+unsigned int Kleo::classify(const QString &filename)
+{
+    Q_ASSERT(std::is_sorted(std::begin(classifications), std::end(classifications), ByExtension<std::less>()));
+
+    return classifyFile(filename, GpgME::hasFeature(0, GpgME::BinaryAndFineGrainedIdentify));
+}
+
+namespace
+{
+// shared by the caller and the pool threads helping it; the latter may
+// only get to run after the caller returned
+struct ClassifyBatch {
+    ClassifyBatch(const QStringList &names, bool fineGrained)
+        : fileNames(names), results(names.size(), defaultClassification),
+          next(0), done(), fineGrainedIdentify(fineGrained) {}
+
+    void work()
+    {
+        for (int i = next++; i < fileNames.size(); i = next++) {
+            results[i] = classifyFile(fileNames[i], fineGrainedIdentify);
+            done.release();
+        }
+    }
+
+    const QStringList fileNames;
+    std::vector<unsigned int> results;
+    std::atomic<int> next;
+    QSemaphore done;
+    const bool fineGrainedIdentify;
+};
+
+class ClassifyRunnable : public QRunnable
+{
+public:
+    explicit ClassifyRunnable(const std::shared_ptr<ClassifyBatch> &batch) : QRunnable(), m_batch(batch) {}
+
+    void run() override
+    {
+        m_batch->work();
+    }
+
+private:
+    const std::shared_ptr<ClassifyBatch> m_batch;
+};
+}
+
+std::vector<unsigned int> Kleo::classifyFiles(const QStringList &fileNames)
+{
+    Q_ASSERT(std::is_sorted(std::begin(classifications), std::end(classifications), ByExtension<std::less>()));
+
+    const std::shared_ptr<ClassifyBatch> batch
+        = std::make_shared<ClassifyBatch>(fileNames, GpgME::hasFeature(0, GpgME::BinaryAndFineGrainedIdentify));
+
+    QThreadPool *const pool = QThreadPool::globalInstance();
+    const int helpers = qMin(pool->maxThreadCount(), (fileNames.size() - 1) / MIN_FILES_PER_THREAD);
+    for (int i = 0; i < helpers; ++i) {
+        pool->start(new ClassifyRunnable(batch));
+    }
+
+    // work along, so that this finishes even if the pool is busy:
+    batch->work();
+    batch->done.acquire(fileNames.size());
+    return batch->results;
+}
+
 static unsigned int classifyContentInteral(const QByteArray &data)
 {
     Q_ASSERT(std::is_sorted(std::begin(content_classifications), std::end(content_classifications), ByContent<std::less>(100)));
@@ -265,6 +387,58 @@ static unsigned int classifyContentInteral(const QByteArray &data)
     return defaultClassification;
 }
 
+/* Answers the cheap and common cases of gpgme_data_identify without
+ * setting up a GpgME::Data: plain files, which gpgme does not know, and
+ * the armor headers whose type gpgme takes from the header alone.
+ * Returns false if gpgme needs to look itself (binary OpenPGP packets,
+ * DER, armored PGP messages, ...). */
+static bool quickIdentify(const QByteArray &data, GpgME::Data::Type &type)
+{
+    if (data.size() < 24) { // too short for gpgme to look at
+        type = GpgME::Data::Unknown;
+        return true;
+    }
+    const unsigned char first = data.at(0);
+    if ((first & 0x80) || first == 0x30 || first == 0x3f) {
+        return false; // may be an OpenPGP packet or a BER encoded SEQUENCE
+    }
+
+    static const struct {
+        const char *header;
+        GpgME::Data::Type type;
+    } armors[] = {
+        { "PGP SIGNATURE-----",         GpgME::Data::PGPSignature },
+        { "PGP SIGNED MESSAGE-----",    GpgME::Data::PGPSigned },
+        { "PGP PUBLIC KEY BLOCK-----",  GpgME::Data::PGPKey },
+        { "PGP PRIVATE KEY BLOCK-----", GpgME::Data::PGPKey },
+        { "CERTIFICATE-----",           GpgME::Data::X509Cert },
+    };
+
+    // like gpgme, only look at line starts up to the first NUL
+    const char *const begin = data.constData();
+    const char *const end = begin + qstrnlen(begin, data.size());
+    for (const char *line = begin; line < end;) {
+        if (end - line >= 11 && qstrncmp(line, "-----BEGIN ", 11) == 0) {
+            const char *const rest = line + 11;
+            for (const auto &armor : armors) {
+                const int len = qstrlen(armor.header);
+                if (end - rest >= len && qstrncmp(rest, armor.header, len) == 0) {
+                    type = armor.type;
+                    return true;
+                }
+            }
+            return false;
+        }
+        const char *const nl = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (!nl) {
+            break;
+        }
+        line = nl + 1;
+    }
+    type = GpgME::Data::Unknown;
+    return true;
+}
+
 unsigned int Kleo::classifyContent(const QByteArray &data)
 {
     /* As of Version 1.6.0 GpgME does not distinguish between detached
@@ -281,9 +455,12 @@ unsigned int Kleo::classifyContent(const QByteArray &data)
             return ourClassification;
         }
     }
-    QGpgME::QByteArrayDataProvider dp(data);
-    GpgME::Data gpgmeData(&dp);
-    GpgME::Data::Type type = gpgmeData.type();
+    GpgME::Data::Type type;
+    if (!quickIdentify(data, type)) {
+        QGpgME::QByteArrayDataProvider dp(data);
+        GpgME::Data gpgmeData(&dp);
+        type = gpgmeData.type();
+    }
 
     return gpgmeTypeMap.value(type, defaultClassification);
 }
@@ -39,6 +39,8 @@
 
 #include <kleo_export.h>
 
+#include <vector>
+
 class QString;
 class QStringList;
 
@@ -92,6 +94,8 @@ enum {
 
 KLEO_EXPORT unsigned int classify(const QString &filename);
 KLEO_EXPORT unsigned int classify(const QStringList &fileNames);
+/** Classify each of \a fileNames, in parallel; the result is in the same order. */
+KLEO_EXPORT std::vector<unsigned int> classifyFiles(const QStringList &fileNames);
 KLEO_EXPORT unsigned int classifyContent(const QByteArray &data);
 
 KLEO_EXPORT QString findSignedData(const QString &signatureFileName);
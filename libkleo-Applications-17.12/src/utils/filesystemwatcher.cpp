@@ -31,6 +31,7 @@
 */
 
 #include "filesystemwatcher.h"
+#include "filesystemwatcher_p.h"
 #include "kleo/stl_util.h"
 
 #include <libkleo_debug.h>
@@ -40,10 +41,149 @@
 #include <QStringList>
 #include <QTimer>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 
 #include <set>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+# include <QHash>
+# include <QSocketNotifier>
+# include <functional>
+# include <sys/inotify.h>
+# include <unistd.h>
+# include <cerrno>
+# include <cstring>
+#endif
 
 using namespace Kleo;
+using Kleo::_detail::PatternMatcher;
+
+namespace
+{
+#ifdef Q_OS_LINUX
+// Watches directories (never single files) through inotify and reports
+// the name of each changed entry, so that a change in a directory with
+// many files neither needs one watch per file nor a re-listing of the
+// whole directory.
+class InotifyWatcher
+{
+public:
+    //! \a entry is empty if events were lost and all of \a dir may have changed
+    typedef std::function<void(const QString &dir, const QString &entry, bool createdOrRemoved)> Callback;
+
+    static InotifyWatcher *create(const Callback &callback)
+    {
+        const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+            qCDebug(LIBKLEO_LOG) << "inotify_init1 failed:" << strerror(errno);
+            return nullptr;
+        }
+        return new InotifyWatcher(fd, callback);
+    }
+
+    ~InotifyWatcher()
+    {
+        ::close(m_fd);
+    }
+
+    void addDirectory(const QString &path)
+    {
+        if (m_wds.contains(path)) {
+            return;
+        }
+        static const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                                     | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+        const int wd = inotify_add_watch(m_fd, QFile::encodeName(path).constData(), mask);
+        if (wd < 0) {
+            qCDebug(LIBKLEO_LOG) << "inotify_add_watch" << path << "failed:" << strerror(errno);
+            return;
+        }
+        m_dirs.insert(wd, path);
+        m_wds.insert(path, wd);
+    }
+
+    void removeDirectory(const QString &path)
+    {
+        const auto it = m_wds.find(path);
+        if (it == m_wds.end()) {
+            return;
+        }
+        inotify_rm_watch(m_fd, *it);
+        m_dirs.remove(*it);
+        m_wds.erase(it);
+    }
+
+private:
+    InotifyWatcher(int fd, const Callback &callback)
+        : m_fd(fd),
+          m_notifier(fd, QSocketNotifier::Read),
+          m_callback(callback)
+    {
+        QObject::connect(&m_notifier, &QSocketNotifier::activated,
+                         &m_notifier, [this]() { readEvents(); });
+    }
+
+    void readEvents()
+    {
+        alignas(struct inotify_event) char buffer[4096];
+        Q_FOREVER {
+            const ssize_t n = ::read(m_fd, buffer, sizeof buffer);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            for (const char *p = buffer; p < buffer + n;) {
+                const struct inotify_event *const ev = reinterpret_cast<const struct inotify_event *>(p);
+                p += sizeof(struct inotify_event) + ev->len;
+                handleEvent(ev);
+            }
+        }
+    }
+
+    void handleEvent(const struct inotify_event *ev)
+    {
+        if (ev->mask & IN_Q_OVERFLOW) {
+            const QStringList dirs = m_dirs.values();
+            for (const QString &dir : dirs) {
+                m_callback(dir, QString(), true);
+            }
+            return;
+        }
+        const auto it = m_dirs.constFind(ev->wd);
+        if (it == m_dirs.cend()) {
+            return;
+        }
+        const QString dir = *it;
+        if (ev->mask & IN_IGNORED) {
+            // watch removed by the kernel, e.g. because dir was deleted
+            m_wds.remove(dir);
+            m_dirs.remove(ev->wd);
+            return;
+        }
+        if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            m_callback(dir, QString(), true);
+            return;
+        }
+        if (ev->len == 0) {
+            return;
+        }
+        m_callback(dir, QFile::decodeName(ev->name),
+                   ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO));
+    }
+
+private:
+    const int m_fd;
+    QSocketNotifier m_notifier;
+    const Callback m_callback;
+    QHash<int, QString> m_dirs; // watch descriptor -> path
+    QHash<QString, int> m_wds;  // path -> watch descriptor
+};
+#endif // Q_OS_LINUX
+}
 
 class FileSystemWatcher::Private
 {
@@ -53,6 +193,9 @@ public:
     ~Private()
     {
         delete m_watcher;
+#ifdef Q_OS_LINUX
+        delete m_inotify;
+#endif
     }
 
     void onFileChanged(const QString &path);
@@ -62,12 +205,26 @@ public:
 
     void connectWatcher();
 
+    void createWatcher();
+    void destroyWatcher();
+    void watch(const QStringList &paths);
+    void unwatch(const QStringList &paths);
+
+#ifdef Q_OS_LINUX
+    void onEntryChanged(const QString &dir, const QString &entry, bool createdOrRemoved);
+    bool needsDirectoryWatch(const QString &dir) const;
+
+    InotifyWatcher *m_inotify = nullptr;
+    std::set<QString> m_watchedDirectories;
+    std::set<QString> m_watchedFiles;
+#endif
     QFileSystemWatcher *m_watcher = nullptr;
     QTimer m_timer;
     std::set<QString> m_seenPaths;
     std::set<QString> m_cachedDirectories;
     std::set<QString> m_cachedFiles;
-    QStringList m_paths, m_blacklist, m_whitelist;
+    QStringList m_paths;
+    PatternMatcher m_blacklist, m_whitelist;
 };
 
 FileSystemWatcher::Private::Private(FileSystemWatcher *qq, const QStringList &paths)
@@ -79,26 +236,17 @@ FileSystemWatcher::Private::Private(FileSystemWatcher *qq, const QStringList &pa
     connect(&m_timer, &QTimer::timeout, q, [this]() { onTimeout(); });
 }
 
-static bool is_matching(const QString &file, const QStringList &list)
-{
-    for (const QString &entry : list)
-        if (QRegExp(entry, Qt::CaseInsensitive, QRegExp::Wildcard).exactMatch(file)) {
-            return true;
-        }
-    return false;
-}
-
-static bool is_blacklisted(const QString &file, const QStringList &blacklist)
+static bool is_blacklisted(const QString &file, const PatternMatcher &blacklist)
 {
-    return is_matching(file, blacklist);
+    return blacklist.matches(file);
 }
 
-static bool is_whitelisted(const QString &file, const QStringList &whitelist)
+static bool is_whitelisted(const QString &file, const PatternMatcher &whitelist)
 {
-    if (whitelist.empty()) {
+    if (whitelist.isEmpty()) {
         return true;    // special case
     }
-    return is_matching(file, whitelist);
+    return whitelist.matches(file);
 }
 
 void FileSystemWatcher::Private::onFileChanged(const QString &path)
@@ -116,7 +264,7 @@ void FileSystemWatcher::Private::onFileChanged(const QString &path)
     handleTimer();
 }
 
-static QStringList list_dir_absolute(const QString &path, const QStringList &blacklist, const QStringList &whitelist)
+static QStringList list_dir_absolute(const QString &path, const PatternMatcher &blacklist, const PatternMatcher &whitelist)
 {
     QDir dir(path);
     QStringList entries = dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot);
@@ -125,7 +273,7 @@ static QStringList list_dir_absolute(const QString &path, const QStringList &bla
                        [&blacklist](const QString &entry) {
                            return is_blacklisted(entry, blacklist);
                        });
-    if (!whitelist.empty())
+    if (!whitelist.isEmpty())
         end = std::remove_if(entries.begin(), end,
                              [&whitelist](const QString &entry) {
                                  return !is_whitelisted(entry, whitelist);
@@ -167,6 +315,54 @@ void FileSystemWatcher::Private::onDirectoryChanged(const QString &path)
     handleTimer();
 }
 
+#ifdef Q_OS_LINUX
+void FileSystemWatcher::Private::onEntryChanged(const QString &dir, const QString &entry, bool createdOrRemoved)
+{
+    if (entry.isEmpty()) {
+        // events were lost; fall back to comparing directory listings
+        if (m_watchedDirectories.count(dir)) {
+            onDirectoryChanged(dir);
+        }
+        return;
+    }
+    if (is_blacklisted(entry, m_blacklist) || !is_whitelisted(entry, m_whitelist)) {
+        return;
+    }
+    const QString path = dir + QLatin1Char('/') + entry;
+    const bool wholeDirectory = m_watchedDirectories.count(dir);
+    if (!wholeDirectory && !m_watchedFiles.count(path)) {
+        return;
+    }
+
+    qCDebug(LIBKLEO_LOG) << path << (createdOrRemoved ? "created or removed" : "changed");
+    m_cachedFiles.insert(path);
+    if (createdOrRemoved) {
+        m_cachedDirectories.insert(dir);
+        if (wholeDirectory && !m_seenPaths.count(path) && QFileInfo(path).isDir()) {
+            q->addPath(path);
+        }
+    }
+    m_seenPaths.insert(path);
+    handleTimer();
+}
+
+bool FileSystemWatcher::Private::needsDirectoryWatch(const QString &dir) const
+{
+    if (m_watchedDirectories.count(dir)) {
+        return true;
+    }
+    // the files below dir, including those in its subdirectories, are a
+    // contiguous range of the sorted set
+    const QString prefix = dir + QLatin1Char('/');
+    for (auto it = m_watchedFiles.lower_bound(prefix); it != m_watchedFiles.end() && it->startsWith(prefix); ++it) {
+        if (it->indexOf(QLatin1Char('/'), prefix.size()) < 0) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
 void FileSystemWatcher::Private::onTimeout()
 {
     std::set<QString> dirs, files;
@@ -197,6 +393,90 @@ void FileSystemWatcher::Private::handleTimer()
     m_timer.start();
 }
 
+void FileSystemWatcher::Private::createWatcher()
+{
+#ifdef Q_OS_LINUX
+    Q_ASSERT(!m_inotify);
+    m_inotify = InotifyWatcher::create([this](const QString &dir, const QString &entry, bool createdOrRemoved) {
+                                           onEntryChanged(dir, entry, createdOrRemoved);
+                                       });
+    if (m_inotify) {
+        return;
+    }
+#endif
+    Q_ASSERT(!m_watcher);
+    m_watcher = new QFileSystemWatcher;
+    connectWatcher();
+}
+
+void FileSystemWatcher::Private::destroyWatcher()
+{
+#ifdef Q_OS_LINUX
+    delete m_inotify;
+    m_inotify = nullptr;
+    m_watchedDirectories.clear();
+    m_watchedFiles.clear();
+#endif
+    delete m_watcher;
+    m_watcher = nullptr;
+}
+
+void FileSystemWatcher::Private::watch(const QStringList &paths)
+{
+    if (paths.empty()) {
+        return;
+    }
+#ifdef Q_OS_LINUX
+    if (m_inotify) {
+        for (const QString &path : paths) {
+            const QFileInfo fi(path);
+            if (fi.isDir()) {
+                const QString dir = fi.absoluteFilePath();
+                m_watchedDirectories.insert(dir);
+                m_inotify->addDirectory(dir);
+            } else {
+                m_watchedFiles.insert(fi.absoluteFilePath());
+                m_inotify->addDirectory(fi.absolutePath());
+            }
+        }
+        return;
+    }
+#endif
+    if (m_watcher) {
+        m_watcher->addPaths(paths);
+    }
+}
+
+void FileSystemWatcher::Private::unwatch(const QStringList &paths)
+{
+    if (paths.empty()) {
+        return;
+    }
+#ifdef Q_OS_LINUX
+    if (m_inotify) {
+        for (const QString &path : paths) {
+            const QString abs = QFileInfo(path).absoluteFilePath();
+            QString dir;
+            if (m_watchedDirectories.erase(abs)) {
+                dir = abs;
+            } else if (m_watchedFiles.erase(abs)) {
+                dir = QFileInfo(abs).absolutePath();
+            } else {
+                continue;
+            }
+            // the watch on a directory also serves the files watched in it
+            if (!needsDirectoryWatch(dir)) {
+                m_inotify->removeDirectory(dir);
+            }
+        }
+        return;
+    }
+#endif
+    if (m_watcher) {
+        m_watcher->removePaths(paths);
+    }
+}
+
 void FileSystemWatcher::Private::connectWatcher()
 {
     if (!m_watcher) {
@@ -224,21 +504,20 @@ void FileSystemWatcher::setEnabled(bool enable)
         return;
     }
     if (enable) {
-        Q_ASSERT(!d->m_watcher);
-        d->m_watcher = new QFileSystemWatcher;
-        if (!d->m_paths.empty()) {
-            d->m_watcher->addPaths(d->m_paths);
-        }
-        d->connectWatcher();
+        d->createWatcher();
+        d->watch(d->m_paths);
     } else {
-        Q_ASSERT(d->m_watcher);
-        delete d->m_watcher;
-        d->m_watcher = nullptr;
+        d->destroyWatcher();
     }
 }
 
 bool FileSystemWatcher::isEnabled() const
 {
+#ifdef Q_OS_LINUX
+    if (d->m_inotify) {
+        return true;
+    }
+#endif
     return d->m_watcher != nullptr;
 }
 
@@ -259,27 +538,25 @@ int FileSystemWatcher::delay() const
 
 void FileSystemWatcher::blacklistFiles(const QStringList &paths)
 {
-    d->m_blacklist += paths;
+    d->m_blacklist.addPatterns(paths);
     QStringList blacklisted;
     d->m_paths.erase(kdtools::separate_if(d->m_paths.begin(), d->m_paths.end(),
                                           std::back_inserter(blacklisted), d->m_paths.begin(),
                                           [this](const QString &path) {
                                               return is_blacklisted(path, d->m_blacklist);
                                           }).second, d->m_paths.end());
-    if (d->m_watcher && !blacklisted.empty()) {
-        d->m_watcher->removePaths(blacklisted);
-    }
+    d->unwatch(blacklisted);
 }
 
 void FileSystemWatcher::whitelistFiles(const QStringList &patterns)
 {
-    d->m_whitelist += patterns;
+    d->m_whitelist.addPatterns(patterns);
     // ### would be nice to add newly-matching paths here right away,
     // ### but it's not as simple as blacklisting above, esp. since we
     // ### don't want to subject addPath()'ed paths to whitelisting.
 }
 
-static QStringList resolve(const QStringList &paths, const QStringList &blacklist, const QStringList &whitelist)
+static QStringList resolve(const QStringList &paths, const PatternMatcher &blacklist, const PatternMatcher &whitelist)
 {
     if (paths.empty()) {
         return QStringList();
@@ -303,9 +580,7 @@ void FileSystemWatcher::addPaths(const QStringList &paths)
     }
     d->m_paths += newPaths;
     d->m_seenPaths.insert(newPaths.begin(), newPaths.end());
-    if (d->m_watcher && !newPaths.empty()) {
-        d->m_watcher->addPaths(newPaths);
-    }
+    d->watch(newPaths);
 }
 
 void FileSystemWatcher::addPath(const QString &path)
@@ -321,9 +596,7 @@ void FileSystemWatcher::removePaths(const QStringList &paths)
     for (const QString &i : paths) {
         d->m_paths.removeAll(i);
     }
-    if (d->m_watcher) {
-        d->m_watcher->removePaths(paths);
-    }
+    d->unwatch(paths);
 }
 
 void FileSystemWatcher::removePath(const QString &path)
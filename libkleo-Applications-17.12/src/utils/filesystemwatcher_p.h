@@ -0,0 +1,122 @@
+/* -*- mode: c++; c-basic-offset:4 -*-
+    utils/filesystemwatcher_p.h
+
+    This file is part of Kleopatra, the KDE keymanager
+    Copyright (c) 2018 Intevation GmbH
+
+    Kleopatra is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kleopatra is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of this program with any edition of
+    the Qt library by Trolltech AS, Norway (or with modified versions
+    of Qt that use the same license as Qt), and distribute linked
+    combinations including the two.  You must obey the GNU General
+    Public License in all respects for all of the code used other than
+    Qt.  If you modify this file, you may extend this exception to
+    your version of the file, but you are not obligated to do so.  If
+    you do not wish to do so, delete this exception statement from
+    your version.
+*/
+
+#ifndef __KLEOPATRA_UTILS_FILESYSTEMWATCHER_P_H__
+#define __KLEOPATRA_UTILS_FILESYSTEMWATCHER_P_H__
+
+#include <QRegExp>
+#include <QString>
+#include <QStringList>
+#include <QStringRef>
+
+#include <vector>
+
+namespace Kleo
+{
+namespace _detail
+{
+
+// Matches file names against a list of wildcard patterns (case
+// insensitive). The patterns are compiled once: plain names, "prefix*"
+// and "*suffix" patterns (e.g. "*.key") are checked with simple string
+// comparisons, which don't allocate; only the remaining patterns fall
+// back to QRegExp.
+class PatternMatcher
+{
+public:
+    void addPatterns(const QStringList &patterns)
+    {
+        for (const QString &pattern : patterns) {
+            addPattern(pattern);
+        }
+    }
+
+    bool isEmpty() const
+    {
+        return m_names.empty() && m_prefixes.empty() && m_suffixes.empty() && m_regexps.empty();
+    }
+
+    bool matches(const QString &file) const
+    {
+        for (const QString &name : m_names)
+            if (QString::compare(file, name, Qt::CaseInsensitive) == 0) {
+                return true;
+            }
+        for (const QString &suffix : m_suffixes)
+            if (file.endsWith(suffix, Qt::CaseInsensitive)) {
+                return true;
+            }
+        for (const QString &prefix : m_prefixes)
+            if (file.startsWith(prefix, Qt::CaseInsensitive)) {
+                return true;
+            }
+        for (const QRegExp &rx : m_regexps)
+            if (rx.exactMatch(file)) {
+                return true;
+            }
+        return false;
+    }
+
+private:
+    static bool hasWildcards(const QStringRef &s)
+    {
+        for (const QChar &ch : s)
+            if (ch == QLatin1Char('*') || ch == QLatin1Char('?') || ch == QLatin1Char('[')) {
+                return true;
+            }
+        return false;
+    }
+
+    void addPattern(const QString &pattern)
+    {
+        if (!hasWildcards(QStringRef(&pattern))) {
+            m_names.push_back(pattern);
+        } else if (pattern.startsWith(QLatin1Char('*')) && !hasWildcards(pattern.midRef(1))) {
+            m_suffixes.push_back(pattern.mid(1));
+        } else if (pattern.endsWith(QLatin1Char('*')) && !hasWildcards(pattern.leftRef(pattern.size() - 1))) {
+            m_prefixes.push_back(pattern.left(pattern.size() - 1));
+        } else {
+            m_regexps.push_back(QRegExp(pattern, Qt::CaseInsensitive, QRegExp::Wildcard));
+        }
+    }
+
+private:
+    std::vector<QString> m_names;
+    std::vector<QString> m_prefixes;
+    std::vector<QString> m_suffixes;
+    std::vector<QRegExp> m_regexps;
+};
+
+}
+}
+
+#endif // __KLEOPATRA_UTILS_FILESYSTEMWATCHER_P_H__